@@ -35,6 +35,7 @@ struct timeval {
 #include <assert.h>
 
 #include "os-features.h"
+#include "an-thread.h" //# Modified by Robert Lancaster for the StellarSolver Internal Library
 #include "blind.h"
 #include "tweak.h"
 #include "tweak2.h"
@@ -245,6 +246,28 @@ void blind_set_cancel_file(blind_t* bp, const char* fn) {
     bp->cancelfname = strdup_safe(fn);
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+void blind_set_cancel_flag(blind_t* bp, const int* flag) {
+    bp->cancel_flag = flag;
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+void blind_set_solved_flag(blind_t* bp, const int* flag,
+                           void (*callback)(void*), void* userdata) {
+    bp->solved_flag = flag;
+    bp->solved_callback = callback;
+    bp->solved_userdata = userdata;
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+static anbool cancel_flag_is_set(blind_t* bp) {
+    if (an_flag_is_set(bp->cancel_flag)) {
+        bp->cancelled = TRUE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
 void blind_set_match_file(blind_t* bp, const char* fn) {
     free(bp->matchfname);
     bp->matchfname = strdup_safe(fn);
@@ -488,7 +511,7 @@ void blind_run(blind_t* bp) {
                 break;
             if (bp->single_field_solved)
                 break;
-            if (bp->cancelled)
+            if (bp->cancelled || cancel_flag_is_set(bp))
                 break;
 
             // Load the index...
@@ -591,11 +614,15 @@ int blind_parameters_are_sane(blind_t* bp, solver_t* sp) {
 int blind_is_run_obsolete(blind_t* bp, solver_t* sp) {
     // If we're just solving one field, check to see if it's already
     // solved before doing a bunch of work and spewing tons of output.
-    if ((il_size(bp->fieldlist) == 1) && bp->solved_in) {
+    if ((il_size(bp->fieldlist) == 1) && (bp->solved_in || bp->solved_flag)) {
         if (is_field_solved(bp, il_get(bp->fieldlist, 0)))
             return 1;
     }
     // Early check to see if this job was cancelled.
+    if (cancel_flag_is_set(bp)) {
+        logerr("Run cancelled.\n");
+        return 1;
+    }
     if (bp->cancelfname) {
         if (file_exists(bp->cancelfname)) {
             logerr("Run cancelled.\n");
@@ -871,6 +898,8 @@ static time_t timer_callback(void* user_data) {
     // check if the field has already been solved...
     if (is_field_solved(bp, bp->fieldnum))
         return 0;
+    if (cancel_flag_is_set(bp))
+        return 0;
     if (bp->cancelfname && file_exists(bp->cancelfname)) {
         bp->cancelled = TRUE;
         logmsg("File \"%s\" exists: cancelling.\n", bp->cancelfname);
@@ -1002,11 +1031,14 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
         sp->numscaleok = 0;
         sp->num_cxdx_skipped = 0;
         sp->num_verified = 0;
+        sp->num_fast_rejected = 0; //# Modified by Robert Lancaster for the StellarSolver Internal Library
         sp->quit_now = FALSE;
         sp->mo_template = &template ;
         sp->record_match_callback = record_match_callback;
         sp->timer_callback = timer_callback;
         sp->userdata = bp;
+        sp->cancel_flag = bp->cancel_flag; //# Modified by Robert Lancaster for the StellarSolver Internal Library
+        sp->solved_flag = bp->solved_flag; //# Modified by Robert Lancaster for the StellarSolver Internal Library
         solver_reset_best_match(sp);
 
         bp->fieldnum = fieldnum;
@@ -1027,9 +1059,12 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
 
             // The real thing
             solver_run(sp);
+            cancel_flag_is_set(bp); //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
             logverb("Field %i: tried %i quads, matched %i codes.\n",
                     fieldnum, sp->numtries, sp->nummatches);
+            logverb("Field %i: %i of %i verified hits were rejected by the quick check.\n",
+                    fieldnum, sp->num_fast_rejected, sp->num_verified); //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
             if (sp->maxquads && sp->numtries >= sp->maxquads)
                 logmsg("  exceeded the number of quads to try: %i >= %i.\n",
@@ -1088,6 +1123,11 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
 
 static anbool is_field_solved(blind_t* bp, int fieldnum) {
     anbool solved = FALSE;
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (an_flag_is_set(bp->solved_flag)) {
+        logmsg("Field %i: field has been solved by another solver.\n", fieldnum);
+        return TRUE;
+    }
     if (bp->solved_in) {
         solved = solvedfile_get(bp->solved_in, fieldnum);
         logverb("Checking %s file %i to see if the field is solved: %s.\n",
@@ -1118,6 +1158,9 @@ static void solved_field(blind_t* bp, int fieldnum) {
     if (bp->solvedserver) {
         solvedclient_set(bp->fieldid, fieldnum);
     }
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (bp->solved_callback)
+        bp->solved_callback(bp->solved_userdata);
     // If we're just solving a single field, and we solved it...
     if (il_size(bp->fieldlist) == 1)
         bp->single_field_solved = TRUE;
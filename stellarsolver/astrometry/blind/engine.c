@@ -212,11 +212,40 @@ int engine_add_index(engine_t* engine, char* path) {
     return 0;
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+//This adds an index that was already fully loaded by the caller, for example from the StellarSolver index cache.
+//The caller keeps ownership of it, so it does not go in the free_indexes list.
+int engine_add_loaded_index(engine_t* engine, index_t* ind) {
+    if (!ind)
+        return -1;
+    if (add_index(engine, ind)) {
+        ERROR("Failed to add index \"%s\"", ind->indexname);
+        return -1;
+    }
+    return 0;
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+//This adds an index whose metadata was filled in by the caller from the StellarSolver index catalogue,
+//so that the file itself doesn't have to be opened until a job uses it.  The engine frees it.
+int engine_add_index_metadata(engine_t* engine, index_t* ind) {
+    if (!ind || !ind->indexname)
+        return -1;
+    if (add_index(engine, ind)) {
+        ERROR("Failed to add index \"%s\"", ind->indexname);
+        return -1;
+    }
+    pl_append(engine->free_indexes, ind);
+    return 0;
+}
+
 static void add_index_to_blind(engine_t* engine, blind_t* bp,
                                int i) {
     index_t* index;
     index = pl_get(engine->indexes, i);
-    if (engine->inparallel) {
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    //Indexes that are already fully loaded (ie. from the index cache) are handed to blind directly instead of being reloaded by name.
+    if (engine->inparallel || index->codekd) {
         blind_add_loaded_index(bp, index);
     } else {
         blind_add_index(bp, index->indexname);
@@ -963,6 +992,30 @@ void engine_free(engine_t* engine) {
     free(engine);
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+//This puts the engine back the way engine_new left it, so a solver that is kept around between solves doesn't need a new one.
+void engine_reset(engine_t* engine) {
+    int i;
+    if (!engine)
+        return;
+    for (i=0; i<pl_size(engine->free_indexes); i++)
+        index_free(pl_get(engine->free_indexes, i));
+    pl_remove_all(engine->free_indexes);
+    for (i=0; i<pl_size(engine->free_mindexes); i++)
+        multiindex_free(pl_get(engine->free_mindexes, i));
+    pl_remove_all(engine->free_mindexes);
+    pl_remove_all(engine->indexes);
+    sl_remove_all(engine->index_paths);
+    il_remove_all(engine->ismallest);
+    il_remove_all(engine->ibiggest);
+    engine->sizesmallest = HUGE_VAL;
+    engine->sizebiggest = -HUGE_VAL;
+    engine->minwidth = 0.1;
+    engine->maxwidth = 180.0;
+    engine->cpulimit = 600.0;
+    engine->inparallel = FALSE;
+}
+
 job_t* engine_read_job_file(engine_t* engine, const char* jobfn) {
     qfits_header* hdr;
     job_t* job;
@@ -6,6 +6,8 @@
 #ifndef PQUAD_H
 #define PQUAD_H
 
+#include <stdint.h>
+
 /**
  This file is just required for testing purposes (of solver.c)
  */
@@ -19,9 +21,14 @@ struct potential_quad
 	double costheta, sintheta;
 	// (field pixel noise / quad scale in pixels)^2
 	double rel_field_noise2;
-	anbool* inbox;
+	//# Modified by Robert Lancaster for the StellarSolver Internal Library
+	// "inbox" is a bitset with one bit per field star, and "x", "y" are
+	// the code-frame positions of the stars in the box.  All three point
+	// into the solver's arena rather than being allocated for each pair.
+	uint32_t* inbox;
 	int ninbox;
-	double* xy;
+	double* x;
+	double* y;
 };
 typedef struct potential_quad pquad;
 
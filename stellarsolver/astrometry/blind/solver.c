@@ -17,6 +17,7 @@
 #include <stdarg.h>
 
 #include "os-features.h"
+#include "an-thread.h" //# Modified by Robert Lancaster for the StellarSolver Internal Library
 #include "ioutils.h"
 #include "mathutil.h"
 #include "matchobj.h"
@@ -251,6 +252,7 @@ void solver_log_params(const solver_t* sp) {
     logverb("  Log tune-up threshold: %g\n", sp->logratio_totune);
     logverb("  Log bail threshold: %g\n", sp->logratio_bail_threshold);
     logverb("  Log stoplooking threshold: %g\n", sp->logratio_stoplooking);
+    logverb("  Quick verification: %i reference stars, log bail threshold %g\n", sp->verify_fast_nrefs, sp->logratio_fast_bail);
     logverb("  Maxquads %i\n", sp->maxquads);
     logverb("  Maxmatches %i\n", sp->maxmatches);
     logverb("  Set CRPIX? %s", sp->set_crpix ? "yes" : "no\n");
@@ -375,6 +377,7 @@ void solver_reset_counters(solver_t* s) {
     s->num_radec_skipped = 0;
     s->num_abscale_skipped = 0;
     s->num_verified = 0;
+    s->num_fast_rejected = 0;
 }
 
 double solver_field_width(const solver_t* s) {
@@ -533,9 +536,22 @@ static void try_all_codes(const pquad* pq,
                           const int* fieldstars, int dimquad,
                           solver_t* solver, double tol2);
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// The codes of one quad, collected so that the code tree can be searched
+// for all of them at once.  The results go in the solver's code_results.
+typedef struct {
+    int n;
+    int stars[SOLVER_MAX_QUAD_CODES][DQMAX];
+    anbool parity[SOLVER_MAX_QUAD_CODES];
+    double codes[SOLVER_MAX_QUAD_CODES * DCMAX];
+} code_batch_t;
+
+static void free_code_search(solver_t* solver);
+
 static void try_all_codes_2(const int* fieldstars, int dimquad,
                             const double* code, solver_t* solver,
-                            anbool current_parity, double tol2);
+                            anbool current_parity, double tol2,
+                            code_batch_t* batch);
 
 static void try_permutations(const int* origstars, int dimquad,
                              const double* origcode,
@@ -543,13 +559,103 @@ static void try_permutations(const int* origstars, int dimquad,
                              double tol2,
                              int* stars, double* code,
                              int slot, anbool* placed,
-                             kdtree_qres_t** presult);
+                             code_batch_t* batch);
+
+static void search_code_batch(code_batch_t* batch, int dimquad,
+                              solver_t* solver, double tol2);
 
 static void resolve_matches(kdtree_qres_t* krez, const double *field,
                             const int* fstars, int dimquads,
                             solver_t* solver, anbool current_parity);
 
 static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip, anbool fake_match);
+static anbool solver_check_hit(solver_t* sp, MatchObj* mo, sip_t* sip, anbool fake_match);
+static int solver_record_hit(solver_t* sp, MatchObj* mo);
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// The counters a piece of work adds to the solver's totals.
+typedef struct {
+    int numtries;
+    int nummatches;
+    int numscaleok;
+    int num_cxdx_skipped;
+    int num_meanx_skipped;
+    int num_radec_skipped;
+    int num_abscale_skipped;
+    int num_verified;
+    int num_fast_rejected;
+    double best_logodds;
+} solver_counts_t;
+
+// A hit that was kept while working in parallel, with the counters of its
+// piece of work at the time, so it can be recorded just as it would have been.
+typedef struct {
+    MatchObj mo;
+    solver_counts_t counts;
+} pending_hit_t;
+
+static void get_counts(const solver_t* s, solver_counts_t* counts) {
+    counts->numtries = s->numtries;
+    counts->nummatches = s->nummatches;
+    counts->numscaleok = s->numscaleok;
+    counts->num_cxdx_skipped = s->num_cxdx_skipped;
+    counts->num_meanx_skipped = s->num_meanx_skipped;
+    counts->num_radec_skipped = s->num_radec_skipped;
+    counts->num_abscale_skipped = s->num_abscale_skipped;
+    counts->num_verified = s->num_verified;
+    counts->num_fast_rejected = s->num_fast_rejected;
+    counts->best_logodds = s->best_logodds;
+}
+
+static void add_counts(solver_t* s, const solver_counts_t* counts) {
+    s->numtries += counts->numtries;
+    s->nummatches += counts->nummatches;
+    s->numscaleok += counts->numscaleok;
+    s->num_cxdx_skipped += counts->num_cxdx_skipped;
+    s->num_meanx_skipped += counts->num_meanx_skipped;
+    s->num_radec_skipped += counts->num_radec_skipped;
+    s->num_abscale_skipped += counts->num_abscale_skipped;
+    s->num_verified += counts->num_verified;
+    s->num_fast_rejected += counts->num_fast_rejected;
+    s->best_logodds = MAX(s->best_logodds, counts->best_logodds);
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// The "inbox" of a pquad is a bitset with one bit per field star.
+static inline anbool inbox_get(const uint32_t* inbox, int i) {
+    return (inbox[i >> 5] >> (i & 31)) & 1;
+}
+static inline void inbox_set(uint32_t* inbox, int i) {
+    inbox[i >> 5] |= (1u << (i & 31));
+}
+static inline void inbox_clear(uint32_t* inbox, int i) {
+    inbox[i >> 5] &= ~(1u << (i & 31));
+}
+// Sets the bits [0, n).
+static void inbox_set_first(uint32_t* inbox, int n) {
+    int i;
+    for (i = 0; i < (n >> 5); i++)
+        inbox[i] = 0xffffffffu;
+    if (n & 31)
+        inbox[n >> 5] |= (1u << (n & 31)) - 1;
+}
+// Returns the first star in the box in [i, end), or "end" if there is none.
+// Whole words of stars that are out of the box are skipped at once.
+static inline int inbox_next(const uint32_t* inbox, int i, int end) {
+    while (i < end) {
+        uint32_t word = inbox[i >> 5] >> (i & 31);
+        if (!word) {
+            i = (i | 31) + 1;
+            continue;
+        }
+        while (!(word & 1)) {
+            word >>= 1;
+            i++;
+        }
+        return MIN(i, end);
+    }
+    return end;
+}
 
 static void check_scale(pquad* pq, solver_t* s) {
     double dx, dy;
@@ -576,7 +682,7 @@ static void check_inbox(pquad* pq, int start, solver_t* solver) {
         double r;
         double Cx, Cy, xxtmp;
         double tol = solver->codetol;
-        if (!pq->inbox[i])
+        if (!inbox_get(pq->inbox, i))
             continue;
         field_getxy(solver, i, &Cx, &Cy);
         Cx -= Ax;
@@ -593,11 +699,83 @@ static void check_inbox(pquad* pq, int start, solver_t* solver) {
         // x^2-x + y^2-y           <=   sqrt(2)*codetol + codetol^2
         r = (Cx * Cx - Cx) + (Cy * Cy - Cy);
         if (r > (tol * (M_SQRT2 + tol))) {
-            pq->inbox[i] = FALSE;
+            inbox_clear(pq->inbox, i);
             continue;
         }
-        setx(pq->xy, i, Cx);
-        sety(pq->xy, i, Cy);
+        pq->x[i] = Cx;
+        pq->y[i] = Cy;
+    }
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// There is only a pquad for A < B, so they are stored as a triangle: the
+// pquad for stars A,B is at B*(B-1)/2 + A.
+static inline size_t pquad_index(int fieldA, int fieldB) {
+    return (size_t)fieldB * (fieldB - 1) / 2 + fieldA;
+}
+
+// The inbox bitsets and code-frame positions of the AB pairs that pass the
+// scale check are handed out from large blocks, instead of two small
+// mallocs per pair.  Each pair gets its "x" and "y" arrays next to each
+// other, followed by its inbox bits.
+#define PQUAD_ARENA_BLOCK_SIZE (4 * 1024 * 1024)
+
+// Each block starts with a pointer to the block before it, so they can all
+// be freed; the union keeps the pairs after it aligned for doubles.
+typedef union pquad_block {
+    union pquad_block* prev;
+    double align;
+} pquad_block_t;
+
+typedef struct {
+    pquad_block_t* lastblock;
+    char* next;
+    size_t left;
+    size_t pairsize;
+    int numxy;
+    int inboxwords;
+} pquad_arena_t;
+
+static void pquad_arena_init(pquad_arena_t* arena, int numxy) {
+    arena->lastblock = NULL;
+    arena->next = NULL;
+    arena->left = 0;
+    arena->numxy = numxy;
+    arena->inboxwords = (numxy + 31) / 32;
+    arena->pairsize = 2 * numxy * sizeof(double) +
+        arena->inboxwords * sizeof(uint32_t);
+    // keep the next pair's doubles aligned
+    arena->pairsize = (arena->pairsize + sizeof(double) - 1) & ~(sizeof(double) - 1);
+}
+
+// Points the pquad at fresh storage for its positions and an empty inbox.
+static anbool pquad_arena_alloc(pquad_arena_t* arena, pquad* pq) {
+    if (arena->left < arena->pairsize) {
+        size_t blocksize = MAX(PQUAD_ARENA_BLOCK_SIZE, arena->pairsize);
+        pquad_block_t* block = malloc(sizeof(pquad_block_t) + blocksize);
+        if (!block) {
+            SYSERROR("Failed to allocate %zu bytes for the potential quads", blocksize);
+            return FALSE;
+        }
+        block->prev = arena->lastblock;
+        arena->lastblock = block;
+        arena->next = (char*)(block + 1);
+        arena->left = blocksize;
+    }
+    pq->x = (double*)arena->next;
+    pq->y = pq->x + arena->numxy;
+    pq->inbox = (uint32_t*)(pq->y + arena->numxy);
+    memset(pq->inbox, 0, arena->inboxwords * sizeof(uint32_t));
+    arena->next += arena->pairsize;
+    arena->left -= arena->pairsize;
+    return TRUE;
+}
+
+static void pquad_arena_free(pquad_arena_t* arena) {
+    while (arena->lastblock) {
+        pquad_block_t* prev = arena->lastblock->prev;
+        free(arena->lastblock);
+        arena->lastblock = prev;
     }
 }
 
@@ -606,7 +784,7 @@ static void print_inbox(pquad* pq) {
     int i;
     debug("[ ");
     for (i = 0; i < pq->ninbox; i++) {
-        if (pq->inbox[i])
+        if (inbox_get(pq->inbox, i))
             debug("%i ", i);
     }
     debug("] (n %i)\n", pq->ninbox);
@@ -645,6 +823,26 @@ void solver_preprocess_field(solver_t* solver) {
 
     solver->vf->do_uniformize = solver->verify_uniformize;
     solver->vf->do_dedup = solver->verify_dedup;
+    solver->vf->cancel_flag = solver->cancel_flag; //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    solver->vf->solved_flag = solver->solved_flag; //# Modified by Robert Lancaster for the StellarSolver Internal Library
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // Find the pairs of field stars that deduplication can remove once, for
+    // every hit.  Stars far from a small quad get a bigger radius than this
+    // and are still looked up in the kdtree.
+    if (solver->verify_dedup)
+        verify_field_prepare_dedup(solver->vf, square(10.0 * solver->verify_pix));
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Checks the cancel and solved flags; if either is set, tells the solver to bail out.
+static inline anbool check_cancelled(solver_t* solver) {
+    if (unlikely(an_flag_is_set(solver->cancel_flag) ||
+                 an_flag_is_set(solver->solved_flag))) {
+        solver->quit_now = TRUE;
+        return TRUE;
+    }
+    return FALSE;
 }
 
 void solver_free_field(solver_t* solver) {
@@ -703,10 +901,9 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
     // It looks funny that we're using f[adding] as a loop variable, but
     // it's required because try_all_codes needs to know which field stars
     // were used to create the quad (which are stored in the "f" array)
-    for (f[adding]=bottom; f[adding]<fieldtop; f[adding]++) {
-        if (!pq->inbox[f[adding]])
-            continue;
-        if (unlikely(solver->quit_now))
+    for (f[adding]=inbox_next(pq->inbox, bottom, fieldtop); f[adding]<fieldtop;
+         f[adding]=inbox_next(pq->inbox, f[adding]+1, fieldtop)) {
+        if (unlikely(solver->quit_now) || check_cancelled(solver))
             return;
 
         // If we've hit the end of the recursion (we're adding the last star),
@@ -723,6 +920,182 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
 }
 
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/*
+ Working on the AB pairs in parallel.
+
+ When the caller gives solver_run() a "parallel_for" function, the pieces of
+ work that the loops below would do one after the other (one AB pair with one
+ index) are queued up instead, and the queue is handed to "parallel_for" when
+ it is full or the loop is done.  Each piece runs on its own copy of the
+ solver, and the hits it would keep are collected in "pending_hits" rather
+ than being recorded.  Afterwards the pieces are gone through in the order
+ the loops would have done them, adding up their counters and recording
+ their hits, and stopping at the first hit that solves the field.  That way
+ the solution and the counters are the same as when it runs in one thread.
+ */
+#define PQUAD_WORK_QUEUE_SIZE 1024
+
+typedef struct {
+    const pquad* pq;
+    int indexnum;
+    // -1 if the new star is star B, or the new star if it is star C
+    int fieldC;
+    // These are filled in by the task.
+    anbool done;
+    anbool quit;
+    solver_counts_t counts;
+    bl* hits;
+} pquad_work_t;
+
+typedef struct {
+    solver_t* solver;
+    int newpoint;
+    int first;
+    int n;
+    pquad_work_t work[PQUAD_WORK_QUEUE_SIZE];
+} pquad_work_queue_t;
+
+static void free_pending_hits(bl* hits, size_t start) {
+    size_t i;
+    if (!hits)
+        return;
+    for (i = start; i < bl_size(hits); i++) {
+        pending_hit_t* hit = bl_access(hits, i);
+        verify_free_matchobj(&hit->mo);
+        if (hit->mo.sip)
+            sip_free(hit->mo.sip);
+    }
+    bl_free(hits);
+}
+
+static int run_pquad_work(void* taskdata, int i) {
+    pquad_work_queue_t* queue = taskdata;
+    pquad_work_t* work = queue->work + queue->first + i;
+    const pquad* pq = work->pq;
+    index_t* index = pl_get(queue->solver->indexes, work->indexnum);
+    int dimquads = index_dimquads(index);
+    int field[DQMAX];
+    double tol2;
+    solver_t worker;
+
+    // It might have been done in an earlier round.
+    if (work->done)
+        return (work->quit || bl_size(work->hits));
+
+    memcpy(&worker, queue->solver, sizeof(solver_t));
+    // The copy has its own code search space, kept for all the quads of this piece of work.
+    memset(worker.code_results, 0, sizeof(worker.code_results));
+    memset(&worker.code_scratch, 0, sizeof(worker.code_scratch));
+    worker.numtries = 0;
+    worker.nummatches = 0;
+    worker.numscaleok = 0;
+    worker.num_cxdx_skipped = 0;
+    worker.num_meanx_skipped = 0;
+    worker.num_radec_skipped = 0;
+    worker.num_abscale_skipped = 0;
+    worker.num_verified = 0;
+    worker.num_fast_rejected = 0;
+    worker.quit_now = FALSE;
+    worker.pending_hits = work->hits = bl_new(4, sizeof(pending_hit_t));
+    set_index(&worker, index);
+    worker.rel_field_noise2 = pq->rel_field_noise2;
+    tol2 = get_tolerance(&worker);
+
+    memset(field, 0, sizeof(field));
+    field[A] = pq->fieldA;
+    field[B] = pq->fieldB;
+    if (work->fieldC < 0) {
+        add_stars(pq, field, C, dimquads-2, 0, queue->newpoint, dimquads, &worker, tol2);
+    } else {
+        field[C] = work->fieldC;
+        if (dimquads > 3)
+            add_stars(pq, field, D, dimquads-3, 0, queue->newpoint, dimquads, &worker, tol2);
+        else
+            TRY_ALL_CODES(pq, field, dimquads, &worker, tol2);
+    }
+
+    free_code_search(&worker);
+    get_counts(&worker, &work->counts);
+    work->quit = worker.quit_now;
+    work->done = TRUE;
+    // Once there is a hit, the work after it may not be needed.
+    return (work->quit || bl_size(work->hits));
+}
+
+// Adds a finished piece of work to the solver as though it had been done in
+// this thread.  Returns TRUE if the solver should stop.
+static anbool commit_pquad_work(solver_t* solver, pquad_work_t* work) {
+    size_t i;
+    set_index(solver, pl_get(solver->indexes, work->indexnum));
+    for (i = 0; i < bl_size(work->hits); i++) {
+        pending_hit_t* hit = bl_access(work->hits, i);
+        hit->mo.quads_tried += solver->numtries;
+        hit->mo.quads_matched += solver->nummatches;
+        hit->mo.quads_scaleok += solver->numscaleok;
+        hit->mo.nverified += solver->num_verified;
+        if (solver_record_hit(solver, &hit->mo)) {
+            add_counts(solver, &hit->counts);
+            free_pending_hits(work->hits, i + 1);
+            work->hits = NULL;
+            solver->quit_now = TRUE;
+            return TRUE;
+        }
+    }
+    add_counts(solver, &work->counts);
+    bl_free(work->hits);
+    work->hits = NULL;
+    if (work->quit)
+        solver->quit_now = TRUE;
+    return solver->quit_now;
+}
+
+// Runs the queued work and commits it in order.  Returns TRUE if the solver
+// should stop.
+static anbool flush_pquad_work(pquad_work_queue_t* queue) {
+    solver_t* solver = queue->solver;
+    int start = 0;
+    int i;
+    while (start < queue->n && !solver->quit_now) {
+        if (check_cancelled(solver))
+            break;
+        queue->first = start;
+        solver->parallel_for(solver->parallel_data, run_pquad_work, queue,
+                             queue->n - start);
+        // Commit the work in order, up to the first piece that was skipped;
+        // the skipped ones get another round if nothing before them solved.
+        for (i = start; i < queue->n; i++) {
+            if (!queue->work[i].done)
+                break;
+            if (commit_pquad_work(solver, queue->work + i))
+                break;
+        }
+        start = i;
+    }
+    for (i = 0; i < queue->n; i++) {
+        free_pending_hits(queue->work[i].hits, 0);
+        queue->work[i].hits = NULL;
+    }
+    queue->n = 0;
+    return solver->quit_now;
+}
+
+// Queues an AB pair with an index.  Returns TRUE if the solver should stop.
+static anbool queue_pquad_work(pquad_work_queue_t* queue, const pquad* pq,
+                               int indexnum, int fieldC) {
+    pquad_work_t* work = queue->work + queue->n;
+    work->pq = pq;
+    work->indexnum = indexnum;
+    work->fieldC = fieldC;
+    work->done = FALSE;
+    work->quit = FALSE;
+    work->hits = NULL;
+    queue->n++;
+    if (queue->n == PQUAD_WORK_QUEUE_SIZE)
+        return flush_pquad_work(queue);
+    return FALSE;
+}
+
 // The real deal
 void solver_run(solver_t* solver) {
     int numxy, newpoint;
@@ -730,6 +1103,8 @@ void solver_run(solver_t* solver) {
     // first timer callback is called after 1 second
     time_t next_timer_callback_time = time(NULL) + 1;
     pquad* pquads;
+    pquad_arena_t arena;
+    pquad_work_queue_t* queue = NULL;
     size_t i, num_indexes;
     double tol2;
     int field[DQMAX];
@@ -782,6 +1157,18 @@ void solver_run(solver_t* solver) {
             //minAB, maxAB);
             minAB2s[i] = square(minAB);
             maxAB2s[i] = square(maxAB);
+
+            //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            // Bin the field stars for the uniformization grids that hits
+            // from this index can use, so each hit doesn't have to.
+            if (solver->vf->do_uniformize && minAB > 0.0 && maxAB > 0.0) {
+                double scalelo = MAX(solver->funits_lower, index->index_scale_lower / maxAB);
+                double scalehi = index->index_scale_upper / minAB;
+                if (solver->funits_upper > 0.0)
+                    scalehi = MIN(scalehi, solver->funits_upper);
+                verify_field_prepare_uniformize(solver->vf, index->cutnside, scalelo, scalehi,
+                                                solver->field_maxx, solver->field_maxy);
+            }
             solver->minminAB2 = MIN(solver->minminAB2, minAB2s[i]);
             solver->maxmaxAB2 = MAX(solver->maxmaxAB2, maxAB2s[i]);
 
@@ -809,18 +1196,31 @@ void solver_run(solver_t* solver) {
          MIN(M_PI, arcsec2rad(field_diag * solver->funits_upper)) ...
          */
 
-        pquads = calloc(numxy * numxy, sizeof(pquad));
+        //# Modified by Robert Lancaster for the StellarSolver Internal Library
+        pquads = calloc(pquad_index(0, numxy), sizeof(pquad));
+        pquad_arena_init(&arena, numxy);
+
+        if (solver->parallel_for) {
+            queue = calloc(1, sizeof(pquad_work_queue_t));
+            queue->solver = solver;
+            // The star kdtrees compute their inverse permutations the first
+            // time they are needed; do that now rather than in the workers.
+            for (i = 0; i < num_indexes; i++) {
+                index_t* index = pl_get(solver->indexes, i);
+                if (index->starkd->tree->perm && !index->starkd->inverse_perm)
+                    startree_compute_inverse_perm(index->starkd);
+            }
+        }
 
         /* We maintain an array of "potential quads" (pquad) structs, where
          * each struct corresponds to one choice of stars A and B; the struct
-         * at index (B * numxy + A) holds information about quads that could be
-         * created using stars A,B.
+         * at index pquad_index(A, B) holds information about quads that could
+         * be created using stars A,B.
          *
-         * (We only use the above-diagonal elements of this 2D array because
-         * A<B.)
+         * (Since A<B, only the triangle below the diagonal is stored.)
          *
          * For each AB pair, we cache the scale and the rotation parameters,
-         * and we keep an array "inbox" of length "numxy" of booleans, one for
+         * and we keep a bitset "inbox" of length "numxy", one bit for
          * each star, which say whether that star is eligible to be star C or D
          * of a quad with AB at the corners.  (Obviously A and B aren't
          * eligible).
@@ -836,7 +1236,7 @@ void solver_run(solver_t* solver) {
             debug("startobj > 0; priming pquad arrays.\n");
             for (field[B] = 0; field[B] < solver->startobj; field[B]++) {
                 for (field[A] = 0; field[A] < field[B]; field[A]++) {
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = pquads + pquad_index(field[A], field[B]);
                     pq->fieldA = field[A];
                     pq->fieldB = field[B];
                     debug("trying A=%i, B=%i\n", field[A], field[B]);
@@ -845,12 +1245,14 @@ void solver_run(solver_t* solver) {
                         debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
-                    pq->xy = malloc(numxy * 2 * sizeof(double));
-                    pq->inbox = malloc(numxy * sizeof(anbool));
-                    memset(pq->inbox, TRUE, solver->startobj);
+                    if (!pquad_arena_alloc(&arena, pq)) {
+                        solver->quit_now = TRUE;
+                        goto quitnow;
+                    }
+                    inbox_set_first(pq->inbox, solver->startobj);
                     pq->ninbox = solver->startobj;
-                    pq->inbox[field[A]] = FALSE;
-                    pq->inbox[field[B]] = FALSE;
+                    inbox_clear(pq->inbox, field[A]);
+                    inbox_clear(pq->inbox, field[B]);
                     check_inbox(pq, 0, solver);
                     debug("  inbox(A=%i, B=%i): ", field[A], field[B]);
                     print_inbox(pq);
@@ -872,6 +1274,10 @@ void solver_run(solver_t* solver) {
 
             debug("Trying newpoint=%i\n", newpoint);
 
+            //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            if (check_cancelled(solver))
+                break;
+
             // Give our caller a chance to cancel us midway. The callback
             // returns how long to wait before calling again.
 
@@ -888,6 +1294,8 @@ void solver_run(solver_t* solver) {
             }
 
             solver->last_examined_object = newpoint;
+            if (queue)
+                queue->newpoint = newpoint;
             // quads with the new star on the diagonal:
             field[B] = newpoint;
             debug("Trying quads with B=%i\n", newpoint);
@@ -895,7 +1303,7 @@ void solver_run(solver_t* solver) {
             // first do an index-independent scale check...
             for (field[A] = 0; field[A] < newpoint; field[A]++) {
                 // initialize the "pquad" struct for this AB combo.
-                pquad* pq = pquads + field[B] * numxy + field[A];
+                pquad* pq = pquads + pquad_index(field[A], field[B]);
                 pq->fieldA = field[A];
                 pq->fieldB = field[B];
                 debug("  trying A=%i, B=%i\n", field[A], field[B]);
@@ -904,16 +1312,17 @@ void solver_run(solver_t* solver) {
                     debug("    bad scale for A=%i, B=%i\n", field[A], field[B]);
                     continue;
                 }
-                // initialize the "inbox" array:
-                pq->inbox = malloc(numxy * sizeof(anbool));
-                pq->xy = malloc(numxy * 2 * sizeof(double));
+                // initialize the "inbox" bitset:
+                if (!pquad_arena_alloc(&arena, pq)) {
+                    solver->quit_now = TRUE;
+                    goto quitnow;
+                }
                 // -try all stars up to "newpoint"...
-                assert(sizeof(anbool) == 1);
-                memset(pq->inbox, TRUE, newpoint + 1);
+                inbox_set_first(pq->inbox, newpoint + 1);
                 pq->ninbox = newpoint + 1;
                 // -except A and B.
-                pq->inbox[field[A]] = FALSE;
-                pq->inbox[field[B]] = FALSE;
+                inbox_clear(pq->inbox, field[A]);
+                inbox_clear(pq->inbox, field[B]);
                 check_inbox(pq, 0, solver);
                 debug("    inbox(A=%i, B=%i): ", field[A], field[B]);
                 print_inbox(pq);
@@ -927,12 +1336,17 @@ void solver_run(solver_t* solver) {
                 dimquads = index_dimquads(index);
                 for (field[A] = 0; field[A] < newpoint; field[A]++) {
                     // initialize the "pquad" struct for this AB combo.
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = pquads + pquad_index(field[A], field[B]);
                     if (!pq->scale_ok)
                         continue;
                     if ((pq->scale < minAB2s[i]) ||
                         (pq->scale > maxAB2s[i]))
                         continue;
+                    if (queue) {
+                        if (queue_pquad_work(queue, pq, i, -1))
+                            goto quitnow;
+                        continue;
+                    }
                     // set code tolerance for this index and AB pair...
                     solver->rel_field_noise2 = pq->rel_field_noise2;
                     tol2 = get_tolerance(solver);
@@ -944,6 +1358,8 @@ void solver_run(solver_t* solver) {
                 }
             }
 
+            if (queue && flush_pquad_work(queue))
+                goto quitnow;
             if (solver->quit_now)
                 goto quitnow;
 
@@ -954,16 +1370,16 @@ void solver_run(solver_t* solver) {
             for (field[A] = 0; field[A] < newpoint; field[A]++) {
                 for (field[B] = field[A] + 1; field[B] < newpoint; field[B]++) {
                     // grab the "pquad" for this AB combo
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = pquads + pquad_index(field[A], field[B]);
                     if (!pq->scale_ok) {
                         debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
                     // test if this C is in the box:
-                    pq->inbox[field[C]] = TRUE;
+                    inbox_set(pq->inbox, field[C]);
                     pq->ninbox = field[C] + 1;
                     check_inbox(pq, field[C], solver);
-                    if (!pq->inbox[field[C]]) {
+                    if (!inbox_get(pq->inbox, field[C])) {
                         debug("  C is not in the box for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
@@ -980,6 +1396,11 @@ void solver_run(solver_t* solver) {
                         if ((pq->scale < minAB2s[i]) ||
                             (pq->scale > maxAB2s[i]))
                             continue;
+                        if (queue) {
+                            if (queue_pquad_work(queue, pq, i, field[C]))
+                                goto quitnow;
+                            continue;
+                        }
                         set_index(solver, index);
                         dimquads = index_dimquads(index);
 
@@ -996,6 +1417,8 @@ void solver_run(solver_t* solver) {
                     }
                 }
             }
+            if (queue && flush_pquad_work(queue))
+                goto quitnow;
             logverb("object %u of %u: %i quads tried, %i matched.\n",
                     newpoint + 1, numxy, solver->numtries, solver->nummatches);
 
@@ -1006,11 +1429,13 @@ void solver_run(solver_t* solver) {
         }
 
     quitnow:
-        for (i = 0; i < (numxy*numxy); i++) {
-            pquad* pq = pquads + i;
-            free(pq->inbox);
-            free(pq->xy);
+        if (queue) {
+            // Anything still queued is dropped.
+            for (i = 0; i < (size_t)queue->n; i++)
+                free_pending_hits(queue->work[i].hits, 0);
+            free(queue);
         }
+        pquad_arena_free(&arena);
         free(pquads);
 
 #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
@@ -1031,8 +1456,10 @@ static void try_all_codes(const pquad* pq,
     double code[DCMAX];
     double flipcode[DCMAX];
     int i;
+    code_batch_t batch;
 
     solver->numtries++;
+    batch.n = 0;
 
     debug("  trying quad [");
     for (i=0; i<dimquad; i++) {
@@ -1041,8 +1468,8 @@ static void try_all_codes(const pquad* pq,
     debug("]\n");
 
     for (i=0; i<dimquad-NBACK; i++) {
-        code[2*i  ] = getx(pq->xy, fieldstars[NBACK+i]);
-        code[2*i+1] = gety(pq->xy, fieldstars[NBACK+i]);
+        code[2*i  ] = pq->x[fieldstars[NBACK+i]];
+        code[2*i+1] = pq->y[fieldstars[NBACK+i]];
     }
 
     if (solver->parity == PARITY_NORMAL ||
@@ -1053,7 +1480,7 @@ static void try_all_codes(const pquad* pq,
             debug("%s%g", (i?", ":""), code[i]);
         debug("].\n");
 
-        try_all_codes_2(fieldstars, dimquad, code, solver, FALSE, tol2);
+        try_all_codes_2(fieldstars, dimquad, code, solver, FALSE, tol2, &batch);
     }
     if (solver->parity == PARITY_FLIP ||
         solver->parity == PARITY_BOTH) {
@@ -1065,8 +1492,10 @@ static void try_all_codes(const pquad* pq,
             debug("%s%g", (i?", ":""), flipcode[i]);
         debug("].\n");
 
-        try_all_codes_2(fieldstars, dimquad, flipcode, solver, TRUE, tol2);
+        try_all_codes_2(fieldstars, dimquad, flipcode, solver, TRUE, tol2, &batch);
     }
+
+    search_code_batch(&batch, dimquad, solver, tol2);
 }
 
 /**
@@ -1075,9 +1504,9 @@ static void try_all_codes(const pquad* pq,
  */
 static void try_all_codes_2(const int* fieldstars, int dimquad,
                             const double* code, solver_t* solver,
-                            anbool current_parity, double tol2) {
+                            anbool current_parity, double tol2,
+                            code_batch_t* batch) {
     int i;
-    kdtree_qres_t* result = NULL;
     int dimcode = (dimquad - 2) * 2;
     int stars[DQMAX];
     double flipcode[DCMAX];
@@ -1093,9 +1522,7 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
         placed[i] = FALSE;
 
     try_permutations(fieldstars, dimquad, code, solver, current_parity,
-                     tol2, stars, NULL, 0, placed, &result);
-    if (unlikely(solver->quit_now))
-        goto bailout;
+                     tol2, stars, NULL, 0, placed, batch);
 
     // Flipped:
     stars[0] = fieldstars[1];
@@ -1108,10 +1535,7 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
         placed[i] = FALSE;
 
     try_permutations(fieldstars, dimquad, flipcode, solver, current_parity,
-                     tol2, stars, NULL, 0, placed, &result);
-
- bailout:
-    kdtree_free_query(result);
+                     tol2, stars, NULL, 0, placed, batch);
 }
 
 /**
@@ -1124,10 +1548,8 @@ static void try_permutations(const int* origstars, int dimquad,
                              double tol2,
                              int* stars, double* code,
                              int slot, anbool* placed,
-                             kdtree_qres_t** presult) {
+                             code_batch_t* batch) {
     int i;
-    int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
-        KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
     double mycode[DCMAX];
     int Nstars = dimquad - NBACK;
     int lastslot = dimquad - NBACK - 1;
@@ -1208,7 +1630,7 @@ static void try_permutations(const int* origstars, int dimquad,
             placed[i] = TRUE;
             try_permutations(origstars, dimquad, origcode, solver,
                              current_parity, tol2, stars, code, 
-                             slot+1, placed, presult);
+                             slot+1, placed, batch);
             placed[i] = FALSE;
 
         } else {
@@ -1217,26 +1639,76 @@ static void try_permutations(const int* origstars, int dimquad,
             continue;
 #endif
 				
-            // Search with the code we've built.
-            *presult = kdtree_rangesearch_options_reuse
-                (solver->index->codekd->tree, *presult, code, tol2, options);
-            //debug("      trying ABCD = [%i %i %i %i]: %i results.\n",
-            //fstars[A], fstars[B], fstars[C], fstars[D], result->nres);
-
-            if ((*presult)->nres) {
-                double pixvals[DQMAX*2];
-                int j;
-                for (j=0; j<dimquad; j++) {
-                    setx(pixvals, j, field_getx(solver, stars[j]));
-                    sety(pixvals, j, field_gety(solver, stars[j]));
-                }
-                resolve_matches(*presult, pixvals, stars, dimquad, solver,
-                                current_parity);
+            //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            // Queue the code we've built; the code tree is searched for
+            // all the codes of this quad together in search_code_batch.
+            {
+                int dimcode = (dimquad - NBACK) * 2;
+                int n = batch->n;
+                assert(n < SOLVER_MAX_QUAD_CODES);
+                memcpy(batch->stars[n], stars, dimquad * sizeof(int));
+                memcpy(batch->codes + n * dimcode, code, dimcode * sizeof(double));
+                batch->parity[n] = current_parity;
+                batch->n++;
+            }
+        }
+    }
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Searches the code tree for all the codes of a quad in one pass and then
+// resolves the matches in the same order the codes were built in, so the
+// solver tries exactly what it did when it searched for each code in turn.
+static void search_code_batch(code_batch_t* batch, int dimquad,
+                              solver_t* solver, double tol2) {
+    int i;
+    int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
+        KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
+
+    if (batch->n == 0)
+        return;
+    if (check_cancelled(solver)) {
+        batch->n = 0;
+        return;
+    }
+
+    // The result structs and scratch space are kept in the solver, so they
+    // are only allocated the first time and then reused for every quad.
+    if (kdtree_rangesearch_batch(solver->index->codekd->tree, solver->code_results,
+                                 batch->codes, batch->n, tol2, options,
+                                 &solver->code_scratch)) {
+        ERROR("Failed to search the code tree");
+        solver->quit_now = TRUE;
+        batch->n = 0;
+        return;
+    }
+
+    for (i=0; i<batch->n; i++) {
+        if (solver->code_results[i]->nres) {
+            double pixvals[DQMAX*2];
+            int j;
+            for (j=0; j<dimquad; j++) {
+                setx(pixvals, j, field_getx(solver, batch->stars[i][j]));
+                sety(pixvals, j, field_gety(solver, batch->stars[i][j]));
             }
-            if (unlikely(solver->quit_now))
-                return;
+            resolve_matches(solver->code_results[i], pixvals, batch->stars[i],
+                            dimquad, solver, batch->parity[i]);
         }
+        if (unlikely(solver->quit_now))
+            break;
+    }
+    batch->n = 0;
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Frees the result structs and scratch space of the code tree searches.
+static void free_code_search(solver_t* solver) {
+    int i;
+    for (i=0; i<SOLVER_MAX_QUAD_CODES; i++) {
+        kdtree_free_query(solver->code_results[i]);
+        solver->code_results[i] = NULL;
     }
+    kdtree_batch_scratch_free(&solver->code_scratch);
 }
 
 // "field" contains the xy pixel coordinates of stars A,B,C,D.
@@ -1368,10 +1840,27 @@ void solver_inject_match(solver_t* solver, MatchObj* mo, sip_t* sip) {
     solver_handle_hit(solver, mo, sip, TRUE);
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Handling a hit is split in two so that the hits found in parallel can be
+// verified in the worker threads and recorded later in the caller's thread.
 static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
                              anbool fake_match) {
+    if (!solver_check_hit(sp, mo, sip, fake_match))
+        return FALSE;
+    if (sp->pending_hits) {
+        pending_hit_t hit;
+        memcpy(&hit.mo, mo, sizeof(MatchObj));
+        get_counts(sp, &hit.counts);
+        bl_append(sp->pending_hits, &hit);
+        return FALSE;
+    }
+    return solver_record_hit(sp, mo);
+}
+
+// Verifies (and maybe tunes up) a hit; returns TRUE if it should be kept.
+static anbool solver_check_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
+                               anbool fake_match) {
     double match_distance_in_pixels2;
-    anbool solved;
     double logaccept;
 
     mo->indexid = sp->index->indexid;
@@ -1386,6 +1875,22 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
 
     logaccept = MIN(sp->logratio_tokeep, sp->logratio_totune);
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // Most hits are false, and a few of the brightest reference stars are
+    // usually enough to tell, so try that before pulling all of them.
+    if (!fake_match &&
+        verify_hit_fast_reject(sp->index->starkd, mo, sip, sp->vf,
+                               match_distance_in_pixels2,
+                               sp->distractor_ratio,
+                               sp->field_maxx, sp->field_maxy,
+                               sp->verify_fast_nrefs,
+                               sp->logratio_fast_bail,
+                               sp->distance_from_quad_bonus)) {
+        mo->nverified = sp->num_verified++;
+        sp->num_fast_rejected++;
+        return FALSE;
+    }
+
     verify_hit(sp->index->starkd, sp->index->cutnside,
                mo, sip, sp->vf, match_distance_in_pixels2,
                sp->distractor_ratio, sp->field_maxx, sp->field_maxy,
@@ -1570,6 +2075,13 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
          printf("\n");
          */
     }
+    return TRUE;
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Passes a kept hit to the callback and updates the best match.
+static int solver_record_hit(solver_t* sp, MatchObj* mo) {
+    anbool solved;
 
     // If the user didn't supply a callback, or if the callback
     // returns TRUE, consider it solved.
@@ -1606,6 +2118,8 @@ void solver_set_default_values(solver_t* solver) {
     solver->funits_upper = HUGE_VAL;
     solver->logratio_bail_threshold = log(1e-100);
     solver->logratio_stoplooking = HUGE_VAL;
+    solver->verify_fast_nrefs = DEFAULT_VERIFY_FAST_NREFS; //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    solver->logratio_fast_bail = log(DEFAULT_FAST_BAIL_THRESHOLD);
     solver->logratio_totune = HUGE_VAL;
     solver->parity = DEFAULT_PARITY;
     solver->codetol = DEFAULT_CODE_TOL;
@@ -1625,6 +2139,7 @@ void solver_clear_indexes(solver_t* solver) {
 
 void solver_cleanup(solver_t* solver) {
     solver_free_field(solver);
+    free_code_search(solver);
     pl_free(solver->indexes);
     solver->indexes = NULL;
     if (solver->have_best_match) {
@@ -14,6 +14,7 @@
 #include <stdint.h>
 
 #include "os-features.h"
+#include "an-thread.h" //# Modified by Robert Lancaster for the StellarSolver Internal Library
 #include "verify.h"
 #include "permutedsort.h"
 #include "mathutil.h"
@@ -66,6 +67,98 @@ struct verify_s {
 typedef struct verify_s verify_t;
 
 static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t* vf, double nsigmas);
+static int get_xy_bin(const double* xy, double fieldW, double fieldH, int nw, int nh);
+static void uniformize_field(const double* xy, const int* starbins, int* perm, int N,
+                             double fieldW, double fieldH, int nw, int nh,
+                             int** p_bincounts, int** p_binids);
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// This puts the field stars in a grid with about two stars per cell.
+static void build_field_grid(verify_field_t* vf) {
+    int i, N;
+    double minx, maxx, miny, maxy;
+    int* next;
+
+    N = starxy_n(vf->field);
+    if (!N)
+        return;
+    minx = maxx = starxy_getx(vf->field, 0);
+    miny = maxy = starxy_gety(vf->field, 0);
+    for (i=1; i<N; i++) {
+        double x = starxy_getx(vf->field, i);
+        double y = starxy_gety(vf->field, i);
+        minx = MIN(minx, x);
+        maxx = MAX(maxx, x);
+        miny = MIN(miny, y);
+        maxy = MAX(maxy, y);
+    }
+    vf->grid_cell = MAX(1.0, sqrt(2.0 * MAX(1.0, (maxx - minx) * (maxy - miny)) / N));
+    vf->grid_x0 = minx;
+    vf->grid_y0 = miny;
+    vf->grid_nx = (int)((maxx - minx) / vf->grid_cell) + 1;
+    vf->grid_ny = (int)((maxy - miny) / vf->grid_cell) + 1;
+
+    vf->grid_start = calloc(vf->grid_nx * vf->grid_ny + 1, sizeof(int));
+    vf->grid_stars = malloc(N * sizeof(int));
+    vf->grid_xy = malloc(N * 2 * sizeof(double));
+    for (i=0; i<N; i++) {
+        int ix = (int)((starxy_getx(vf->field, i) - minx) / vf->grid_cell);
+        int iy = (int)((starxy_gety(vf->field, i) - miny) / vf->grid_cell);
+        vf->grid_start[iy * vf->grid_nx + ix + 1]++;
+    }
+    for (i=0; i<vf->grid_nx * vf->grid_ny; i++)
+        vf->grid_start[i+1] += vf->grid_start[i];
+    next = malloc(vf->grid_nx * vf->grid_ny * sizeof(int));
+    memcpy(next, vf->grid_start, vf->grid_nx * vf->grid_ny * sizeof(int));
+    for (i=0; i<N; i++) {
+        int ix = (int)((starxy_getx(vf->field, i) - minx) / vf->grid_cell);
+        int iy = (int)((starxy_gety(vf->field, i) - miny) / vf->grid_cell);
+        int k = next[iy * vf->grid_nx + ix]++;
+        vf->grid_stars[k] = i;
+        starxy_get(vf->field, i, vf->grid_xy + k*2);
+    }
+    free(next);
+}
+
+// Returns the field star nearest to "xy" within distance-squared "r2",
+// skipping the "nskip" stars in "skip", or -1 if there is none.
+static int field_grid_nearest(const verify_field_t* vf, const double* xy, double r2,
+                              const unsigned int* skip, int nskip, double* p_d2) {
+    int ix, iy, ixlo, ixhi, iylo, iyhi, k, j;
+    double r = sqrt(r2);
+    double bestd2 = r2;
+    int best = -1;
+
+    ixlo = (int)floor((xy[0] - r - vf->grid_x0) / vf->grid_cell);
+    ixhi = (int)floor((xy[0] + r - vf->grid_x0) / vf->grid_cell);
+    iylo = (int)floor((xy[1] - r - vf->grid_y0) / vf->grid_cell);
+    iyhi = (int)floor((xy[1] + r - vf->grid_y0) / vf->grid_cell);
+    ixlo = MAX(ixlo, 0);
+    iylo = MAX(iylo, 0);
+    ixhi = MIN(ixhi, vf->grid_nx - 1);
+    iyhi = MIN(iyhi, vf->grid_ny - 1);
+    for (iy=iylo; iy<=iyhi; iy++) {
+        for (ix=ixlo; ix<=ixhi; ix++) {
+            int c = iy * vf->grid_nx + ix;
+            for (k=vf->grid_start[c]; k<vf->grid_start[c+1]; k++) {
+                double d2 = distsq(xy, vf->grid_xy + k*2, 2);
+                anbool skipped = FALSE;
+                if (d2 > bestd2)
+                    continue;
+                for (j=0; j<nskip; j++)
+                    if ((int)skip[j] == vf->grid_stars[k])
+                        skipped = TRUE;
+                if (skipped)
+                    continue;
+                bestd2 = d2;
+                best = vf->grid_stars[k];
+            }
+        }
+    }
+    if (best != -1 && p_d2)
+        *p_d2 = bestd2;
+    return best;
+}
 
 verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
     verify_field_t* vf;
@@ -95,16 +188,115 @@ verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
     vf->do_uniformize = TRUE;
     vf->do_dedup = TRUE;
     vf->do_ror = TRUE;
+    vf->cancel_flag = NULL;
+    vf->solved_flag = NULL;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    vf->grid_start = NULL;
+    vf->grid_stars = NULL;
+    vf->grid_xy = NULL;
+    build_field_grid(vf);
+    vf->dedup_r2 = 0.0;
+    vf->dedup_start = NULL;
+    vf->dedup_stars = NULL;
+    vf->dedup_d2 = NULL;
+    vf->nbingrids = 0;
 
     return vf;
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+void verify_field_prepare_dedup(verify_field_t* vf, double maxr2) {
+    int i, j, N;
+    il* stars;
+    dl* d2s;
+    kdtree_qres_t* res = NULL;
+    int options = KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_SMALL_RADIUS;
+
+    free(vf->dedup_start);
+    free(vf->dedup_stars);
+    free(vf->dedup_d2);
+
+    N = starxy_n(vf->field);
+    stars = il_new(256);
+    d2s = dl_new(256);
+    vf->dedup_start = malloc((N + 1) * sizeof(int));
+    for (i=0; i<N; i++) {
+        vf->dedup_start[i] = il_size(stars);
+        res = kdtree_rangesearch_options_reuse(vf->ftree, res, vf->xy + 2*i, maxr2, options);
+        for (j=0; j<res->nres; j++) {
+            int ind = res->inds[j];
+            // deduplication only ever removes the fainter star of a pair.
+            if (ind <= i)
+                continue;
+            il_append(stars, ind);
+            dl_append(d2s, distsq(vf->xy + 2*i, vf->xy + 2*ind, 2));
+        }
+    }
+    vf->dedup_start[N] = il_size(stars);
+    kdtree_free_query(res);
+    vf->dedup_stars = il_to_array(stars);
+    vf->dedup_d2 = dl_to_array(d2s);
+    vf->dedup_r2 = maxr2;
+    il_free(stars);
+    dl_free(d2s);
+    debug("Deduplication: %i pairs of field stars within %g pixels\n", vf->dedup_start[N], sqrt(maxr2));
+}
+
+static const int* find_bin_grid(const verify_field_t* vf, int nw, int nh) {
+    int i;
+    for (i=0; i<vf->nbingrids; i++)
+        if (vf->bingrids[i].nw == nw && vf->bingrids[i].nh == nh)
+            return vf->bingrids[i].binids;
+    return NULL;
+}
+
+void verify_field_prepare_uniformize(verify_field_t* vf, int cutnside,
+                                     double scalelo, double scalehi,
+                                     double fieldW, double fieldH) {
+    int nwlo, nhlo, nwhi, nhhi, nw, nh, i, N;
+
+    if (!(scalelo > 0.0) || !isfinite(scalehi) || scalehi < scalelo)
+        return;
+    verify_get_uniformize_scale(cutnside, scalelo, fieldW, fieldH, &nwlo, &nhlo);
+    verify_get_uniformize_scale(cutnside, scalehi, fieldW, fieldH, &nwhi, &nhhi);
+    if ((double)(nwhi - nwlo + 1) * (nhhi - nhlo + 1) > VERIFY_MAX_BIN_GRIDS - vf->nbingrids) {
+        debug("Too many uniformization grids (%i to %i by %i to %i) to keep\n", nwlo, nwhi, nhlo, nhhi);
+        return;
+    }
+    N = starxy_n(vf->field);
+    for (nh=nhlo; nh<=nhhi; nh++) {
+        for (nw=nwlo; nw<=nwhi; nw++) {
+            verify_bin_grid_t* grid;
+            // a 1 x 1 grid isn't uniformized at all.
+            if ((nw == 1 && nh == 1) || find_bin_grid(vf, nw, nh))
+                continue;
+            grid = vf->bingrids + vf->nbingrids;
+            grid->nw = nw;
+            grid->nh = nh;
+            grid->binids = malloc(MAX(N, 1) * sizeof(int));
+            for (i=0; i<N; i++)
+                grid->binids[i] = get_xy_bin(vf->xy + 2*i, fieldW, fieldH, nw, nh);
+            vf->nbingrids++;
+        }
+    }
+}
+
 void verify_field_free(verify_field_t* vf) {
+    int i;
     if (!vf)
         return;
     kdtree_free(vf->ftree);
     free(vf->xy);
     free(vf->fieldcopy);
+    free(vf->grid_start); //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    free(vf->grid_stars);
+    free(vf->grid_xy);
+    free(vf->dedup_start);
+    free(vf->dedup_stars);
+    free(vf->dedup_d2);
+    for (i=0; i<vf->nbingrids; i++)
+        free(vf->bingrids[i].binids);
     free(vf);
 }
 
@@ -129,10 +321,8 @@ static double* compute_sigma2s(const verify_field_t* vf,
         // star.
         for (i=0; i<NF; i++) {
             if (vf) {
-                double sxy[2];
-                starxy_get(vf->field, i, sxy);
                 // Distance from the quad center of this field star:
-                R2 = distsq(sxy, qc, 2);
+                R2 = distsq(vf->xy + 2*i, qc, 2); //# Modified by Robert Lancaster for the StellarSolver Internal Library
             } else
                 R2 = distsq(xy + 2*i, qc, 2);
 
@@ -323,7 +513,8 @@ static void verify_apply_ror(verify_t* v,
 
         // uniformize!
         if (uni_nw > 1 || uni_nh > 1) {
-            verify_uniformize_field(vf->xy, v->testperm, v->NT, fieldW, fieldH, uni_nw, uni_nh, NULL, &binids);
+            //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            uniformize_field(vf->xy, find_bin_grid(vf, uni_nw, uni_nh), v->testperm, v->NT, fieldW, fieldH, uni_nw, uni_nh, NULL, &binids);
             bincenters = verify_uniformize_bin_centers(fieldW, fieldH, uni_nw, uni_nh);
 
             if (DEBUGVERIFY) {
@@ -878,6 +1069,16 @@ static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t*
         ti = v->testperm[i];
         if (!keepers[ti])
             continue;
+        //# Modified by Robert Lancaster for the StellarSolver Internal Library
+        // The test stars are still in field order here, so the stars after
+        // this one are the ones that were found for it in preprocessing.
+        if (vf->dedup_start && nsig2 * v->testsigma[ti] <= vf->dedup_r2) {
+            double r2 = nsig2 * v->testsigma[ti];
+            for (j=vf->dedup_start[ti]; j<vf->dedup_start[ti+1]; j++)
+                if (vf->dedup_d2[j] <= r2)
+                    keepers[vf->dedup_stars[j]] = FALSE;
+            continue;
+        }
         starxy_get(vf->field, ti, sxy);
         res = kdtree_rangesearch_options_reuse(vf->ftree, res, sxy, nsig2 * v->testsigma[ti], options);
         for (j=0; j<res->nres; j++) {
@@ -924,72 +1125,86 @@ void verify_get_uniformize_scale(int cutnside, double scale, int W, int H, int*
         *cutnh = MAX(1, (int)round(H / cutpix));
 }
 
-void verify_uniformize_field(const double* xy,
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// This sorts the stars into their bins with a counting sort instead of a
+// list per bin.  "starbins", if given, holds the bin of every field star.
+static void uniformize_field(const double* xy,
+                             const int* starbins,
                              int* perm,
                              int N,
                              double fieldW, double fieldH,
                              int nw, int nh,
                              int** p_bincounts,
                              int** p_binids) {
-    il** lists;
-    int i,j,k,p;
-    int* bincounts = NULL;
+    int i, k, b, p;
+    int nbins = nw * nh;
+    int maxcount = 0;
+    int* bins;
+    int* binstart;
+    int* next;
+    int* sorted;
     int* binids = NULL;
 
     if (p_binids) {
-        binids = malloc(N * sizeof(int));
+        binids = malloc(MAX(N, 1) * sizeof(int));
         *p_binids = binids;
     }
 
-    lists = malloc(nw * nh * sizeof(il*));
-    for (i=0; i<(nw*nh); i++)
-        lists[i] = il_new(16);
-
-    // put the stars in the appropriate bins.
-    debug2("Test star bins:\n");
+    // put the stars in the appropriate bins, keeping their order within each bin.
+    bins = malloc(MAX(N, 1) * sizeof(int));
+    binstart = calloc(nbins + 1, sizeof(int));
     for (i=0; i<N; i++) {
-        int ind;
-        int bin;
-        ind = perm[i];
-        bin = get_xy_bin(xy + 2*ind, fieldW, fieldH, nw, nh);
-        debug2("%i ", bin);
-        il_append(lists[bin], ind);
+        int ind = perm[i];
+        bins[i] = starbins ? starbins[ind] : get_xy_bin(xy + 2*ind, fieldW, fieldH, nw, nh);
+        binstart[bins[i] + 1]++;
     }
-    debug2("\n");
 
     if (p_bincounts) {
         // note the bin occupancies.
-        bincounts = malloc(nw * nh * sizeof(int));
-        for (i=0; i<(nw*nh); i++) {
-            bincounts[i] = il_size(lists[i]);
-            //logverb("bin %i has %i stars\n", i, bincounts[i]);
-        }
+        int* bincounts = malloc(nbins * sizeof(int));
+        for (b=0; b<nbins; b++)
+            bincounts[b] = binstart[b + 1];
         *p_bincounts = bincounts;
     }
 
+    for (b=0; b<nbins; b++) {
+        maxcount = MAX(maxcount, binstart[b + 1]);
+        binstart[b + 1] += binstart[b];
+    }
+    next = malloc(nbins * sizeof(int));
+    memcpy(next, binstart, nbins * sizeof(int));
+    sorted = malloc(MAX(N, 1) * sizeof(int));
+    for (i=0; i<N; i++)
+        sorted[next[bins[i]]++] = perm[i];
+
     // make sweeps through the bins, grabbing one star from each.
-    p=0;
-    for (k=0;; k++) {
-        for (j=0; j<nh; j++) {
-            for (i=0; i<nw; i++) {
-                int binid = j*nw + i;
-                il* lst = lists[binid];
-                if (k >= il_size(lst))
-                    continue;
-                perm[p] = il_get(lst, k);
-                if (binids)
-                    binids[p] = binid;
-                p++;
-            }
+    p = 0;
+    for (k=0; k<maxcount; k++) {
+        for (b=0; b<nbins; b++) {
+            if (k >= binstart[b + 1] - binstart[b])
+                continue;
+            perm[p] = sorted[binstart[b] + k];
+            if (binids)
+                binids[p] = b;
+            p++;
         }
-        if (p == N)
-            break;
     }
     assert(p == N);
 
-    for (i=0; i<(nw*nh); i++)
-        il_free(lists[i]);
-    free(lists);
+    free(sorted);
+    free(next);
+    free(binstart);
+    free(bins);
+}
+
+void verify_uniformize_field(const double* xy,
+                             int* perm,
+                             int N,
+                             double fieldW, double fieldH,
+                             int nw, int nh,
+                             int** p_bincounts,
+                             int** p_binids) {
+    uniformize_field(xy, NULL, perm, N, fieldW, fieldH, nw, nh, p_bincounts, p_binids);
 }
 
 double* verify_uniformize_bin_centers(double fieldW, double fieldH,
@@ -1221,6 +1436,103 @@ void verify_count_hits(int* theta, int besti, int* p_nmatch, int* p_nconflict, i
 }
 
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+static anbool verify_should_stop(const verify_field_t* vf) {
+    if (!vf)
+        return FALSE;
+    return an_flag_is_set(vf->cancel_flag) || an_flag_is_set(vf->solved_flag);
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+anbool verify_hit_fast_reject(startree_t* skdt, MatchObj* mo,
+                              const sip_t* sip, const verify_field_t* vf,
+                              double pix2, double distractors,
+                              double fieldW, double fieldH,
+                              int nrefs, double logbail,
+                              anbool do_gamma) {
+    sip_t thewcs;
+    const sip_t* wcs;
+    int* starids = NULL;
+    double* refxyz = NULL;
+    double* refxy;
+    int* sweep;
+    int* perm;
+    int NB, NR, i, j, mu;
+    double qc[2], Q2 = 0;
+    double logbg, logodds;
+    anbool reject = FALSE;
+
+    if (nrefs <= 0 || !skdt->sweep || !vf->grid_start)
+        return FALSE;
+
+    if (sip)
+        wcs = sip;
+    else {
+        sip_wrap_tan(&mo->wcstan, &thewcs);
+        wcs = &thewcs;
+    }
+
+    NB = startree_search_bright(skdt, mo->center, square(mo->radius), &starids, &refxyz);
+    if (!NB)
+        return FALSE;
+
+    // Project the bright stars that aren't part of the quad into the image.
+    refxy = malloc(NB * 2 * sizeof(double));
+    sweep = malloc(NB * sizeof(int));
+    NR = 0;
+    for (i=0; i<NB; i++) {
+        anbool inquad = FALSE;
+        for (j=0; j<mo->dimquads; j++)
+            if ((unsigned int)starids[i] == mo->star[j])
+                inquad = TRUE;
+        if (inquad)
+            continue;
+        if (!sip_xyzarr2pixelxy(wcs, refxyz+i*3, refxy+NR*2, refxy+NR*2+1) ||
+            !sip_pixel_is_inside_image(wcs, refxy[NR*2], refxy[NR*2+1]))
+            continue;
+        sweep[NR] = skdt->sweep[starids[i]];
+        NR++;
+    }
+    free(starids);
+    free(refxyz);
+
+    // Test the brightest ones first, with the same odds as real_verify_star_lists,
+    // but going through the reference stars instead of the field stars.
+    perm = permuted_sort(sweep, sizeof(int), compare_ints_asc, NULL, NR);
+    NR = MIN(NR, nrefs);
+    if (do_gamma)
+        verify_get_quad_center(vf, mo, qc, &Q2);
+    logbg = log(1.0 / (fieldW * fieldH));
+    logodds = 0.0;
+    mu = 0;
+    for (i=0; i<NR; i++) {
+        const double* xy = refxy + 2*perm[i];
+        double sig2 = do_gamma ? get_sigma2_at_radius(pix2, distsq(xy, qc, 2), Q2) : pix2;
+        double logd = logd_at(distractors, mu, NR, logbg);
+        double logfg = -HUGE_VAL;
+        double d2;
+        if (field_grid_nearest(vf, xy, sig2 * 25.0, mo->field, mo->dimquads, &d2) != -1)
+            logfg = log((1.0 - distractors) / (2.0 * M_PI * sig2 * NR)) - d2 / (2.0 * sig2);
+        if (logfg > logd) {
+            logodds += logfg - logbg;
+            mu++;
+        } else
+            logodds += logd - logbg;
+        if (logodds < logbail) {
+            debug("Fast verification bailed after %i of %i bright reference stars, logodds %g\n", i+1, NR, logodds);
+            reject = TRUE;
+            break;
+        }
+    }
+    free(perm);
+    free(sweep);
+    free(refxy);
+
+    if (reject)
+        set_null_mo(mo);
+    return reject;
+}
+
 void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
                 const sip_t* sip, const verify_field_t* vf,
                 double pix2, double distractors,
@@ -1249,6 +1561,10 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 
     memset(v, 0, sizeof(verify_t));
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (verify_should_stop(vf))
+        goto bailout;
+
     if (sip)
         v->wcs = sip;
     else {
@@ -1398,6 +1714,9 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
         logverb("After applying RoR, NR=%i, NT=%i\n", v->NR, v->NT);
         goto bailout;
     }
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (verify_should_stop(vf))
+        goto bailout;
 
     worst = -HUGE_VAL;
     K = real_verify_star_lists(v, effA, distractors,
@@ -38,5 +38,29 @@
 #include "astrometry/an-thread-pthreads.h"
 #endif
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/*
+ Reads an int flag that another thread sets, such as the cancel and solved
+ flags of the solver, with acquire ordering, so that whatever the other
+ thread wrote before setting the flag is seen after it.  A NULL flag is
+ never set.  On the C++ side the flags are std::atomic<int>, which is an int
+ with the same layout.
+ */
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+static inline int an_flag_is_set(const int* flag) {
+    if (!flag)
+        return 0;
+#if !defined(_MSC_VER)
+    return __atomic_load_n(flag, __ATOMIC_ACQUIRE) != 0;
+#elif defined(_M_ARM64)
+    return __ldar32((unsigned __int32 volatile*)flag) != 0;
+#else
+    // Volatile loads have acquire semantics on x86 and x64 with MSVC
+    return *(const volatile int*)flag != 0;
+#endif
+}
+
 
 #endif
@@ -124,12 +124,30 @@ struct blind_params {
     char* cancelfname;
     anbool cancelled;
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // in-process alternative to the cancel file: the run is cancelled as soon
+    // as the int this points to becomes nonzero.  It is read with
+    // an_flag_is_set(), and so is "solved_flag".
+    const int* cancel_flag;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // in-process alternative to the solved file, shared by the blind_t
+    // instances solving the same single field in parallel.  The field counts
+    // as solved once the int "solved_flag" points to is nonzero;
+    // "solved_callback" is called when this run solves it and should set it.
+    const int* solved_flag;
+    void (*solved_callback)(void*);
+    void* solved_userdata;
+
     anbool best_hit_only;
 };
 typedef struct blind_params blind_t;
 
 void blind_set_field_file(blind_t* bp, const char* fn);
 void blind_set_cancel_file(blind_t* bp, const char* fn);
+void blind_set_cancel_flag(blind_t* bp, const int* flag);
+void blind_set_solved_flag(blind_t* bp, const int* flag,
+                           void (*callback)(void*), void* userdata);
 void blind_set_solved_file(blind_t* bp, const char* fn);
 void blind_set_solvedin_file(blind_t* bp, const char* fn);
 void blind_set_solvedout_file(blind_t* bp, const char* fn);
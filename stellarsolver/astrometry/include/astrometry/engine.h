@@ -58,12 +58,22 @@ void engine_add_search_path(engine_t* engine, const char* path);
 char* engine_find_index(engine_t*, const char* name);
 // note that "path" must be a full path name.
 int engine_add_index(engine_t* engine, char* path);
+// adds an index that is already fully loaded; the caller keeps ownership of it
+// and must not free it until after engine_free().
+int engine_add_loaded_index(engine_t* engine, index_t* ind);
+// adds an index of which only the metadata has been filled in (ie. from a
+// catalogue of the index files), without opening the file; the engine takes
+// ownership of it.  The file is loaded by name when it is used.
+int engine_add_index_metadata(engine_t* engine, index_t* ind);
 // look in all the search path directories for index files.
 int engine_autoindex_search_paths(engine_t* engine);
 int engine_parse_config_file_stream(engine_t* engine, FILE* fconf);
 int engine_parse_config_file(engine_t* engine, const char* fn);
 int engine_run_job(engine_t* engine, job_t* job);
 void engine_free(engine_t* engine);
+// frees what the engine owns and empties its lists of search paths and indexes,
+// so that the same engine can be used for another job.
+void engine_reset(engine_t* engine);
 
 job_t* engine_read_job_file(engine_t* engine, const char* jobfn);
 int job_set_base_dir(job_t* job, const char* dir);
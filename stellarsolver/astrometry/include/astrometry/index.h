@@ -73,6 +73,13 @@ typedef struct {
     int dimquads;
     int nstars;
     int nquads;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // Set if the index is a native (indexbin.h) file; the components then
+    // point into "binmap".
+    anbool binfile;
+    void* binmap;
+    size_t binmapsize;
 } index_t;
 
 /**
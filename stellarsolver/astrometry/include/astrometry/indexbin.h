@@ -0,0 +1,59 @@
+/*
+ # This file is part of the Astrometry.net suite.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+
+#ifndef AN_INDEXBIN_H
+#define AN_INDEXBIN_H
+
+#include "astrometry/index.h"
+#include "astrometry/an-bool.h"
+
+/*
+ A native binary layout for index files.
+
+ The code tree, the quads, the star tree (with its sweep numbers) and
+ the tree of bright stars are all stored in one file, in the byte order
+ and type sizes of the machine that wrote it, behind a small fixed
+ header.  Every array starts on a 64-byte boundary, and the big ones on
+ a page boundary, so the whole file can be mapped at once and used in
+ place.  Opening an index is one mmap and a check of the header; nothing
+ is parsed or copied.
+
+ The converter writes the trees with the smallest data type that keeps
+ the quantization error of the points below a tolerance: u16 for the
+ codes and u32 for the star positions.  Trees that already use integer
+ types are written as they are.
+ */
+
+#define INDEXBIN_SUFFIX ".ssidx"
+// The folder, inside the folder of an index, that the converted files go to
+// when no other place is given.  It must not be one of the index folders
+// the solver searches, or it would load both copies of each index.
+#define INDEXBIN_FOLDER "ssidx"
+
+/**
+ Returns TRUE if the given file starts with the native index header.
+ */
+anbool indexbin_is_file(const char* fn);
+
+/**
+ Maps the native index file "fn" and sets the "codekd", "quads" and
+ "starkd" of "index" to point into it.  Returns 0 on success.
+ */
+int indexbin_open(index_t* index, const char* fn);
+
+/**
+ Frees the components that indexbin_open() created and unmaps the file.
+ */
+void indexbin_close(index_t* index);
+
+/**
+ Writes a fully loaded index (from the FITS files or a native file) to
+ "fn" in the native layout.  Returns 0 on success.
+ */
+int indexbin_write(const index_t* index, const char* fn);
+
+#endif
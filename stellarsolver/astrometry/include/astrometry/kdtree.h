@@ -128,6 +128,39 @@ typedef struct kdtree kdtree_t;
 struct kdtree_qres;
 typedef struct kdtree_qres kdtree_qres_t;
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/*
+ Scratch space for kdtree_rangesearch_batch().  A caller that makes many
+ batch searches keeps one of these, zeroed before the first search, so
+ that the arrays are only allocated once and then grow as needed.  Each
+ one is "size" bytes.  Free it with kdtree_batch_scratch_free().
+ */
+struct kdtree_batch_scratch {
+    void* tqueries;
+    size_t tqueries_size;
+    void* use_tquery;
+    size_t use_tquery_size;
+    void* bblo;
+    size_t bblo_size;
+    void* bbhi;
+    size_t bbhi_size;
+    void* lists;
+    size_t lists_size;
+    void* runs;
+    size_t runs_size;
+    void* sorted;
+    size_t sorted_size;
+    void* counts;
+    size_t counts_size;
+    void* inds;
+    size_t inds_size;
+    void* sdists;
+    size_t sdists_size;
+    void* points;
+    size_t points_size;
+};
+typedef struct kdtree_batch_scratch kdtree_batch_scratch_t;
+
 struct kdtree_funcs {
     void* (*get_data)(const kdtree_t* kd, int i);
     void  (*copy_data_double)(const kdtree_t* kd, int start, int N, double* dest);
@@ -139,6 +172,8 @@ struct kdtree_funcs {
 
     void  (*nearest_neighbour_internal)(const kdtree_t* kd, const void* query, double* bestd2, int* pbest);
     kdtree_qres_t* (*rangesearch)(const kdtree_t* kd, kdtree_qres_t* res, const void* pt, double maxd2, int options);
+    int (*rangesearch_batch)(const kdtree_t* kd, kdtree_qres_t** results, const void* pts, int N, double maxd2, int options,
+                             kdtree_batch_scratch_t* scratch);
 
     void (*nodes_contained)(const kdtree_t* kd,
                             const void* querylow, const void* queryhi,
@@ -335,6 +370,10 @@ void kdtree_inverse_permutation(const kdtree_t* tree, int* invperm);
 /* Free results */
 void kdtree_free_query(kdtree_qres_t *res);
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Frees the arrays of a batch search's scratch space and zeroes it, so it can be used again.
+void kdtree_batch_scratch_free(kdtree_batch_scratch_t* scratch);
+
 /* Free a tree; does not free kd->data */
 void kdtree_free(kdtree_t *kd);
 
@@ -586,6 +625,26 @@ kdtree_t* KDFUNC(kdtree_build)
                                                                                                                                                      */
                                                                                                                                                     kdtree_qres_t* KDFUNC(kdtree_rangesearch_options_reuse)(const kdtree_t *kd, kdtree_qres_t* res, const void *pt, double maxd2, int options);
 
+/*
+ Range search for a block of N query points with the same maxd2, as
+ though kdtree_rangesearch_options_reuse() was called for each of them.
+ The tree is walked once for the whole block, and each node is only
+ tested against the queries that are still in range of it.
+
+ pts: the N query points, one after the other.
+
+ results: an array of N result structs.  Each one can be NULL, in which
+ case it is allocated, or a result struct to reuse.  Each query's results
+ are the same, in the same order, as its own range search would give.
+
+ scratch: the scratch space to keep between searches, or NULL to use
+ scratch space that is only kept for this search.
+
+ Returns 0 on success, -1 on failure.
+ */
+int KDFUNC(kdtree_rangesearch_batch)(const kdtree_t *kd, kdtree_qres_t** results, const void *pts, int N, double maxd2, int options,
+                                     kdtree_batch_scratch_t* scratch);
+
 #if !defined(KD_DIM)
 #undef KD_DIM_GENERIC
 #endif
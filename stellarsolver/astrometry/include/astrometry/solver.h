@@ -34,6 +34,17 @@ enum {
 #define DEFAULT_DISTRACTOR_RATIO 0.25
 #define DEFAULT_VERIFY_PIX 1.0
 #define DEFAULT_BAIL_THRESHOLD 1e-100
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+#define DEFAULT_VERIFY_FAST_NREFS 0
+#define DEFAULT_FAST_BAIL_THRESHOLD 1e-12
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// The most codes one quad can produce: both parities, both orders of
+// the backbone stars A and B, and every order of the (up to 3) other stars.
+#if DQMAX > 5
+#error "SOLVER_MAX_QUAD_CODES needs updating for the new DQMAX"
+#endif
+#define SOLVER_MAX_QUAD_CODES (2 * 2 * 6)
 
 struct verify_field_t;
 struct solver_t {
@@ -118,6 +129,17 @@ struct solver_t {
     // maximum Bayes factor value).
     double logratio_stoplooking;
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // Before verifying a hit against all the reference stars, it is checked
+    // against this many of the brightest ones, and if the log-odds ratio drops
+    // below "logratio_fast_bail" it is rejected right away.  The full bail
+    // threshold can't be reached with so few stars, so this one is separate.
+    // A few stars can also reject a true match that the full verification
+    // would have accepted, so this is off (zero) by default.  About 30 stars
+    // and the default log(1e-12) are the values to try.
+    int verify_fast_nrefs;
+    double logratio_fast_bail;
+
     // Number of field quads to try or zero for no limit.
     int maxquads;
     // Number of quad matches to try or zero for no limit.
@@ -136,12 +158,31 @@ struct solver_t {
     // calling again.  The parameter is "userdata".
     time_t (*timer_callback)(void*);
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // If set, solver_run() uses this to work on the AB pairs of each new star
+    // in parallel.  It must call task(taskdata, i) for each i in [0, n), from
+    // as many threads as it likes, and return once they have all finished.
+    // After a task returns nonzero, the tasks after it that have not started
+    // yet can be skipped.  The first parameter is "parallel_data".
+    // The matches are still recorded in the same order as without it.
+    void (*parallel_for)(void* parallel_data, int (*task)(void* taskdata, int i),
+                         void* taskdata, int n);
+    void* parallel_data;
+
     // FIELDS THAT AFFECT THE RUNNING SOLVER ON CALLBACK
     // =================================================
 
     // Bail out ASAP.
     anbool quit_now;
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // If set, the solver bails out as soon as the int this points to becomes
+    // nonzero.  Another thread sets it to cancel the solve without a cancel file.
+    // Both flags are read with an_flag_is_set().
+    const int* cancel_flag;
+    // Same, but set by another solver working on the same field when it solves it.
+    const int* solved_flag;
+
     // SOLVER OUTPUTS
     // ==============
     // NOTE: these are only incremented, not initialized.  It's up to you to set
@@ -161,6 +202,8 @@ struct solver_t {
     int num_abscale_skipped;
     // The number of times we ran verification on a quad.
     int num_verified;
+    // The number of those that were rejected by the quick check.
+    int num_fast_rejected; //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
     // INTERNAL PARAMETERS; DO NOT MODIFY
     // ==================================
@@ -204,6 +247,17 @@ struct solver_t {
 
     // Cached data about this field, for verify_hit().
     verify_field_t* vf;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // The results and scratch space of the code tree searches, kept from one
+    // quad to the next.  There is a result for each code a quad can produce.
+    kdtree_qres_t* code_results[SOLVER_MAX_QUAD_CODES];
+    kdtree_batch_scratch_t code_scratch;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // While an AB pair is being worked on in parallel, the matches that would
+    // be recorded are collected here instead, to be recorded in order later.
+    bl* pending_hits;
 };
 typedef struct solver_t solver_t;
 
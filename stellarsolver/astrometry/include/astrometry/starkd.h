@@ -26,12 +26,28 @@
 
 #define STARTREE_NAME "stars"
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+#define STARTREE_BRIGHT_NSWEEPS 2
+#define STARTREE_BRIGHT_BUILT 2
+
 typedef struct {
     kdtree_t* tree;
     qfits_header* header;
     int* inverse_perm;
     uint8_t* sweep;
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // The brightest stars of the index (sweep < STARTREE_BRIGHT_NSWEEPS), in a
+    // small tree of their own, so that verification can look at a few bright
+    // reference stars without pulling all of them.  "brightids" maps the
+    // points of "brightkd" to star ids.  The tree is built when the index is
+    // loaded, see startree_build_bright(); "brightstate" is 0 before that, 1
+    // while a thread builds it and STARTREE_BRIGHT_BUILT afterwards.  They
+    // stay NULL if the index has no sweep numbers.
+    kdtree_t* brightkd;
+    int* brightids;
+    int brightstate;
+
     // reading or writing?
     int writing;
 
@@ -175,6 +191,20 @@ void startree_set_jitter(startree_t* s, double jitter_arcsec);
 // or the tree has no sweep numbers.
 int startree_get_sweep(const startree_t* s, int ind);
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Builds the tree of the bright stars (see "brightkd") if it isn't built
+// yet.  Each tree is built once; a thread that calls this while another one
+// is building the same tree waits for it, and other trees are not held up.
+void startree_build_bright(startree_t* s);
+
+// Searches the bright stars (see "brightkd") within a radius of a point,
+// building their tree first if the index was loaded without it.  This can be
+// called from several threads at once.  Returns the number found, with their
+// star ids and xyz positions in newly-allocated arrays, or 0 with the arrays
+// set to NULL.
+int startree_search_bright(startree_t* s, const double* xyzcenter, double radius2,
+                           int** starids, double** xyzresults);
+
 int startree_N(const startree_t* s);
 
 int startree_nodes(const startree_t* s);
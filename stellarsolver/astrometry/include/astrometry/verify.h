@@ -14,6 +14,19 @@
 #include "astrometry/bl.h"
 #include "astrometry/starxy.h"
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// The most uniformization grid sizes that verify_field_prepare_uniformize()
+// will keep the field star bins for.
+#define VERIFY_MAX_BIN_GRIDS 32
+
+struct verify_bin_grid_t {
+    int nw;
+    int nh;
+    // the bin of each field star
+    int* binids;
+};
+typedef struct verify_bin_grid_t verify_bin_grid_t;
+
 struct verify_field_t {
     const starxy_t* field;
     // this copy is normal.
@@ -28,6 +41,38 @@ struct verify_field_t {
     anbool do_dedup;
     // apply radius-of-relevance filtering
     anbool do_ror;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // if set, verification bails out as soon as the int either of these point to is nonzero.
+    // They are read with an_flag_is_set().
+    const int* cancel_flag;
+    const int* solved_flag;
+
+    // a grid over the field stars, for looking up the field stars near a
+    // position without the kdtree.  The stars in cell (ix, iy) are
+    // grid_stars[grid_start[c] .. grid_start[c+1]-1], c = iy * grid_nx + ix,
+    // and their positions are in grid_xy in the same order.
+    double grid_x0;
+    double grid_y0;
+    double grid_cell;
+    int grid_nx;
+    int grid_ny;
+    int* grid_start;
+    int* grid_stars;
+    double* grid_xy;
+
+    // for deduplication: the field stars after star i that are within
+    // sqrt(dedup_r2) of it are dedup_stars[dedup_start[i] .. dedup_start[i+1]-1],
+    // and their distances-squared from it are in dedup_d2.
+    double dedup_r2;
+    int* dedup_start;
+    int* dedup_stars;
+    double* dedup_d2;
+
+    // the uniformization bins of the field stars, for the grid sizes
+    // that verify_field_prepare_uniformize() has been called for.
+    int nbingrids;
+    verify_bin_grid_t bingrids[VERIFY_MAX_BIN_GRIDS];
 };
 typedef struct verify_field_t verify_field_t;
 
@@ -46,6 +91,28 @@ verify_field_t* verify_field_preprocess(const starxy_t* fieldxy);
  */
 void verify_field_free(verify_field_t* vf);
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/*
+ These compute field-side data that verification would otherwise
+ recompute for every hit, so that all the verify_hit() calls for the
+ field can share it.  They must be called before verification begins,
+ since verify_hit() only reads the verify_field_t.
+
+ verify_field_prepare_dedup() finds the pairs of field stars within
+ sqrt(maxr2) of each other.  Stars whose deduplication radius is bigger
+ than that still use the kdtree.
+
+ verify_field_prepare_uniformize() puts the field stars in bins for each
+ uniformization grid size that a hit between "scalelo" and "scalehi"
+ arcsec/pixel can use for an index with "cutnside".  Nothing is done if
+ the range covers too many grid sizes; those hits bin the stars themselves.
+ */
+void verify_field_prepare_dedup(verify_field_t* vf, double maxr2);
+
+void verify_field_prepare_uniformize(verify_field_t* vf, int cutnside,
+                                     double scalelo, double scalehi,
+                                     double fieldW, double fieldH);
+
 
 
 
@@ -105,6 +172,31 @@ void verify_hit(const startree_t* skdt,
                 anbool distance_from_quad_bonus,
                 anbool fake_match);
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/*
+ A quick test to run before verify_hit() on a hit that isn't a fake match.
+ It takes up to "nrefs" of the brightest reference stars in the field (by
+ sweep, from the star tree's "brightkd"), projects them into the image and
+ looks for a field star near each of them in the grid of "vf".  If the
+ running log-odds ratio of those stars drops below "logratio_tobail", it
+ returns TRUE and sets "mo" the way verify_hit() does when it bails out,
+ without pulling all the reference stars.  Otherwise it returns FALSE and
+ verify_hit() has to decide.  The parameters are the same as verify_hit().
+ With only a few stars, it can reject a true match that verify_hit() would
+ have accepted, so it is only run when "nrefs" is set.
+ */
+anbool verify_hit_fast_reject(startree_t* skdt,
+                              MatchObj* mo,
+                              const sip_t* sip,
+                              const verify_field_t* vf,
+                              double verify_pix2,
+                              double distractors,
+                              double fieldW,
+                              double fieldH,
+                              int nrefs,
+                              double logratio_tobail,
+                              anbool distance_from_quad_bonus);
+
 // Distractor
 #define THETA_DISTRACTOR -1
 // Conflict
@@ -530,6 +530,23 @@ void kdtree_free_query(kdtree_qres_t *kq) {
     FREE(kq);
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+void kdtree_batch_scratch_free(kdtree_batch_scratch_t* scratch) {
+    if (!scratch) return;
+    FREE(scratch->tqueries);
+    FREE(scratch->use_tquery);
+    FREE(scratch->bblo);
+    FREE(scratch->bbhi);
+    FREE(scratch->lists);
+    FREE(scratch->runs);
+    FREE(scratch->sorted);
+    FREE(scratch->counts);
+    FREE(scratch->inds);
+    FREE(scratch->sdists);
+    FREE(scratch->points);
+    memset(scratch, 0, sizeof(kdtree_batch_scratch_t));
+}
+
 void kdtree_free(kdtree_t *kd) {
     if (!kd) return;
     FREE(kd->name);
@@ -1445,6 +1445,584 @@ kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
 }
 
 
+/*
+ Which child of an internal node does a range search with a splitting
+ plane search first?  It pushes the near child and then the far one, so
+ the far child is searched first.  This returns TRUE if that is the
+ left child.
+ */
+static anbool split_far_child_is_left(const kdtree_t* kd, int nodeid,
+                                      const etype* query, const ttype* tquery,
+                                      anbool use_tsplit) {
+    int dim = -1;
+    ttype split = *KD_SPLIT(kd, nodeid);
+    if (kd->splitdim)
+        dim = kd->splitdim[nodeid];
+    if (!kd->splitdim && TTYPE_INTEGER) {
+        bigint tmpsplit = split;
+        dim = tmpsplit & kd->dimmask;
+        split = tmpsplit & kd->splitmask;
+    }
+    if (TTYPE_INTEGER && use_tsplit)
+        return !(tquery[dim] < split);
+    {
+        dtype rsplit = POINT_TE(kd, dim, split);
+        return !(query[dim] < rsplit);
+    }
+}
+
+/*
+ Would a single range search with a splitting plane reach leaf "a"
+ before leaf "b"?  The two paths split at their common ancestor, and
+ whichever of them goes into the far child there comes first.
+ */
+static anbool split_leaf_searched_before(const kdtree_t* kd, int a, int b,
+                                         const etype* query, const ttype* tquery,
+                                         anbool use_tsplit) {
+    int childa = a, childb = b;
+    while (a != b) {
+        if (a > b) {
+            childa = a;
+            a = KD_PARENT(a);
+        } else {
+            childb = b;
+            b = KD_PARENT(b);
+        }
+    }
+    if (split_far_child_is_left(kd, a, query, tquery, use_tsplit))
+        return KD_IS_LEFT_CHILD(childa);
+    return KD_IS_LEFT_CHILD(childb);
+}
+
+// Makes one array of a batch search's scratch space at least "need" bytes,
+// keeping what it already has if that is big enough.
+static void* batch_scratch_reserve(void** buf, size_t* size, size_t need) {
+    if (need == 0)
+        need = 1;
+    if (*size < need) {
+        void* grown = REALLOC(*buf, need);
+        if (!grown)
+            return NULL;
+        *buf = grown;
+        *size = need;
+    }
+    return *buf;
+}
+
+// One leaf's worth of results for one query of a batch.
+typedef struct {
+    int query;
+    int leaf;
+    int first;
+    int n;
+} batch_leaf_results;
+
+/*
+ Put the results of one query into the order a single range search
+ would have found them in.  With a splitting plane, the order of the
+ children depends on the side of the plane the query is on, while the
+ batch always searches them in the same order, so the runs of results
+ from each leaf are reordered.
+ */
+static anbool reorder_batch_results(const kdtree_t* kd, kdtree_qres_t* res,
+                                    batch_leaf_results* runs, int nruns,
+                                    const etype* query, const ttype* tquery,
+                                    anbool use_tsplit, int D,
+                                    anbool do_dists, anbool do_points,
+                                    kdtree_batch_scratch_t* scratch) {
+    int i, j, k, pos;
+    anbool sorted = TRUE;
+    u32* inds;
+    double* sdists = NULL;
+    etype* points = NULL;
+
+    for (i=1; i<nruns && sorted; i++)
+        sorted = split_leaf_searched_before(kd, runs[i-1].leaf, runs[i].leaf,
+                                            query, tquery, use_tsplit);
+    if (sorted)
+        return TRUE;
+
+    // There are only a handful of leaves per query, so an insertion sort is fine.
+    for (i=1; i<nruns; i++) {
+        batch_leaf_results run = runs[i];
+        for (j=i; j>0 && split_leaf_searched_before(kd, run.leaf, runs[j-1].leaf,
+                                                   query, tquery, use_tsplit); j--)
+            runs[j] = runs[j-1];
+        runs[j] = run;
+    }
+
+    inds = batch_scratch_reserve(&scratch->inds, &scratch->inds_size, res->nres * sizeof(u32));
+    if (do_dists)
+        sdists = batch_scratch_reserve(&scratch->sdists, &scratch->sdists_size, res->nres * sizeof(double));
+    if (do_points)
+        points = batch_scratch_reserve(&scratch->points, &scratch->points_size, (size_t)res->nres * D * sizeof(etype));
+    if (!inds || (do_dists && !sdists) || (do_points && !points)) {
+        SYSERROR("Failed to allocate space to reorder kdtree results");
+        return FALSE;
+    }
+    memcpy(inds, res->inds, res->nres * sizeof(u32));
+    if (do_dists)
+        memcpy(sdists, res->sdists, res->nres * sizeof(double));
+    if (do_points)
+        memcpy(points, res->results.ETYPE, (size_t)res->nres * D * sizeof(etype));
+
+    pos = 0;
+    for (i=0; i<nruns; i++) {
+        for (k=runs[i].first; k<runs[i].first + runs[i].n; k++) {
+            res->inds[pos] = inds[k];
+            if (do_dists)
+                res->sdists[pos] = sdists[k];
+            if (do_points)
+                memcpy(res->results.ETYPE + (size_t)pos * D, points + (size_t)k * D,
+                       D * sizeof(etype));
+            pos++;
+        }
+    }
+    return TRUE;
+}
+
+int MANGLE(kdtree_rangesearch_batch)
+     (const kdtree_t* kd, kdtree_qres_t** results, const void* vqueries,
+      int nq, double maxd2, int options, kdtree_batch_scratch_t* scratch)
+{
+    int nodestack[100];
+    int liststart[100];
+    int listsize[100];
+    int stackpos = 0;
+    int D;
+    anbool do_dists;
+    anbool do_points = TRUE;
+    anbool do_wholenode_check;
+    double maxdist = 0.0;
+    ttype tlinf = 0;
+    ttype tl1 = 0;
+    ttype tl2 = 0;
+    bigttype bigtl2 = 0;
+
+    anbool use_tmath = FALSE;
+    anbool use_bigtmath = FALSE;
+    anbool tsplit_fits = FALSE;
+
+    anbool do_precheck = FALSE;
+    anbool do_l1precheck = FALSE;
+
+    anbool use_bboxes = FALSE;
+    Unused anbool use_splits = FALSE;
+
+    double dtl1=0.0, dtl2=0.0, dtlinf=0.0;
+
+    const etype* queries = vqueries;
+    ttype* tqueries = NULL;
+    anbool* use_tquery = NULL;
+    etype* bblo = NULL;
+    etype* bbhi = NULL;
+    // The lists of the queries still searching each node on the stack
+    int* lists = NULL;
+    int listcap, listend;
+    // The leaves each query got results from, when they need reordering
+    batch_leaf_results* runs = NULL;
+    int nruns = 0, runcap = 0;
+    int q, status = -1;
+    // If the caller doesn't keep scratch space, it is only kept for this search
+    kdtree_batch_scratch_t ownscratch;
+
+    if (!kd || !queries || !results)
+        return -1;
+    if (nq <= 0)
+        return 0;
+#if defined(KD_DIM)
+    assert(kd->ndim == KD_DIM);
+    D = KD_DIM;
+#else
+    D = kd->ndim;
+#endif
+
+    if (options & KD_OPTIONS_SORT_DISTS)
+        options |= KD_OPTIONS_COMPUTE_DISTS;
+    do_dists = options & KD_OPTIONS_COMPUTE_DISTS;
+    do_wholenode_check = !(options & KD_OPTIONS_SMALL_RADIUS);
+
+    if ((options & KD_OPTIONS_SPLIT_PRECHECK) &&
+        kd->bb.any && kd->splitdim) {
+        do_precheck = TRUE;
+    }
+
+    if ((options & KD_OPTIONS_L1_PRECHECK) &&
+        kd->bb.any) {
+        do_l1precheck = TRUE;
+    }
+
+    if (!kd->split.any) {
+        assert(kd->bb.any);
+        use_bboxes = TRUE;
+    } else {
+        if (kd->bb.any) {
+            if (options & KD_OPTIONS_USE_SPLIT) {
+                use_splits = TRUE;
+            } else {
+                use_bboxes = TRUE;
+            }
+        } else {
+            use_splits = TRUE;
+            assert(kd->splitdim || TTYPE_INTEGER);
+        }
+    }
+
+    assert(use_splits || use_bboxes);
+
+    maxdist = sqrt(maxd2);
+
+    if (!scratch) {
+        memset(&ownscratch, 0, sizeof(ownscratch));
+        scratch = &ownscratch;
+    }
+    tqueries = batch_scratch_reserve(&scratch->tqueries, &scratch->tqueries_size, (size_t)nq * D * sizeof(ttype));
+    use_tquery = batch_scratch_reserve(&scratch->use_tquery, &scratch->use_tquery_size, nq * sizeof(anbool));
+    bblo = batch_scratch_reserve(&scratch->bblo, &scratch->bblo_size, D * sizeof(etype));
+    bbhi = batch_scratch_reserve(&scratch->bbhi, &scratch->bbhi_size, D * sizeof(etype));
+    listcap = nq * (kd->nlevels + 3);
+    lists = batch_scratch_reserve(&scratch->lists, &scratch->lists_size, (size_t)listcap * sizeof(int));
+    runcap = scratch->runs_size / sizeof(batch_leaf_results);
+    runs = scratch->runs;
+    if (!tqueries || !use_tquery || !bblo || !bbhi || !lists) {
+        SYSERROR("Failed to allocate kdtree batch search arrays");
+        goto bailout;
+    }
+
+    // The same integer versions of the query and the distance as the single search uses.
+    // Only the conversion of the query depends on the query, the rest is shared.
+    for (q=0; q<nq; q++) {
+        use_tquery[q] = FALSE;
+        if (TTYPE_INTEGER &&
+            (kd->split.any || do_precheck || do_l1precheck))
+            use_tquery[q] = ttype_query(kd, queries + (size_t)q * D, tqueries + (size_t)q * D);
+    }
+
+    if (TTYPE_INTEGER) {
+        dtl1   = DIST_ET(kd, maxdist * sqrt(D),);
+        dtl2   = DIST2_ET(kd, maxd2, );
+        dtlinf = DIST_ET(kd, maxdist, );
+        tl1    = ceil(dtl1);
+        tlinf  = ceil(dtlinf);
+        bigtl2 = ceil(dtl2);
+        tl2    = bigtl2;
+    }
+
+    tsplit_fits = (dtlinf < TTYPE_MAX);
+
+    if (do_l1precheck)
+        if (dtl1 > TTYPE_MAX)
+            do_l1precheck = FALSE;
+
+    if (TTYPE_INTEGER && kd->bb.any) {
+        if (dtl2 < TTYPE_MAX)
+            use_tmath = TRUE;
+        else if (dtl2 < BIGTTYPE_MAX)
+            use_bigtmath = TRUE;
+        if (use_bigtmath && (options & KD_OPTIONS_NO_BIG_INT_MATH))
+            use_bigtmath = FALSE;
+    }
+
+    for (q=0; q<nq; q++) {
+        kdtree_qres_t* res = results[q];
+        if (res) {
+            if (!res->capacity)
+                resize_results(res, KDTREE_MAX_RESULTS, D, do_dists, do_points);
+            else
+                resize_results(res, res->capacity, D, do_dists, do_points);
+            res->nres = 0;
+        } else {
+            res = CALLOC(1, sizeof(kdtree_qres_t));
+            if (!res) {
+                SYSERROR("Failed to allocate kdtree_qres_t struct");
+                goto bailout;
+            }
+            resize_results(res, KDTREE_MAX_RESULTS, D, do_dists, do_points);
+            results[q] = res;
+        }
+    }
+
+    // queue root, with all the queries.
+    nodestack[0] = 0;
+    liststart[0] = 0;
+    listsize[0] = nq;
+    for (q=0; q<nq; q++)
+        lists[q] = q;
+    listend = nq;
+
+    while (stackpos >= 0) {
+        int nodeid;
+        int i, k;
+        int L, R;
+        int start, n;
+        int nleft, nright;
+        int* left;
+        int* right;
+
+        nodeid = nodestack[stackpos];
+        start = liststart[stackpos];
+        n = listsize[stackpos];
+        stackpos--;
+
+        if (KD_IS_LEAF(kd, nodeid)) {
+            dtype* data;
+            L = kdtree_left(kd, nodeid);
+            R = kdtree_right(kd, nodeid);
+
+            for (k=0; k<n; k++) {
+                const etype* query;
+                kdtree_qres_t* res;
+                int before;
+                q = lists[start + k];
+                query = queries + (size_t)q * D;
+                res = results[q];
+                before = res->nres;
+                if (do_dists) {
+                    for (i=L; i<=R; i++) {
+                        anbool bailedout = FALSE;
+                        double dsqd;
+                        data = KD_DATA(kd, D, i);
+                        dist2_bailout(kd, query, data, D, maxd2, &bailedout, &dsqd);
+                        if (bailedout)
+                            continue;
+                        if (!add_result(kd, res, dsqd, KD_PERM(kd, i), data,
+                                        D, do_dists, do_points))
+                            goto bailout;
+                    }
+                } else {
+                    for (i=L; i<=R; i++) {
+                        data = KD_DATA(kd, D, i);
+                        if (dist2_exceeds(kd, query, data, D, maxd2))
+                            continue;
+                        if (!add_result(kd, res, HUGE_VAL, KD_PERM(kd, i), data,
+                                        D, do_dists, do_points))
+                            goto bailout;
+                    }
+                }
+                if (!use_bboxes && res->nres > before) {
+                    if (nruns == runcap) {
+                        runcap = runcap ? runcap * 2 : 256;
+                        runs = batch_scratch_reserve(&scratch->runs, &scratch->runs_size,
+                                                     runcap * sizeof(batch_leaf_results));
+                        if (!runs) {
+                            SYSERROR("Failed to allocate kdtree batch search arrays");
+                            goto bailout;
+                        }
+                    }
+                    runs[nruns].query = q;
+                    runs[nruns].leaf = nodeid;
+                    runs[nruns].first = before;
+                    runs[nruns].n = res->nres - before;
+                    nruns++;
+                }
+            }
+            // this node's list was the last one, so its space can be reused.
+            listend = start;
+            continue;
+        }
+
+        // The children's lists go after this node's list, and are moved down over it afterwards.
+        left = lists + start + n;
+        right = left + n;
+        nleft = nright = 0;
+
+        for (k=0; k<n; k++) {
+            const etype* query;
+            const ttype* tquery;
+            anbool tq;
+            q = lists[start + k];
+            query = queries + (size_t)q * D;
+            tquery = tqueries + (size_t)q * D;
+            tq = use_tquery[q];
+
+            if (use_bboxes) {
+                anbool wholenode = FALSE;
+                ttype *tlo=NULL, *thi=NULL;
+
+                bboxes(kd, nodeid, &tlo, &thi, D);
+                assert(tlo && thi);
+
+                if (do_precheck && nodeid) {
+                    anbool isleftchild = KD_IS_LEFT_CHILD(nodeid);
+                    int pdim;
+                    anbool cut;
+                    if (kd->splitdim)
+                        pdim = kd->splitdim[KD_PARENT(nodeid)];
+                    else {
+                        pdim = kd->split.TTYPE[KD_PARENT(nodeid)];
+                        pdim &= kd->dimmask;
+                    }
+                    if (TTYPE_INTEGER && tq) {
+                        if (isleftchild)
+                            cut = ((tquery[pdim] > thi[pdim]) &&
+                                   (tquery[pdim] - thi[pdim] > tlinf));
+                        else
+                            cut = ((tlo[pdim] > tquery[pdim]) &&
+                                   (tlo[pdim] - tquery[pdim] > tlinf));
+                    } else {
+                        etype bb;
+                        if (isleftchild) {
+                            bb = POINT_TE(kd, pdim, thi[pdim]);
+                            cut = (query[pdim] - bb > maxdist);
+                        } else {
+                            bb = POINT_TE(kd, pdim, tlo[pdim]);
+                            cut = (bb - query[pdim] > maxdist);
+                        }
+                    }
+                    if (cut)
+                        continue;
+                }
+
+                if (TTYPE_INTEGER && do_l1precheck && tq)
+                    if (bb_point_l1mindist_exceeds_ttype(tlo, thi, (ttype*)tquery, D, tl1, tlinf))
+                        continue;
+
+                if (TTYPE_INTEGER && use_tmath && tq) {
+                    if (bb_point_mindist2_exceeds_ttype(tlo, thi, (ttype*)tquery, D, tl2))
+                        continue;
+                    wholenode = do_wholenode_check &&
+                        !bb_point_maxdist2_exceeds_ttype(tlo, thi, (ttype*)tquery, D, tl2);
+                } else if (TTYPE_INTEGER && use_bigtmath && tq) {
+                    if (bb_point_mindist2_exceeds_bigttype(tlo, thi, (ttype*)tquery, D, bigtl2))
+                        continue;
+                    wholenode = do_wholenode_check &&
+                        !bb_point_maxdist2_exceeds_bigttype(tlo, thi, (ttype*)tquery, D, bigtl2);
+                } else {
+                    int d;
+                    for (d=0; d<D; d++) {
+                        bblo[d] = POINT_TE(kd, d, tlo[d]);
+                        bbhi[d] = POINT_TE(kd, d, thi[d]);
+                    }
+                    if (bb_point_mindist2_exceeds(bblo, bbhi, query, D, maxd2))
+                        continue;
+                    wholenode = do_wholenode_check &&
+                        !bb_point_maxdist2_exceeds(bblo, bbhi, query, D, maxd2);
+                }
+
+                if (wholenode) {
+                    kdtree_qres_t* res = results[q];
+                    L = kdtree_left(kd, nodeid);
+                    R = kdtree_right(kd, nodeid);
+                    for (i=L; i<=R; i++) {
+                        double dsqd = (do_dists ? dist2(kd, query, KD_DATA(kd, D, i), D) : HUGE_VAL);
+                        if (!add_result(kd, res, dsqd, KD_PERM(kd, i),
+                                        KD_DATA(kd, D, i), D,
+                                        do_dists, do_points))
+                            goto bailout;
+                    }
+                    continue;
+                }
+
+                // bounding boxes always search the right child first, for every query.
+                left[nleft++] = q;
+                right[nright++] = q;
+
+            } else {
+                // use_splits.
+                int dim = -1;
+                ttype split = *KD_SPLIT(kd, nodeid);
+                if (kd->splitdim)
+                    dim = kd->splitdim[nodeid];
+                if (!kd->splitdim && TTYPE_INTEGER) {
+                    bigint tmpsplit;
+                    tmpsplit = split;
+                    dim = tmpsplit & kd->dimmask;
+                    split = tmpsplit & kd->splitmask;
+                }
+
+                if (TTYPE_INTEGER && tq && tsplit_fits) {
+                    if (tquery[dim] < split) {
+                        left[nleft++] = q;
+                        if (split - tquery[dim] <= tlinf)
+                            right[nright++] = q;
+                    } else {
+                        right[nright++] = q;
+                        if (tquery[dim] - split <= tlinf)
+                            left[nleft++] = q;
+                    }
+                } else {
+                    dtype rsplit = POINT_TE(kd, dim, split);
+                    if (query[dim] < rsplit) {
+                        left[nleft++] = q;
+                        if (rsplit - query[dim] <= maxdist)
+                            right[nright++] = q;
+                    } else {
+                        right[nright++] = q;
+                        if (query[dim] - rsplit <= maxdist)
+                            left[nleft++] = q;
+                    }
+                }
+            }
+        }
+
+        // Push the left child and then the right one, like the bounding box search,
+        // so the right child is searched first.
+        listend = start;
+        if (nleft) {
+            memmove(lists + listend, left, nleft * sizeof(int));
+            stackpos++;
+            nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+            liststart[stackpos] = listend;
+            listsize[stackpos] = nleft;
+            listend += nleft;
+        }
+        if (nright) {
+            memmove(lists + listend, right, nright * sizeof(int));
+            stackpos++;
+            nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+            liststart[stackpos] = listend;
+            listsize[stackpos] = nright;
+            listend += nright;
+        }
+        assert(listend + 2 * nq <= listcap);
+    }
+
+    // With splitting planes, put each query's results in the order its single search finds them.
+    if (nruns) {
+        int r = 0;
+        batch_leaf_results* sorted = batch_scratch_reserve(&scratch->sorted, &scratch->sorted_size,
+                                                           nruns * sizeof(batch_leaf_results));
+        int* counts = batch_scratch_reserve(&scratch->counts, &scratch->counts_size, (nq + 1) * sizeof(int));
+        if (!sorted || !counts) {
+            SYSERROR("Failed to allocate kdtree batch search arrays");
+            goto bailout;
+        }
+        memset(counts, 0, (nq + 1) * sizeof(int));
+        // group the runs by query, keeping their order.
+        for (r=0; r<nruns; r++)
+            counts[runs[r].query + 1]++;
+        for (q=0; q<nq; q++)
+            counts[q + 1] += counts[q];
+        for (r=0; r<nruns; r++)
+            sorted[counts[runs[r].query]++] = runs[r];
+        r = 0;
+        for (q=0; q<nq; q++) {
+            int first = r;
+            while (r < nruns && sorted[r].query == q)
+                r++;
+            if (r - first > 1 &&
+                !reorder_batch_results(kd, results[q], sorted + first, r - first,
+                                       queries + (size_t)q * D, tqueries + (size_t)q * D,
+                                       use_tquery[q] && tsplit_fits, D, do_dists, do_points,
+                                       scratch))
+                goto bailout;
+        }
+    }
+
+    for (q=0; q<nq; q++) {
+        if (!(options & KD_OPTIONS_NO_RESIZE_RESULTS))
+            resize_results(results[q], results[q]->nres, D, do_dists, do_points);
+        if (options & KD_OPTIONS_SORT_DISTS)
+            kdtree_qsort_results(results[q], kd->ndim);
+    }
+    status = 0;
+
+ bailout:
+    if (scratch == &ownscratch)
+        kdtree_batch_scratch_free(scratch);
+    return status;
+}
+
 static void* get_data(const kdtree_t* kd, int i) {
     return KD_DATA(kd, kd->ndim, i);
 }
@@ -2998,6 +3576,7 @@ void MANGLE(kdtree_update_funcs)(kdtree_t* kd) {
     kd->fun.fix_bounding_boxes = MANGLE(kdtree_fix_bounding_boxes);
     kd->fun.nearest_neighbour_internal = MANGLE(kdtree_nn);
     kd->fun.rangesearch = MANGLE(kdtree_rangesearch_options);
+    kd->fun.rangesearch_batch = MANGLE(kdtree_rangesearch_batch);
     kd->fun.nodes_contained = MANGLE(kdtree_nodes_contained);
 }
 
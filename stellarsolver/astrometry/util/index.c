@@ -4,6 +4,7 @@
  */
 
 #include "index.h"
+#include "indexbin.h"
 #include "log.h"
 #include "errors.h"
 #include "ioutils.h"
@@ -136,6 +137,10 @@ anbool index_is_file_index(const char* filename) {
     //index_t meta;
     anbool rtn = TRUE;
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (indexbin_is_file(filename))
+        return TRUE;
+
     get_filenames(filename, &quadfn, &ckdtfn, &skdtfn, &singlefile);
     if (!file_readable(quadfn)) {
         ERROR("Index file %s is not readable.", quadfn);
@@ -348,21 +353,32 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
 
     dest->indexname = strdup(indexname);
 
-    get_filenames(indexname, &(dest->quadfn), &(dest->codefn), &(dest->starfn),
-                  &singlefile);
-    if (singlefile) {
-        dest->fits = anqfits_open(dest->quadfn);
-        if (!dest->fits) {
-            ERROR("Failed to open FITS file %s", dest->quadfn);
-            goto bailout;
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // A native index is a single file that index_reload() maps as a whole.
+    if (indexbin_is_file(indexname)) {
+        dest->binfile = TRUE;
+        dest->quadfn = strdup(indexname);
+        dest->codefn = strdup(indexname);
+        dest->starfn = strdup(indexname);
+    } else {
+        get_filenames(indexname, &(dest->quadfn), &(dest->codefn), &(dest->starfn),
+                      &singlefile);
+        if (singlefile) {
+            dest->fits = anqfits_open(dest->quadfn);
+            if (!dest->fits) {
+                ERROR("Failed to open FITS file %s", dest->quadfn);
+                goto bailout;
+            }
         }
     }
 
     if (index_reload(dest)) {
         goto bailout;
     }
-    free(dest->indexname);
-    dest->indexname = strdup(quadfile_get_filename(dest->quads));
+    if (!dest->binfile) {
+        free(dest->indexname);
+        dest->indexname = strdup(quadfile_get_filename(dest->quads));
+    }
     set_meta(dest);
 
     logverb("Index scale: [%g, %g] arcmin, [%g, %g] arcsec\n",
@@ -391,6 +407,14 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
 }
 
 int index_reload(index_t* index) {
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (index->binfile) {
+        if (index->starkd)
+            return 0;
+        logverb("Mapping native index %s...\n", index->indexname);
+        return indexbin_open(index, index->indexname);
+    }
+
     // Read .skdt file...
     if (!index->starkd) {
         if (index->fits)
@@ -404,6 +428,10 @@ int index_reload(index_t* index) {
             goto bailout;
         }
     }
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // The bright star tree is built now, before solvers can share the index,
+    // rather than by the first one to verify a match.
+    startree_build_bright(index->starkd);
 
     // Read .quad file...
     if (!index->quads) {
@@ -439,6 +467,11 @@ int index_reload(index_t* index) {
 }
 
 void index_unload(index_t* index) {
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (index->binfile) {
+        indexbin_close(index);
+        return;
+    }
     if (index->starkd) {
         startree_close(index->starkd);
         index->starkd = NULL;
@@ -455,6 +488,10 @@ void index_unload(index_t* index) {
 
 int index_close_fds(index_t* ind) {
     kdtree_fits_t* io;
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // A native index has no open files once it is mapped.
+    if (ind->binfile)
+        return 0;
     if (ind->quads->fb->fid) {
         if (fclose(ind->quads->fb->fid)) {
             SYSERROR("Failed to fclose() an astrometry_net_data quadfile");
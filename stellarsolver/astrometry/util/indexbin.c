@@ -0,0 +1,566 @@
+/*
+ # This file is part of the Astrometry.net suite.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "indexbin.h"
+#include "kdtree.h"
+#include "starkd.h"
+#include "codekd.h"
+#include "quadfile.h"
+#include "starutil.h"
+#include "fitsioutils.h"
+#include "qfits_header.h"
+#include "ioutils.h"
+#include "errors.h"
+#include "log.h"
+
+#define INDEXBIN_MAGIC "SSINDEX\0"
+#define INDEXBIN_VERSION 1
+#define INDEXBIN_ENDIAN 0x01020304
+
+// Small arrays are aligned to a cache line, big ones to a page.
+#define INDEXBIN_ALIGN 64
+#define INDEXBIN_PAGE 4096
+
+// The largest quantization error the converter accepts for each tree, in
+// the units of the tree: code space, and distance on the unit sphere.
+#define INDEXBIN_CODE_TOLERANCE 1e-4
+#define INDEXBIN_STAR_TOLERANCE 5e-9
+
+// Everything in the header is 8-byte aligned, so the layout doesn't depend
+// on the compiler's padding rules.  Offsets are from the start of the file;
+// an offset of 0 means the array isn't there.
+typedef struct {
+    uint64_t lr;
+    uint64_t perm;
+    uint64_t bb;
+    uint64_t split;
+    uint64_t splitdim;
+    uint64_t data;
+    uint64_t minval;
+    uint64_t maxval;
+    double scale;
+    double invscale;
+    uint32_t treetype;
+    int32_t ndata;
+    int32_t ndim;
+    int32_t nnodes;
+    int32_t nbottom;
+    int32_t ninterior;
+    int32_t nlevels;
+    int32_t has_linear_lr;
+    int32_t n_bb;
+    uint32_t dimbits;
+    uint32_t dimmask;
+    uint32_t splitmask;
+} indexbin_tree_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t filesize;
+    uint64_t quads;
+    uint64_t sweep;
+    uint64_t brightids;
+    // radians, like quadfile_t
+    double index_scale_upper;
+    double index_scale_lower;
+    double jitter;
+    double cutdedup;
+    int32_t indexid;
+    int32_t healpix;
+    int32_t hpnside;
+    int32_t dimquads;
+    int32_t nquads;
+    int32_t nstars;
+    int32_t cutnside;
+    int32_t cutnsweep;
+    int32_t cutmargin;
+    int32_t circle;
+    int32_t cx_less_than_dx;
+    int32_t meanx_less_than_half;
+    char cutband[8];
+    indexbin_tree_t codetree;
+    indexbin_tree_t startree;
+    indexbin_tree_t brighttree;
+} indexbin_header_t;
+
+static int tree_type_size(uint32_t treetype) {
+    switch (treetype & KDT_TREE_MASK) {
+    case KDT_TREE_DOUBLE:
+        return sizeof(double);
+    case KDT_TREE_FLOAT:
+        return sizeof(float);
+    case KDT_TREE_U32:
+        return sizeof(u32);
+    case KDT_TREE_U16:
+        return sizeof(u16);
+    }
+    return 0;
+}
+
+static int data_type_size(uint32_t treetype) {
+    switch (treetype & KDT_DATA_MASK) {
+    case KDT_DATA_DOUBLE:
+        return sizeof(double);
+    case KDT_DATA_FLOAT:
+        return sizeof(float);
+    case KDT_DATA_U32:
+        return sizeof(u32);
+    case KDT_DATA_U16:
+        return sizeof(u16);
+    }
+    return 0;
+}
+
+anbool indexbin_is_file(const char* fn) {
+    char magic[8];
+    FILE* f = fopen(fn, "rb");
+    anbool rtn;
+    if (!f)
+        return FALSE;
+    rtn = (fread(magic, 1, sizeof(magic), f) == sizeof(magic)) &&
+        (memcmp(magic, INDEXBIN_MAGIC, sizeof(magic)) == 0);
+    fclose(f);
+    return rtn;
+}
+
+// Checks that an array of "size" bytes at "offset" lies inside the file.
+static anbool section_ok(uint64_t offset, uint64_t size, uint64_t filesize, anbool required) {
+    if (!offset)
+        return !required;
+    if (offset % 8)
+        return FALSE;
+    return offset <= filesize && size <= filesize - offset;
+}
+
+static anbool tree_ok(const indexbin_tree_t* t, uint64_t filesize) {
+    uint64_t tsize, dsize;
+    if (!t->ndata)
+        return TRUE;
+    tsize = tree_type_size(t->treetype);
+    dsize = data_type_size(t->treetype);
+    if (!tsize || !dsize || t->ndata < 0 || t->ndim < 1 ||
+        t->nbottom < 1 || t->ninterior < 0 ||
+        t->nnodes != t->nbottom + t->ninterior ||
+        t->n_bb < 0 || t->n_bb > t->nnodes)
+        return FALSE;
+    if (!t->bb && !t->split)
+        return FALSE;
+    return
+        section_ok(t->lr, (uint64_t)t->nbottom * sizeof(int32_t), filesize, FALSE) &&
+        section_ok(t->perm, (uint64_t)t->ndata * sizeof(u32), filesize, FALSE) &&
+        section_ok(t->bb, (uint64_t)t->n_bb * 2 * t->ndim * tsize, filesize, FALSE) &&
+        section_ok(t->split, (uint64_t)t->ninterior * tsize, filesize, FALSE) &&
+        section_ok(t->splitdim, (uint64_t)t->ninterior, filesize, FALSE) &&
+        section_ok(t->data, (uint64_t)t->ndata * t->ndim * dsize, filesize, TRUE) &&
+        section_ok(t->minval, (uint64_t)t->ndim * sizeof(double), filesize, FALSE) &&
+        section_ok(t->maxval, (uint64_t)t->ndim * sizeof(double), filesize, FALSE);
+}
+
+static int check_header(const indexbin_header_t* hdr, uint64_t filesize, const char* fn) {
+    if (memcmp(hdr->magic, INDEXBIN_MAGIC, sizeof(hdr->magic))) {
+        ERROR("File %s is not a native index", fn);
+        return -1;
+    }
+    if (hdr->version != INDEXBIN_VERSION) {
+        ERROR("Native index %s has version %u; this library reads version %i", fn,
+              (unsigned int)hdr->version, INDEXBIN_VERSION);
+        return -1;
+    }
+    if (hdr->endian != INDEXBIN_ENDIAN) {
+        ERROR("Native index %s was written on a machine with a different byte order", fn);
+        return -1;
+    }
+    if (hdr->filesize != filesize) {
+        ERROR("Native index %s should be %llu bytes but is %llu; it may be truncated", fn,
+              (unsigned long long)hdr->filesize, (unsigned long long)filesize);
+        return -1;
+    }
+    if (hdr->dimquads < 3 || hdr->dimquads > DQMAX || hdr->nquads < 0 || hdr->nstars < 0 ||
+        hdr->codetree.ndata != hdr->nquads || hdr->startree.ndata != hdr->nstars ||
+        !tree_ok(&hdr->codetree, filesize) ||
+        !tree_ok(&hdr->startree, filesize) ||
+        !tree_ok(&hdr->brighttree, filesize) ||
+        !section_ok(hdr->quads, (uint64_t)hdr->nquads * hdr->dimquads * sizeof(uint32_t), filesize, TRUE) ||
+        !section_ok(hdr->sweep, (uint64_t)hdr->nstars, filesize, FALSE) ||
+        !section_ok(hdr->brightids, (uint64_t)hdr->brighttree.ndata * sizeof(int), filesize,
+                    hdr->brighttree.ndata > 0)) {
+        ERROR("Native index %s has an invalid layout", fn);
+        return -1;
+    }
+    return 0;
+}
+
+// The tree's arrays point straight into the mapping; only the kdtree_t is allocated.
+static kdtree_t* tree_from_map(char* map, const indexbin_tree_t* t) {
+    kdtree_t* kd;
+    if (!t->ndata)
+        return NULL;
+    kd = calloc(1, sizeof(kdtree_t));
+    kd->treetype = t->treetype;
+    kd->lr = t->lr ? (int32_t*)(map + t->lr) : NULL;
+    kd->perm = t->perm ? (u32*)(map + t->perm) : NULL;
+    kd->bb.any = t->bb ? (void*)(map + t->bb) : NULL;
+    kd->n_bb = t->n_bb;
+    kd->split.any = t->split ? (void*)(map + t->split) : NULL;
+    kd->splitdim = t->splitdim ? (u8*)(map + t->splitdim) : NULL;
+    kd->dimbits = (u8)t->dimbits;
+    kd->dimmask = t->dimmask;
+    kd->splitmask = t->splitmask;
+    kd->data.any = map + t->data;
+    kd->free_data = FALSE;
+    kd->minval = t->minval ? (double*)(map + t->minval) : NULL;
+    kd->maxval = t->maxval ? (double*)(map + t->maxval) : NULL;
+    kd->scale = t->scale;
+    kd->invscale = t->invscale;
+    kd->ndata = t->ndata;
+    kd->ndim = t->ndim;
+    kd->nnodes = t->nnodes;
+    kd->nbottom = t->nbottom;
+    kd->ninterior = t->ninterior;
+    kd->nlevels = t->nlevels;
+    kd->has_linear_lr = t->has_linear_lr;
+    kdtree_update_funcs(kd);
+    return kd;
+}
+
+static void unmap(void* map, size_t size) {
+    if (munmap(map, size))
+        SYSERROR("Failed to munmap a native index");
+}
+
+int indexbin_open(index_t* index, const char* fn) {
+    FILE* f;
+    off_t size;
+    char* map;
+    const indexbin_header_t* hdr;
+    codetree_t* codekd;
+    startree_t* starkd;
+    quadfile_t* quads;
+
+    f = fopen(fn, "rb");
+    if (!f) {
+        SYSERROR("Failed to open native index %s", fn);
+        return -1;
+    }
+    if (fseeko(f, 0, SEEK_END) || (size = ftello(f)) < (off_t)sizeof(indexbin_header_t)) {
+        ERROR("Native index %s is too small", fn);
+        fclose(f);
+        return -1;
+    }
+#ifdef _WIN32
+    map = mmap_file(fileno(f), size);
+#else
+    map = mmap(0, size, PROT_READ, MAP_SHARED, fileno(f), 0);
+#endif
+    // The mapping stays valid after the file is closed.
+    fclose(f);
+    if (map == MAP_FAILED || map == NULL) {
+        SYSERROR("Couldn't mmap native index %s", fn);
+        return -1;
+    }
+    hdr = (const indexbin_header_t*)map;
+    if (check_header(hdr, (uint64_t)size, fn)) {
+        unmap(map, size);
+        return -1;
+    }
+
+    codekd = calloc(1, sizeof(codetree_t));
+    codekd->tree = tree_from_map(map, &hdr->codetree);
+    codekd->header = qfits_header_default();
+    qfits_header_add(codekd->header, "CIRCLE", hdr->circle ? "T" : "F", "", NULL);
+    qfits_header_add(codekd->header, "CXDX", hdr->cx_less_than_dx ? "T" : "F", "", NULL);
+    qfits_header_add(codekd->header, "CXDXLT1", hdr->meanx_less_than_half ? "T" : "F", "", NULL);
+
+    starkd = calloc(1, sizeof(startree_t));
+    starkd->tree = tree_from_map(map, &hdr->startree);
+    starkd->sweep = hdr->sweep ? (uint8_t*)(map + hdr->sweep) : NULL;
+    starkd->brightkd = tree_from_map(map, &hdr->brighttree);
+    starkd->brightids = hdr->brightids ? (int*)(map + hdr->brightids) : NULL;
+    // The bright star tree is part of the file, and isn't built again
+    starkd->brightstate = STARTREE_BRIGHT_BUILT;
+    starkd->header = qfits_header_default();
+    fits_header_add_double(starkd->header, "JITTER", hdr->jitter, "");
+    fits_header_add_int(starkd->header, "CUTNSIDE", hdr->cutnside, "");
+    fits_header_add_int(starkd->header, "CUTNSWEP", hdr->cutnsweep, "");
+    fits_header_add_double(starkd->header, "CUTDEDUP", hdr->cutdedup, "");
+    fits_header_add_int(starkd->header, "CUTMARG", hdr->cutmargin, "");
+    if (hdr->cutband[0]) {
+        char band[sizeof(hdr->cutband) + 1];
+        memcpy(band, hdr->cutband, sizeof(hdr->cutband));
+        band[sizeof(hdr->cutband)] = '\0';
+        qfits_header_add(starkd->header, "CUTBAND", band, "", NULL);
+    }
+
+    quads = calloc(1, sizeof(quadfile_t));
+    quads->numquads = hdr->nquads;
+    quads->numstars = hdr->nstars;
+    quads->dimquads = hdr->dimquads;
+    quads->index_scale_upper = hdr->index_scale_upper;
+    quads->index_scale_lower = hdr->index_scale_lower;
+    quads->indexid = hdr->indexid;
+    quads->healpix = hdr->healpix;
+    quads->hpnside = hdr->hpnside;
+    quads->quadarray = (uint32_t*)(map + hdr->quads);
+
+    index->codekd = codekd;
+    index->starkd = starkd;
+    index->quads = quads;
+    index->binmap = map;
+    index->binmapsize = size;
+    return 0;
+}
+
+void indexbin_close(index_t* index) {
+    if (index->starkd) {
+        free(index->starkd->inverse_perm);
+        qfits_header_destroy(index->starkd->header);
+        free(index->starkd->tree);
+        free(index->starkd->brightkd);
+        free(index->starkd);
+        index->starkd = NULL;
+    }
+    if (index->codekd) {
+        free(index->codekd->inverse_perm);
+        qfits_header_destroy(index->codekd->header);
+        free(index->codekd->tree);
+        free(index->codekd);
+        index->codekd = NULL;
+    }
+    free(index->quads);
+    index->quads = NULL;
+    if (index->binmap)
+        unmap(index->binmap, index->binmapsize);
+    index->binmap = NULL;
+    index->binmapsize = 0;
+}
+
+/*
+ If the tree holds its points as doubles, this rebuilds it with u16 or
+ u32 points if that keeps the quantization error below "tolerance".
+ The points are put back in their original order first, so the new
+ tree's permutation gives the same star and quad ids as the old one.
+ Returns NULL if the tree should be written as it is.
+ */
+static kdtree_t* tighten_tree(const kdtree_t* kd, double tolerance) {
+    int N = kd->ndata;
+    int D = kd->ndim;
+    int i, d, treetype, Nleaf;
+    double range = 0.0;
+    double* data;
+    double* ordered;
+    kdtree_t* tight;
+
+    if ((kd->treetype & KDT_DATA_MASK) != KDT_DATA_DOUBLE ||
+        (kd->treetype & KDT_EXT_MASK) != KDT_EXT_DOUBLE || N < 1)
+        return NULL;
+
+    data = malloc((size_t)N * D * sizeof(double));
+    kdtree_copy_data_double(kd, 0, N, data);
+    for (d=0; d<D; d++) {
+        double lo = data[d], hi = data[d];
+        for (i=1; i<N; i++) {
+            lo = MIN(lo, data[i*D + d]);
+            hi = MAX(hi, data[i*D + d]);
+        }
+        range = MAX(range, hi - lo);
+    }
+    if (range / UINT16_MAX <= tolerance)
+        treetype = KDTT_DSS;
+    else if (range / UINT32_MAX <= tolerance)
+        treetype = KDTT_DUU;
+    else {
+        free(data);
+        return NULL;
+    }
+
+    ordered = malloc((size_t)N * D * sizeof(double));
+    for (i=0; i<N; i++)
+        memcpy(ordered + (size_t)kdtree_permute(kd, i) * D, data + (size_t)i * D, D * sizeof(double));
+    free(data);
+
+    Nleaf = MAX(1, (N + kd->nbottom - 1) / kd->nbottom);
+    tight = kdtree_build(NULL, ordered, N, D, Nleaf, treetype,
+                         KD_BUILD_BBOX | KD_BUILD_SPLIT | KD_BUILD_SPLITDIM);
+    // The integer tree converted the points into its own array.
+    free(ordered);
+    if (!tight)
+        return NULL;
+    logverb("Converted a %i-point tree from %s to %s points\n", N,
+            kdtree_kdtype_to_string(kd->treetype & KDT_DATA_MASK),
+            kdtree_kdtype_to_string(treetype & KDT_DATA_MASK));
+    return tight;
+}
+
+typedef struct {
+    const void* data;
+    uint64_t size;
+    uint64_t* offset;
+} section_t;
+
+#define MAX_SECTIONS 32
+
+static void add_section(section_t* sections, int* nsections, const void* data,
+                        uint64_t size, uint64_t* offset) {
+    *offset = 0;
+    if (!data || !size)
+        return;
+    sections[*nsections].data = data;
+    sections[*nsections].size = size;
+    sections[*nsections].offset = offset;
+    (*nsections)++;
+}
+
+static void add_tree(section_t* sections, int* nsections, const kdtree_t* kd,
+                     indexbin_tree_t* t) {
+    uint64_t tsize, dsize;
+    memset(t, 0, sizeof(indexbin_tree_t));
+    if (!kd)
+        return;
+    tsize = tree_type_size(kd->treetype);
+    dsize = data_type_size(kd->treetype);
+    t->treetype = kd->treetype;
+    t->ndata = kd->ndata;
+    t->ndim = kd->ndim;
+    t->nnodes = kd->nnodes;
+    t->nbottom = kd->nbottom;
+    t->ninterior = kd->ninterior;
+    t->nlevels = kd->nlevels;
+    t->has_linear_lr = kd->has_linear_lr;
+    t->n_bb = kd->bb.any ? kd->n_bb : 0;
+    t->dimbits = kd->dimbits;
+    t->dimmask = kd->dimmask;
+    t->splitmask = kd->splitmask;
+    t->scale = kd->scale;
+    t->invscale = kd->invscale;
+    add_section(sections, nsections, kd->lr, (uint64_t)kd->nbottom * sizeof(int32_t), &t->lr);
+    add_section(sections, nsections, kd->perm, (uint64_t)kd->ndata * sizeof(u32), &t->perm);
+    add_section(sections, nsections, kd->bb.any, (uint64_t)t->n_bb * 2 * kd->ndim * tsize, &t->bb);
+    add_section(sections, nsections, kd->split.any, (uint64_t)kd->ninterior * tsize, &t->split);
+    add_section(sections, nsections, kd->splitdim, (uint64_t)kd->ninterior, &t->splitdim);
+    add_section(sections, nsections, kd->data.any, (uint64_t)kd->ndata * kd->ndim * dsize, &t->data);
+    add_section(sections, nsections, kd->minval, (uint64_t)kd->ndim * sizeof(double), &t->minval);
+    add_section(sections, nsections, kd->maxval, (uint64_t)kd->ndim * sizeof(double), &t->maxval);
+}
+
+int indexbin_write(const index_t* index, const char* fn) {
+    indexbin_header_t hdr;
+    section_t sections[MAX_SECTIONS];
+    int nsections = 0;
+    kdtree_t* codetree;
+    kdtree_t* startree;
+    kdtree_t* tightcodes;
+    kdtree_t* tightstars;
+    startree_t* starkd = index->starkd;
+    char* band;
+    uint64_t offset;
+    FILE* f;
+    int i, rtn = -1;
+
+    if (!index->codekd || !index->quads || !starkd) {
+        ERROR("Index %s is not loaded", index->indexname);
+        return -1;
+    }
+
+    // The file carries the bright star tree, so it is never built when the file is mapped
+    startree_build_bright(starkd);
+
+    tightcodes = tighten_tree(index->codekd->tree, INDEXBIN_CODE_TOLERANCE);
+    tightstars = tighten_tree(starkd->tree, INDEXBIN_STAR_TOLERANCE);
+    codetree = tightcodes ? tightcodes : index->codekd->tree;
+    startree = tightstars ? tightstars : starkd->tree;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEXBIN_MAGIC, sizeof(hdr.magic));
+    hdr.version = INDEXBIN_VERSION;
+    hdr.endian = INDEXBIN_ENDIAN;
+    hdr.index_scale_upper = index->quads->index_scale_upper;
+    hdr.index_scale_lower = index->quads->index_scale_lower;
+    hdr.jitter = index->index_jitter;
+    hdr.cutdedup = index->cutdedup;
+    hdr.indexid = index->indexid;
+    hdr.healpix = index->healpix;
+    hdr.hpnside = index->hpnside;
+    hdr.dimquads = quadfile_dimquads(index->quads);
+    hdr.nquads = quadfile_nquads(index->quads);
+    hdr.nstars = startree_N(starkd);
+    hdr.cutnside = index->cutnside;
+    hdr.cutnsweep = index->cutnsweep;
+    hdr.cutmargin = index->cutmargin;
+    hdr.circle = index->circle;
+    hdr.cx_less_than_dx = index->cx_less_than_dx;
+    hdr.meanx_less_than_half = index->meanx_less_than_half;
+    band = index->cutband;
+    if (band) {
+        // The band is a fixed-size tag; the zeroed header pads it and
+        // indexbin_open adds the terminator when it reads it back.
+        size_t len = strlen(band);
+        if (len > sizeof(hdr.cutband))
+            len = sizeof(hdr.cutband);
+        memcpy(hdr.cutband, band, len);
+    }
+
+    add_tree(sections, &nsections, codetree, &hdr.codetree);
+    add_tree(sections, &nsections, startree, &hdr.startree);
+    add_tree(sections, &nsections, starkd->brightkd, &hdr.brighttree);
+    add_section(sections, &nsections, index->quads->quadarray,
+                (uint64_t)hdr.nquads * hdr.dimquads * sizeof(uint32_t), &hdr.quads);
+    add_section(sections, &nsections, starkd->sweep, (uint64_t)hdr.nstars, &hdr.sweep);
+    if (starkd->brightkd)
+        add_section(sections, &nsections, starkd->brightids,
+                    (uint64_t)starkd->brightkd->ndata * sizeof(int), &hdr.brightids);
+
+    // Lay the arrays out after the header.
+    offset = sizeof(hdr);
+    for (i=0; i<nsections; i++) {
+        uint64_t align = (sections[i].size >= INDEXBIN_PAGE) ? INDEXBIN_PAGE : INDEXBIN_ALIGN;
+        offset = (offset + align - 1) / align * align;
+        *(sections[i].offset) = offset;
+        offset += sections[i].size;
+    }
+    hdr.filesize = offset;
+
+    f = fopen(fn, "wb");
+    if (!f) {
+        SYSERROR("Failed to open %s for writing", fn);
+        goto cleanup;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+        goto writefailed;
+    for (i=0; i<nsections; i++) {
+        // pad_fid() pads up to an absolute file offset.
+        if (pad_fid(f, *(sections[i].offset), 0) ||
+            fwrite(sections[i].data, 1, sections[i].size, f) != sections[i].size)
+            goto writefailed;
+    }
+    if (fclose(f)) {
+        f = NULL;
+        goto writefailed;
+    }
+    logverb("Wrote native index %s: %llu bytes\n", fn, (unsigned long long)hdr.filesize);
+    rtn = 0;
+    goto cleanup;
+
+ writefailed:
+    SYSERROR("Failed to write native index %s", fn);
+    if (f)
+        fclose(f);
+    remove(fn);
+
+ cleanup:
+    kdtree_free(tightcodes);
+    kdtree_free(tightstars);
+    return rtn;
+}
@@ -26,6 +26,37 @@ struct timeval {
 };
 #endif
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Each star tree builds its bright star tree once.  The "brightstate" of the
+// tree is claimed with a compare-and-swap, so only one thread builds it, and
+// it is only read after the state says it is built.
+#ifndef _MSC_VER
+#include <sched.h>
+static int bright_claim(int* state) {
+    int expected = 0;
+    return __atomic_compare_exchange_n(state, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+static void bright_publish(int* state) {
+    __atomic_store_n(state, STARTREE_BRIGHT_BUILT, __ATOMIC_RELEASE);
+}
+static int bright_is_built(int* state) {
+    return __atomic_load_n(state, __ATOMIC_ACQUIRE) == STARTREE_BRIGHT_BUILT;
+}
+#define BRIGHT_YIELD() sched_yield()
+#else
+#include <windows.h>
+static int bright_claim(int* state) {
+    return InterlockedCompareExchange((volatile LONG*)state, 1, 0) == 0;
+}
+static void bright_publish(int* state) {
+    InterlockedExchange((volatile LONG*)state, STARTREE_BRIGHT_BUILT);
+}
+static int bright_is_built(int* state) {
+    return InterlockedCompareExchange((volatile LONG*)state, STARTREE_BRIGHT_BUILT, STARTREE_BRIGHT_BUILT) == STARTREE_BRIGHT_BUILT;
+}
+#define BRIGHT_YIELD() SwitchToThread()
+#endif
+
 static startree_t* startree_alloc() {
     startree_t* s = calloc(1, sizeof(startree_t));
     if (!s) {
@@ -221,6 +252,94 @@ static bl* get_chunks(startree_t* s, il* wordsizes) {
     return chunks;
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// This collects the brightest stars of each uniformization cell into a small tree.
+static void build_bright_tree(startree_t* s) {
+    int i, N, NB;
+    double* xyz;
+    int Nleaf = 8;
+
+    if (!s->sweep)
+        return;
+    N = startree_N(s);
+    NB = 0;
+    for (i=0; i<N; i++)
+        if (s->sweep[kdtree_permute(s->tree, i)] < STARTREE_BRIGHT_NSWEEPS)
+            NB++;
+    if (!NB)
+        return;
+
+    xyz = malloc(NB * 3 * sizeof(double));
+    s->brightids = malloc(NB * sizeof(int));
+    NB = 0;
+    for (i=0; i<N; i++) {
+        int starid = kdtree_permute(s->tree, i);
+        if (s->sweep[starid] >= STARTREE_BRIGHT_NSWEEPS)
+            continue;
+        kdtree_copy_data_double(s->tree, i, 1, xyz + NB*3);
+        s->brightids[NB] = starid;
+        NB++;
+    }
+    s->brightkd = kdtree_build(NULL, xyz, NB, 3, Nleaf, KDTT_DOUBLE, KD_BUILD_SPLIT);
+    if (!s->brightkd) {
+        free(xyz);
+        free(s->brightids);
+        s->brightids = NULL;
+        return;
+    }
+    debug("Built a tree of %i bright stars out of %i\n", NB, N);
+}
+
+static void free_bright_tree(startree_t* s) {
+    if (s->brightkd) {
+        free(s->brightkd->data.any);
+        kdtree_free(s->brightkd);
+        s->brightkd = NULL;
+    }
+    free(s->brightids);
+    s->brightids = NULL;
+}
+
+void startree_build_bright(startree_t* s) {
+    if (bright_is_built(&s->brightstate))
+        return;
+    if (bright_claim(&s->brightstate)) {
+        build_bright_tree(s);
+        bright_publish(&s->brightstate);
+        return;
+    }
+    // Another thread is building this tree; it only takes one pass over the stars.
+    while (!bright_is_built(&s->brightstate))
+        BRIGHT_YIELD();
+}
+
+int startree_search_bright(startree_t* s, const double* xyzcenter, double radius2,
+                           int** starids, double** xyzresults) {
+    kdtree_qres_t* res;
+    int i, N;
+
+    *starids = NULL;
+    *xyzresults = NULL;
+    startree_build_bright(s);
+    if (!s->brightkd)
+        return 0;
+    res = kdtree_rangesearch_options(s->brightkd, xyzcenter, radius2,
+                                     KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_RETURN_POINTS);
+    if (!res)
+        return 0;
+    N = res->nres;
+    if (N) {
+        *starids = malloc(N * sizeof(int));
+        for (i=0; i<N; i++)
+            (*starids)[i] = s->brightids[res->inds[i]];
+        // Steal the results array.
+        *xyzresults = res->results.d;
+        res->results.d = NULL;
+    }
+    kdtree_free_query(res);
+    return N;
+}
+
 static startree_t* my_open(const char* fn, anqfits_t* fits) {
     struct timeval tv1, tv2;
     startree_t* s;
@@ -318,6 +437,7 @@ int startree_close(startree_t* s) {
     if (!s) return 0;
     if (s->inverse_perm)
         free(s->inverse_perm);
+    free_bright_tree(s); //# Modified by Robert Lancaster for the StellarSolver Internal Library
     if (s->header)
         qfits_header_destroy(s->header);
     if (s->tree) {
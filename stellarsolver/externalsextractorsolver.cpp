@@ -11,6 +11,7 @@
 #include <qmath.h>
 #include <wcshdr.h>
 #include <wcsfix.h>
+#include <memory>
 
 static int solverNum = 1;
 
@@ -298,6 +299,9 @@ void ExternalSextractorSolver::run()
                     else
                     {
                         int result = runExternalSolver();
+                        //A child solver of a parallel solve keeps working on the shared queue until it solves or the queue runs out
+                        while(result != 0 && takeNextWorkItem())
+                            result = runExternalSolver();
                         cleanupTempFiles();
                         emit finished(result);
                     }
@@ -1653,6 +1657,7 @@ int ExternalSextractorSolver::loadWCS()
 }
 
 //This was essentially copied from KStars' loadWCS method and split in half with some modifications
+//The coordinates are not computed here anymore, this just sets up the grid that computes them when they are needed.
 void ExternalSextractorSolver::computeWCSCoord()
 {
     if(!m_HasWCS)
@@ -1662,32 +1667,39 @@ void ExternalSextractorSolver::computeWCSCoord()
     }
     int w  = m_Statistics.width;
     int h = m_Statistics.height;
-    wcs_coord = new FITSImage::wcs_point[w * h];
-    FITSImage::wcs_point * p = wcs_coord;
-    double imgcrd[2], phi = 0, pixcrd[2], theta = 0, world[2];
-    int status;
-    int stat[2];
 
-    for (int i = 0; i < h; i++)
+    //The grid gets its own copy of the WCS so that it still works after this solver is deleted
+    struct wcsprm *gridWCS = static_cast<struct wcsprm *>(calloc(1, sizeof(struct wcsprm)));
+    gridWCS->flag = -1;
+    int status = wcssub(1, m_wcs, nullptr, nullptr, gridWCS);
+    if(status == 0)
+        status = wcsset(gridWCS);
+    if(status != 0)
     {
-        for (int j = 0; j < w; j++)
-        {
-            pixcrd[0] = j;
-            pixcrd[1] = i;
-
-            if ((status = wcsp2s(m_wcs, 1, 2, &pixcrd[0], &imgcrd[0], &phi, &theta, &world[0], &stat[0])) != 0)
-            {
-                emit logOutput(QString("wcsp2s error %1: %2.").arg(status).arg(wcs_errmsg[status]));
-            }
-            else
-            {
-                p->ra  = world[0];
-                p->dec = world[1];
-
-                p++;
-            }
-        }
+        emit logOutput(QString("wcssub error %1: %2.").arg(status).arg(wcs_errmsg[status]));
+        wcsfree(gridWCS);
+        free(gridWCS);
+        return;
     }
+    std::shared_ptr<struct wcsprm> sharedWCS(gridWCS, [](struct wcsprm * wcsToFree)
+    {
+        wcsfree(wcsToFree);
+        free(wcsToFree);
+    });
+
+    m_WCSGrid.reset(new WCSGrid(w, h, [sharedWCS](double x, double y, double & ra, double & dec)
+    {
+        double imgcrd[2], phi = 0, pixcrd[2], theta = 0, world[2];
+        int stat[2];
+        pixcrd[0] = x;
+        pixcrd[1] = y;
+        if (wcsp2s(sharedWCS.get(), 1, 2, &pixcrd[0], &imgcrd[0], &phi, &theta, &world[0], &stat[0]) != 0)
+            return false;
+        ra = world[0];
+        dec = world[1];
+        return true;
+    }));
+    wcs_coord = nullptr;
 }
 
 bool ExternalSextractorSolver::pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &skyPoint)
@@ -1716,6 +1728,37 @@ bool ExternalSextractorSolver::pixelToWCS(const QPointF &pixelPoint, FITSImage::
     return true;
 }
 
+//wcsp2s can convert all the points in one call
+bool ExternalSextractorSolver::pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints)
+{
+    if(!hasWCSData())
+    {
+        emit logOutput("There is no WCS Data.");
+        return false;
+    }
+    const int n = pixelPoints.size();
+    skyPoints.resize(n);
+    if(n == 0)
+        return true;
+    QVector<double> pixcrd(2 * n), imgcrd(2 * n), world(2 * n), phi(n), theta(n);
+    QVector<int> stat(n);
+    for(int i = 0; i < n; i++)
+    {
+        pixcrd[2 * i] = pixelPoints[i].x();
+        pixcrd[2 * i + 1] = pixelPoints[i].y();
+    }
+
+    int status = wcsp2s(m_wcs, n, 2, pixcrd.data(), imgcrd.data(), phi.data(), theta.data(), world.data(), stat.data());
+    if(status != 0)
+        emit logOutput(QString("wcsp2s error %1: %2.").arg(status).arg(wcs_errmsg[status]));
+    for(int i = 0; i < n; i++)
+    {
+        skyPoints[i].ra = world[2 * i];
+        skyPoints[i].dec = world[2 * i + 1];
+    }
+    return status == 0;
+}
+
 bool ExternalSextractorSolver::wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint)
 {
     if(!hasWCSData())
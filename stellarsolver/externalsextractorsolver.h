@@ -80,6 +80,7 @@ class ExternalSextractorSolver : public InternalSextractorSolver
         bool appendStarsRAandDEC(QList<FITSImage::Star> &stars) override;
 
         bool pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &skyPoint) override;
+        bool pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints) override;
         bool wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint) override;
 
 
@@ -0,0 +1,240 @@
+/*  FloatConversion, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "floatconversion.h"
+
+#include <cstring>
+
+//The vector versions are only built for x86.  With GCC and Clang each function says which instruction set it uses,
+//so the rest of the library doesn't need to be built with -mavx2, and the processor is checked before they are called.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SS_X86_SIMD
+#include <immintrin.h>
+#define SS_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define SS_X86_SIMD
+#include <immintrin.h>
+#include <intrin.h>
+#define SS_TARGET(isa)
+#endif
+
+namespace
+{
+enum InstructionSet
+{
+    SCALAR,
+    SSE41,
+    AVX2
+};
+
+template <typename T>
+void convertScalar(const T *source, const float *background, float *destination, int count)
+{
+    if(background)
+    {
+        for(int i = 0; i < count; i++)
+            destination[i] = static_cast<float>(source[i]) - background[i];
+    }
+    else
+    {
+        for(int i = 0; i < count; i++)
+            destination[i] = static_cast<float>(source[i]);
+    }
+}
+
+#ifdef SS_X86_SIMD
+
+InstructionSet detectInstructionSet()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse41 = info[2] & (1 << 19);
+    const bool osxsave = info[2] & (1 << 27);
+    const bool avx = info[2] & (1 << 28);
+    //AVX2 also needs the operating system to save the AVX registers
+    if(maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(info, 7, 0);
+        if(info[1] & (1 << 5))
+            return AVX2;
+    }
+    if(sse41)
+        return SSE41;
+#else
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return AVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+        return SSE41;
+#endif
+    return SCALAR;
+}
+
+//These load 8 values and convert them to floats
+SS_TARGET("avx2") inline __m256 load8(const uint8_t *source)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(source))));
+}
+SS_TARGET("avx2") inline __m256 load8(const int16_t *source)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source))));
+}
+SS_TARGET("avx2") inline __m256 load8(const uint16_t *source)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source))));
+}
+SS_TARGET("avx2") inline __m256 load8(const int32_t *source)
+{
+    return _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(source)));
+}
+SS_TARGET("avx2") inline __m256 load8(const float *source)
+{
+    return _mm256_loadu_ps(source);
+}
+
+template <typename T>
+SS_TARGET("avx2") void convertAVX2(const T *source, const float *background, float *destination, int count)
+{
+    int i = 0;
+    if(background)
+    {
+        for(; i + 8 <= count; i += 8)
+            _mm256_storeu_ps(destination + i, _mm256_sub_ps(load8(source + i), _mm256_loadu_ps(background + i)));
+    }
+    else
+    {
+        for(; i + 8 <= count; i += 8)
+            _mm256_storeu_ps(destination + i, load8(source + i));
+    }
+    convertScalar(source + i, background ? background + i : nullptr, destination + i, count - i);
+}
+
+//These load 4 values and convert them to floats
+SS_TARGET("sse4.1") inline __m128 load4(const uint8_t *source)
+{
+    int32_t packed;
+    memcpy(&packed, source, sizeof(packed));
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+}
+SS_TARGET("sse4.1") inline __m128 load4(const int16_t *source)
+{
+    return _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(source))));
+}
+SS_TARGET("sse4.1") inline __m128 load4(const uint16_t *source)
+{
+    return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(source))));
+}
+SS_TARGET("sse4.1") inline __m128 load4(const int32_t *source)
+{
+    return _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source)));
+}
+SS_TARGET("sse4.1") inline __m128 load4(const float *source)
+{
+    return _mm_loadu_ps(source);
+}
+
+template <typename T>
+SS_TARGET("sse4.1") void convertSSE41(const T *source, const float *background, float *destination, int count)
+{
+    int i = 0;
+    if(background)
+    {
+        for(; i + 4 <= count; i += 4)
+            _mm_storeu_ps(destination + i, _mm_sub_ps(load4(source + i), _mm_loadu_ps(background + i)));
+    }
+    else
+    {
+        for(; i + 4 <= count; i += 4)
+            _mm_storeu_ps(destination + i, load4(source + i));
+    }
+    convertScalar(source + i, background ? background + i : nullptr, destination + i, count - i);
+}
+
+#endif
+
+//The processor is only checked once
+InstructionSet instructionSetInUse()
+{
+#ifdef SS_X86_SIMD
+    static const InstructionSet instructionSet = detectInstructionSet();
+    return instructionSet;
+#else
+    return SCALAR;
+#endif
+}
+
+template <typename T>
+void convertVectorized(const T *source, const float *background, float *destination, int count)
+{
+#ifdef SS_X86_SIMD
+    switch(instructionSetInUse())
+    {
+        case AVX2:
+            convertAVX2(source, background, destination, count);
+            return;
+        case SSE41:
+            convertSSE41(source, background, destination, count);
+            return;
+        default:
+            break;
+    }
+#endif
+    convertScalar(source, background, destination, count);
+}
+}
+
+void FloatConversion::convertLine(const uint8_t *source, const float *background, float *destination, int count)
+{
+    convertVectorized(source, background, destination, count);
+}
+
+void FloatConversion::convertLine(const int16_t *source, const float *background, float *destination, int count)
+{
+    convertVectorized(source, background, destination, count);
+}
+
+void FloatConversion::convertLine(const uint16_t *source, const float *background, float *destination, int count)
+{
+    convertVectorized(source, background, destination, count);
+}
+
+void FloatConversion::convertLine(const int32_t *source, const float *background, float *destination, int count)
+{
+    convertVectorized(source, background, destination, count);
+}
+
+//There is no vector instruction for unsigned 32 bit integers before AVX-512, so these use the plain version
+void FloatConversion::convertLine(const uint32_t *source, const float *background, float *destination, int count)
+{
+    convertScalar(source, background, destination, count);
+}
+
+void FloatConversion::convertLine(const float *source, const float *background, float *destination, int count)
+{
+    convertVectorized(source, background, destination, count);
+}
+
+void FloatConversion::convertLine(const double *source, const float *background, float *destination, int count)
+{
+    convertScalar(source, background, destination, count);
+}
+
+QString FloatConversion::instructionSet()
+{
+    switch(instructionSetInUse())
+    {
+        case AVX2:
+            return "AVX2";
+        case SSE41:
+            return "SSE4.1";
+        default:
+            return "Scalar";
+    }
+}
@@ -0,0 +1,30 @@
+/*  FloatConversion, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <QString>
+#include <cstdint>
+
+//These convert one line of image data to the float values SEP works with, optionally subtracting the background line at the same time,
+//so each pixel is only read and written once.  On x86 processors the AVX2 or SSE4.1 version is picked when the program runs,
+//and every other processor uses the plain version.  All of them give exactly the same result as converting to float and then subtracting.
+class FloatConversion
+{
+    public:
+        //background can be nullptr to just convert the values, and it can be the same array as destination
+        static void convertLine(const uint8_t *source, const float *background, float *destination, int count);
+        static void convertLine(const int16_t *source, const float *background, float *destination, int count);
+        static void convertLine(const uint16_t *source, const float *background, float *destination, int count);
+        static void convertLine(const int32_t *source, const float *background, float *destination, int count);
+        static void convertLine(const uint32_t *source, const float *background, float *destination, int count);
+        static void convertLine(const float *source, const float *background, float *destination, int count);
+        static void convertLine(const double *source, const float *background, float *destination, int count);
+
+        //This is the name of the instruction set that is being used, for the log
+        static QString instructionSet();
+};
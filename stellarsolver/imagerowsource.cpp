@@ -0,0 +1,155 @@
+/*  ImageRowSource, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "imagerowsource.h"
+
+#include <QFile>
+
+#include <fitsio.h>
+
+namespace
+{
+class FunctionRowSource : public ImageRowSource
+{
+    public:
+        explicit FunctionRowSource(const RowReader &reader) : m_Reader(reader) {}
+
+        bool readRows(uint32_t y, uint32_t count, void *buffer) override
+        {
+            return m_Reader(y, count, buffer);
+        }
+
+    private:
+        RowReader m_Reader;
+};
+
+//The file stays open as long as the source exists.  cfitsio converts the values to the type that is asked for,
+//so the 32 bit types are read as TINT and TUINT, which are 32 bits wide everywhere, unlike TLONG and TULONG.
+class FITSRowSource : public ImageRowSource
+{
+    public:
+        FITSRowSource(fitsfile *fptr, uint32_t width, int readType) : m_File(fptr), m_Width(width), m_ReadType(readType) {}
+
+        ~FITSRowSource() override
+        {
+            int status = 0;
+            fits_close_file(m_File, &status);
+        }
+
+        bool readRows(uint32_t y, uint32_t count, void *buffer) override
+        {
+            int status = 0, anynull = 0;
+            long firstPixel[3] = {1, static_cast<long>(y) + 1, 1};
+            fits_read_pix(m_File, m_ReadType, firstPixel, static_cast<LONGLONG>(m_Width) * count, nullptr, buffer, &anynull, &status);
+            return status == 0;
+        }
+
+    private:
+        fitsfile *m_File;
+        uint32_t m_Width;
+        int m_ReadType;
+};
+}
+
+QSharedPointer<ImageRowSource> ImageRowSource::fromFunction(const RowReader &reader)
+{
+    return QSharedPointer<ImageRowSource>(new FunctionRowSource(reader));
+}
+
+QSharedPointer<ImageRowSource> ImageRowSource::fromFITSFile(const QString &path, FITSImage::Statistic &stats, QString *errorMessage)
+{
+    fitsfile *fptr = nullptr;
+    int status = 0;
+    auto fail = [&](const QString & message)
+    {
+        if(errorMessage)
+            *errorMessage = message;
+        if(fptr)
+        {
+            int closeStatus = 0;
+            fits_close_file(fptr, &closeStatus);
+        }
+        return QSharedPointer<ImageRowSource>();
+    };
+
+    // Use open diskfile as it does not use extended file names which has problems opening
+    // files with [ ] or ( ) in their names.
+    if (fits_open_diskfile(&fptr, path.toLocal8Bit().constData(), READONLY, &status))
+    {
+        fptr = nullptr;
+        return fail(QString("Error opening fits file %1").arg(path));
+    }
+    if (fits_movabs_hdu(fptr, 1, IMAGE_HDU, &status))
+        return fail("Could not locate image HDU.");
+
+    int bitpix = 0, ndim = 0;
+    long naxes[3] = {0, 0, 1};
+    if (fits_get_img_equivtype(fptr, &bitpix, &status) || fits_get_img_dim(fptr, &ndim, &status) ||
+            fits_get_img_size(fptr, 3, naxes, &status))
+        return fail("FITS file open error (fits_get_img_param).");
+    if (ndim < 2)
+        return fail("1D FITS images are not supported.");
+    if (naxes[0] <= 0 || naxes[1] <= 0)
+        return fail(QString("Image has invalid dimensions %1x%2").arg(naxes[0]).arg(naxes[1]));
+    //The size has to fit in the 16 bit width and height of the statistics
+    if (naxes[0] > UINT16_MAX || naxes[1] > UINT16_MAX)
+        return fail(QString("Image is %1x%2, but at most %3 pixels on a side are supported").arg(naxes[0]).arg(naxes[1]).arg(UINT16_MAX));
+
+    int readType = 0;
+    switch (bitpix)
+    {
+        case BYTE_IMG:
+            stats.dataType = TBYTE;
+            stats.bytesPerPixel = sizeof(uint8_t);
+            readType = TBYTE;
+            break;
+        case SHORT_IMG:
+            stats.dataType = TSHORT;
+            stats.bytesPerPixel = sizeof(int16_t);
+            readType = TSHORT;
+            break;
+        case USHORT_IMG:
+            stats.dataType = TUSHORT;
+            stats.bytesPerPixel = sizeof(uint16_t);
+            readType = TUSHORT;
+            break;
+        case LONG_IMG:
+            stats.dataType = TLONG;
+            stats.bytesPerPixel = sizeof(int32_t);
+            readType = TINT;
+            break;
+        case ULONG_IMG:
+            stats.dataType = TULONG;
+            stats.bytesPerPixel = sizeof(uint32_t);
+            readType = TUINT;
+            break;
+        case FLOAT_IMG:
+            stats.dataType = TFLOAT;
+            stats.bytesPerPixel = sizeof(float);
+            readType = TFLOAT;
+            break;
+        //The extractor can't read 64 bit integers, so cfitsio converts them
+        case LONGLONG_IMG:
+        case DOUBLE_IMG:
+            stats.dataType = TDOUBLE;
+            stats.bytesPerPixel = sizeof(double);
+            readType = TDOUBLE;
+            break;
+        default:
+            return fail(QString("Bit depth %1 is not supported.").arg(bitpix));
+    }
+
+    //Only the first channel of a color image is read
+    stats.ndim = ndim;
+    stats.width = static_cast<uint16_t>(naxes[0]);
+    stats.height = static_cast<uint16_t>(naxes[1]);
+    stats.channels = static_cast<uint8_t>(ndim < 3 ? 1 : naxes[2]);
+    stats.samples_per_channel = stats.width * stats.height;
+    stats.size = QFile(path).size();
+
+    return QSharedPointer<ImageRowSource>(new FITSRowSource(fptr, stats.width, readType));
+}
@@ -0,0 +1,38 @@
+/*  ImageRowSource, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include "structuredefinitions.h"
+
+#include <QString>
+#include <QSharedPointer>
+#include <functional>
+
+//This is where the internal extractor gets the rows of an image that is too big to hand over as one image buffer,
+//such as a large mosaic or a drift scan strip.  The extractor asks for a band of rows at a time and only keeps a few bands
+//in memory, so the memory it needs depends on the width of the image, not its size.
+//The rows are in the data type given in the statistics of the image, one after the other with no padding.
+//The extractor only calls readRows from one thread at a time, but not always the same one.
+//The width and height in FITSImage::Statistic are 16 bit, since the structure is shared with KStars, so an image
+//can still be at most 65535 pixels on a side.  A longer drift scan strip has to be split into pieces.
+class ImageRowSource
+{
+    public:
+        //This reads count rows starting at row y into buffer and returns false if it could not read them
+        typedef std::function<bool(uint32_t y, uint32_t count, void *buffer)> RowReader;
+
+        virtual ~ImageRowSource() = default;
+        virtual bool readRows(uint32_t y, uint32_t count, void *buffer) = 0;
+
+        //This makes a source that calls the function to read the rows
+        static QSharedPointer<ImageRowSource> fromFunction(const RowReader &reader);
+        //This makes a source that reads the rows of the first image in a FITS file, without reading the rest of it.
+        //It fills in the size and the data type of the image in stats, and returns a null pointer if the file can't be read
+        //or the image is larger than 65535 pixels on a side.
+        static QSharedPointer<ImageRowSource> fromFITSFile(const QString &path, FITSImage::Statistic &stats, QString *errorMessage = nullptr);
+};
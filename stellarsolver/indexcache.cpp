@@ -0,0 +1,254 @@
+/*  IndexCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "indexcache.h"
+#include "indexcatalog.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+
+namespace
+{
+struct CacheEntry
+{
+    index_t *index;
+    QString path;
+    QDateTime modified;
+    qint64 size;
+    int refCount;
+    bool resident;
+};
+
+struct IndexCacheState
+{
+    QMutex mutex;
+    bool enabled { false };
+    QHash<QString, CacheEntry *> byPath;
+    QHash<index_t *, CacheEntry *> byIndex;
+};
+
+//The state is kept in a function local static so that it is safe to use from other static objects
+IndexCacheState &state()
+{
+    static IndexCacheState s;
+    return s;
+}
+
+//This must be called with the mutex locked.  It takes the entry out of the path lookup so the next acquire reloads the file,
+//and frees it right away if nobody is using it.  Otherwise the last release frees it.
+void retire(CacheEntry *entry)
+{
+    if(entry->resident)
+    {
+        state().byPath.remove(entry->path);
+        entry->resident = false;
+    }
+    if(entry->refCount == 0)
+    {
+        state().byIndex.remove(entry->index);
+        index_free(entry->index);
+        delete entry;
+    }
+}
+
+//The solvers that share an index only read it, but the star tree computes its inverse permutation the first time a star is looked up by id.
+//That is done here, before the index is handed out, so no two solvers can build or free it at the same time.
+void prepareForSharing(index_t *index)
+{
+    if(index->starkd && index->starkd->tree->perm && !index->starkd->inverse_perm)
+        startree_compute_inverse_perm(index->starkd);
+}
+}
+
+void IndexCache::setEnabled(bool enabled)
+{
+    {
+        QMutexLocker locker(&state().mutex);
+        state().enabled = enabled;
+    }
+    if(!enabled)
+        evict();
+}
+
+bool IndexCache::isEnabled()
+{
+    QMutexLocker locker(&state().mutex);
+    return state().enabled;
+}
+
+index_t *IndexCache::acquire(const QString &indexPath)
+{
+    QFileInfo info(indexPath);
+    if(!info.exists())
+        return nullptr;
+    const QString path = info.absoluteFilePath();
+    const QDateTime modified = info.lastModified();
+    const qint64 size = info.size();
+
+    {
+        QMutexLocker locker(&state().mutex);
+        CacheEntry *entry = state().byPath.value(path, nullptr);
+        if(entry)
+        {
+            if(entry->modified == modified && entry->size == size)
+            {
+                entry->refCount++;
+                return entry->index;
+            }
+            //The file changed on disk since it was loaded
+            retire(entry);
+        }
+    }
+
+    //Loading an index can take a while, so it is done without holding the lock.
+    index_t *index = index_load(path.toLocal8Bit().constData(), 0, nullptr);
+    if(!index)
+        return nullptr;
+    prepareForSharing(index);
+
+    QMutexLocker locker(&state().mutex);
+    CacheEntry *entry = state().byPath.value(path, nullptr);
+    if(entry)
+    {
+        //Another solver loaded the same file while this one was loading it
+        if(entry->modified == modified && entry->size == size)
+        {
+            entry->refCount++;
+            locker.unlock();
+            index_free(index);
+            return entry->index;
+        }
+        retire(entry);
+    }
+
+    entry = new CacheEntry;
+    entry->index = index;
+    entry->path = path;
+    entry->modified = modified;
+    entry->size = size;
+    entry->refCount = 1;
+    entry->resident = true;
+    state().byPath.insert(path, entry);
+    state().byIndex.insert(index, entry);
+    return index;
+}
+
+QList<index_t *> IndexCache::acquireFolders(const QStringList &indexFolders)
+{
+    return acquireFiles(indexFilesIn(indexFolders));
+}
+
+QList<index_t *> IndexCache::acquireFiles(const QStringList &indexPaths)
+{
+    QList<index_t *> indexes;
+    for(const QString &indexPath : indexPaths)
+    {
+        index_t *index = acquire(indexPath);
+        if(index)
+            indexes.append(index);
+    }
+    return indexes;
+}
+
+QSharedPointer<const QList<index_t *>> IndexCache::acquireShared(const QStringList &indexPaths)
+{
+    return QSharedPointer<const QList<index_t *>>(new QList<index_t *>(acquireFiles(indexPaths)), [](const QList<index_t *> *indexes)
+    {
+        release(*indexes);
+        delete indexes;
+    });
+}
+
+void IndexCache::release(index_t *index)
+{
+    if(!index)
+        return;
+    QMutexLocker locker(&state().mutex);
+    CacheEntry *entry = state().byIndex.value(index, nullptr);
+    if(!entry)
+        return;
+    entry->refCount--;
+    if(!entry->resident || !state().enabled)
+        retire(entry);
+}
+
+void IndexCache::release(const QList<index_t *> &indexes)
+{
+    for(index_t *index : indexes)
+        release(index);
+}
+
+int IndexCache::preload(const QStringList &indexFolders)
+{
+    {
+        QMutexLocker locker(&state().mutex);
+        state().enabled = true;
+    }
+    QList<index_t *> indexes = acquireFolders(indexFolders);
+    const int count = indexes.size();
+    release(indexes);
+    return count;
+}
+
+int IndexCache::evict(const QStringList &indexPaths)
+{
+    QMutexLocker locker(&state().mutex);
+    QList<CacheEntry *> toEvict;
+    if(indexPaths.isEmpty())
+    {
+        toEvict = state().byPath.values();
+    }
+    else
+    {
+        for(const QString &indexPath : indexPaths)
+        {
+            CacheEntry *entry = state().byPath.value(QFileInfo(indexPath).absoluteFilePath(), nullptr);
+            if(entry)
+                toEvict.append(entry);
+        }
+    }
+    for(CacheEntry *entry : toEvict)
+        retire(entry);
+    return toEvict.size();
+}
+
+QStringList IndexCache::residentIndexes()
+{
+    QMutexLocker locker(&state().mutex);
+    QStringList paths = state().byPath.keys();
+    paths.sort();
+    return paths;
+}
+
+bool IndexCache::isResident(const QString &indexPath)
+{
+    QMutexLocker locker(&state().mutex);
+    return state().byPath.contains(QFileInfo(indexPath).absoluteFilePath());
+}
+
+qint64 IndexCache::residentBytes()
+{
+    QMutexLocker locker(&state().mutex);
+    qint64 total = 0;
+    for(CacheEntry *entry : state().byPath)
+        total += entry->size;
+    return total;
+}
+
+//This finds the index files in the folders with the index catalogue, in the order engine_autoindex_search_paths would add them,
+//so only files that are new or changed since the catalogue was made are opened to see if they are index files.
+QStringList IndexCache::indexFilesIn(const QStringList &indexFolders)
+{
+    QStringList indexFiles;
+    for(const IndexCatalog::Entry &entry : IndexCatalog::indexesIn(indexFolders))
+        indexFiles.append(entry.path);
+    return indexFiles;
+}
@@ -0,0 +1,56 @@
+/*  IndexCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QSharedPointer>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/index.h"
+}
+
+//This is a process wide registry of fully loaded index files that is shared by all the StellarSolver objects.
+//Loading the index files is a big part of the time for each solve, so if the cache is enabled, the index files
+//stay loaded after a solve finishes and the next solve just gets the handles that are already there.
+//Entries are keyed by the absolute path of the file and are reloaded if the file's modification time or size changes.
+//Each handle that is acquired has to be released again.  An index that is evicted while in use is freed on its last release.
+class IndexCache
+{
+    public:
+        //This turns the cache on or off for the internal solver.  Turning it off evicts everything that is not in use.
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+
+        //This gets a fully loaded index for one index file, loading it if it is not resident yet.  Returns nullptr on failure.
+        static index_t *acquire(const QString &indexPath);
+        //This gets all the index files in the given folders, in the same order engine_autoindex_search_paths would add them.
+        static QList<index_t *> acquireFolders(const QStringList &indexFolders);
+        //This gets the given index files, in the order they are given.
+        static QList<index_t *> acquireFiles(const QStringList &indexPaths);
+        //This gets the given index files as one set that several solvers can hold at once.  They are released when the last copy of the pointer goes away.
+        static QSharedPointer<const QList<index_t *>> acquireShared(const QStringList &indexPaths);
+        //Each acquired index must be released when the solver is done with it.
+        static void release(index_t *index);
+        static void release(const QList<index_t *> &indexes);
+
+        //This loads all the index files in the given folders so that they are ready for the next solve, turning the cache on.  Returns the number loaded.
+        static int preload(const QStringList &indexFolders);
+        //This evicts the given index files, or all of them if the list is empty.  Returns the number of entries evicted.
+        static int evict(const QStringList &indexPaths = QStringList());
+
+        //These report what is currently resident in the cache
+        static QStringList residentIndexes();
+        static bool isResident(const QString &indexPath);
+        static qint64 residentBytes();
+
+    private:
+        static QStringList indexFilesIn(const QStringList &indexFolders);
+};
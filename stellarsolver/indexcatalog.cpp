@@ -0,0 +1,290 @@
+/*  IndexCatalog, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "indexcatalog.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QtConcurrent>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(Q_OS_OSX) || defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/healpix.h"
+}
+
+namespace
+{
+//This goes up whenever the format of the catalogue files changes, so old ones are read again from the index files
+const int catalogVersion = 2;
+
+struct IndexCatalogState
+{
+    QMutex mutex;
+    //The entries of each folder, by file name
+    QHash<QString, QHash<QString, IndexCatalog::Entry>> folders;
+    QStringList prefetched;
+};
+
+IndexCatalogState &state()
+{
+    static IndexCatalogState s;
+    return s;
+}
+
+QString catalogFileFor(const QString &folder)
+{
+    const QString name = QCryptographicHash::hash(folder.toUtf8(), QCryptographicHash::Md5).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/stellarsolver/indexcatalog/" + name + ".txt";
+}
+
+QHash<QString, IndexCatalog::Entry> loadCatalogFile(const QString &folder)
+{
+    QHash<QString, IndexCatalog::Entry> entries;
+    QFile file(catalogFileFor(folder));
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return entries;
+    QTextStream in(&file);
+    const QStringList header = in.readLine().split('\t');
+    if(header.size() != 2 || header[0].toInt() != catalogVersion || header[1] != folder)
+        return entries;
+    while(!in.atEnd())
+    {
+        const QStringList fields = in.readLine().split('\t');
+        if(fields.size() != 12)
+            continue;
+        IndexCatalog::Entry entry;
+        entry.path = folder + "/" + fields[0];
+        entry.size = fields[1].toLongLong();
+        entry.modified = QDateTime::fromMSecsSinceEpoch(fields[2].toLongLong());
+        entry.isIndex = fields[3].toInt();
+        entry.indexid = fields[4].toInt();
+        entry.healpix = fields[5].toInt();
+        entry.hpnside = fields[6].toInt();
+        entry.scaleLow = fields[7].toDouble();
+        entry.scaleHigh = fields[8].toDouble();
+        entry.dimquads = fields[9].toInt();
+        entry.nquads = fields[10].toInt();
+        entry.nstars = fields[11].toInt();
+        entries.insert(fields[0], entry);
+    }
+    return entries;
+}
+
+void saveCatalogFile(const QString &folder, const QHash<QString, IndexCatalog::Entry> &entries)
+{
+    const QString path = catalogFileFor(folder);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QFile file(path);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return;
+    QTextStream out(&file);
+    out << catalogVersion << '\t' << folder << '\n';
+    for(auto it = entries.constBegin(); it != entries.constEnd(); ++it)
+    {
+        const IndexCatalog::Entry &entry = it.value();
+        out << it.key() << '\t' << entry.size << '\t' << entry.modified.toMSecsSinceEpoch() << '\t' << (entry.isIndex ? 1 : 0) << '\t'
+            << entry.indexid << '\t' << entry.healpix << '\t' << entry.hpnside << '\t'
+            << QString::number(entry.scaleLow, 'g', 17) << '\t' << QString::number(entry.scaleHigh, 'g', 17) << '\t'
+            << entry.dimquads << '\t' << entry.nquads << '\t' << entry.nstars << '\n';
+    }
+}
+
+//This reads the metadata of one file from its header
+void readEntry(IndexCatalog::Entry &entry)
+{
+    const QByteArray path = entry.path.toLocal8Bit();
+    entry.isIndex = false;
+    if(!index_is_file_index(path.constData()))
+        return;
+    index_t *index = index_load(path.constData(), INDEX_ONLY_LOAD_METADATA, nullptr);
+    if(!index)
+        return;
+    entry.isIndex = true;
+    entry.indexid = index->indexid;
+    entry.healpix = index->healpix;
+    entry.hpnside = index->hpnside;
+    entry.scaleLow = index->index_scale_lower;
+    entry.scaleHigh = index->index_scale_upper;
+    entry.dimquads = index->dimquads;
+    entry.nquads = index->nquads;
+    entry.nstars = index->nstars;
+    index_free(index);
+}
+
+//This is the same test as index_is_within_range
+double distanceTo(const IndexCatalog::Entry &entry, double ra, double dec)
+{
+    if(entry.healpix == -1)
+        return 0;
+    return healpix_distance_to_radec(entry.healpix, entry.hpnside, ra, dec, nullptr);
+}
+
+//This only asks the operating system to read the file into its cache, it doesn't wait for it.
+//On Windows there is no simple way to do that for a file that isn't open, so the files are just opened normally when they are needed.
+void prefetchFile(const QString &path, qint64 size)
+{
+#if defined(Q_OS_OSX) || defined(Q_OS_LINUX)
+    int fd = open(path.toLocal8Bit().constData(), O_RDONLY);
+    if(fd < 0)
+        return;
+#if defined(Q_OS_OSX)
+    struct radvisory advice;
+    advice.ra_offset = 0;
+    advice.ra_count = size > INT_MAX ? INT_MAX : static_cast<int>(size);
+    fcntl(fd, F_RDADVISE, &advice);
+#else
+    Q_UNUSED(size);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    close(fd);
+#else
+    Q_UNUSED(path);
+    Q_UNUSED(size);
+#endif
+}
+}
+
+//The entries that are already known and unchanged are taken from the catalogue, and only new or changed files are opened.
+//The catalogue file for the folder is only written again if something changed.
+QList<IndexCatalog::Entry> IndexCatalog::folderEntries(const QString &folder)
+{
+    QList<Entry> result;
+    QDir dir(folder);
+    if(!dir.exists())
+        return result;
+    const QString folderPath = dir.absolutePath();
+
+    QHash<QString, Entry> known;
+    {
+        QMutexLocker locker(&state().mutex);
+        if(!state().folders.contains(folderPath))
+            state().folders.insert(folderPath, loadCatalogFile(folderPath));
+        known = state().folders.value(folderPath);
+    }
+
+    QHash<QString, Entry> current;
+    bool changed = false;
+    const QFileInfoList infoList = dir.entryInfoList(QDir::Files, QDir::Name | QDir::Reversed);
+    for(const QFileInfo &info : infoList)
+    {
+        Entry entry = known.value(info.fileName());
+        if(entry.path.isEmpty() || entry.size != info.size() || entry.modified != info.lastModified())
+        {
+            entry = Entry();
+            entry.path = info.absoluteFilePath();
+            entry.size = info.size();
+            entry.modified = info.lastModified();
+            readEntry(entry);
+            changed = true;
+        }
+        current.insert(info.fileName(), entry);
+        if(entry.isIndex)
+            result.append(entry);
+    }
+    //Files that were removed from the folder also change the catalogue
+    if(current.size() != known.size())
+        changed = true;
+
+    if(changed)
+    {
+        QMutexLocker locker(&state().mutex);
+        state().folders.insert(folderPath, current);
+        saveCatalogFile(folderPath, current);
+    }
+    return result;
+}
+
+QList<IndexCatalog::Entry> IndexCatalog::indexesIn(const QStringList &indexFolders)
+{
+    QList<Entry> entries;
+    for(const QString &folder : indexFolders)
+        entries.append(folderEntries(folder));
+    return entries;
+}
+
+QList<IndexCatalog::Entry> IndexCatalog::indexesNear(const QStringList &indexFolders, double ra, double dec, double radius)
+{
+    QList<Entry> entries;
+    for(const Entry &entry : indexesIn(indexFolders))
+    {
+        if(distanceTo(entry, ra, dec) <= radius)
+            entries.append(entry);
+    }
+    return entries;
+}
+
+QStringList IndexCatalog::indexFilesNear(const QStringList &indexFolders, double ra, double dec, double radius)
+{
+    QStringList indexFiles;
+    for(const Entry &entry : indexesNear(indexFolders, ra, dec, radius))
+        indexFiles.append(entry.path);
+    return indexFiles;
+}
+
+//This fills in the same metadata that index_load fills in with INDEX_ONLY_LOAD_METADATA, as far as the engine uses it.
+//It is allocated the way the astrometry.net code does it, since index_free is what frees it.
+index_t *IndexCatalog::metadataIndex(const Entry &entry)
+{
+    index_t *index = static_cast<index_t *>(calloc(1, sizeof(index_t)));
+    index->indexname = strdup(entry.path.toLocal8Bit().constData());
+    index->indexid = entry.indexid;
+    index->healpix = entry.healpix;
+    index->hpnside = entry.hpnside;
+    index->index_scale_lower = entry.scaleLow;
+    index->index_scale_upper = entry.scaleHigh;
+    index->dimquads = entry.dimquads;
+    index->nquads = entry.nquads;
+    index->nstars = entry.nstars;
+    index->circle = TRUE;
+    return index;
+}
+
+//The tiles next to the search area are the ones that are within one tile width of it, but not in it.
+void IndexCatalog::prefetchAround(const QStringList &indexFolders, double ra, double dec, double radius)
+{
+    QStringList paths;
+    QList<qint64> sizes;
+    for(const Entry &entry : indexesIn(indexFolders))
+    {
+        if(entry.healpix == -1)
+            continue;
+        const double distance = distanceTo(entry, ra, dec);
+        if(distance > radius && distance <= radius + healpix_side_length_arcmin(entry.hpnside) / 60.0)
+        {
+            paths.append(entry.path);
+            sizes.append(entry.size);
+        }
+    }
+
+    //Nothing needs to be done if the last prefetch was for the same files
+    {
+        QMutexLocker locker(&state().mutex);
+        if(paths.isEmpty() || paths == state().prefetched)
+            return;
+        state().prefetched = paths;
+    }
+    QtConcurrent::run([paths, sizes]()
+    {
+        for(int i = 0; i < paths.size(); i++)
+            prefetchFile(paths[i], sizes[i]);
+    });
+}
@@ -0,0 +1,60 @@
+/*  IndexCatalog, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QDateTime>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/index.h"
+}
+
+//This is a process wide catalogue of the metadata of the index files: which part of the sky each one covers, its range of quad sizes
+//and its size.  The metadata of each file is read from its header the first time the file is seen, and is saved to a small file
+//per index folder in the cache folder, so later runs just read that one file instead of opening every index file in the folder.
+//When the position of the image is known, it also means only the index files near it have to be opened.
+//Entries are keyed by the file name and are read again if the file's modification time or size changes.
+class IndexCatalog
+{
+    public:
+        struct Entry
+        {
+            QString path;
+            qint64 size { 0 };
+            QDateTime modified;
+            bool isIndex { false };
+            int indexid { -1 };
+            //-1 means the index covers the whole sky
+            int healpix { -1 };
+            int hpnside { 0 };
+            //The range of quad sizes in arcseconds
+            double scaleLow { 0 };
+            double scaleHigh { 0 };
+            int dimquads { 0 };
+            int nquads { 0 };
+            int nstars { 0 };
+        };
+
+        //This gets the entries for all the index files in the folders, in the same order engine_autoindex_search_paths would add them.
+        static QList<Entry> indexesIn(const QStringList &indexFolders);
+        //This gets the index files whose tile is within radius degrees of the position, using the same test as the engine.
+        //All sky index files are always included.
+        static QList<Entry> indexesNear(const QStringList &indexFolders, double ra, double dec, double radius);
+        static QStringList indexFilesNear(const QStringList &indexFolders, double ra, double dec, double radius);
+        //This makes an index with just the metadata filled in from the entry, for engine_add_index_metadata.
+        static index_t *metadataIndex(const Entry &entry);
+        //This asks the operating system to start reading the index files for the tiles next to the search area in the background,
+        //so they are already in memory if the next image is taken a little further along.
+        static void prefetchAround(const QStringList &indexFolders, double ra, double dec, double radius);
+
+    private:
+        static QList<Entry> folderEntries(const QString &folder);
+};
@@ -15,10 +15,19 @@
 #endif
 
 #include <QtConcurrent>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <memory>
+#include <numeric>
 
 #include "internalsextractorsolver.h"
+#include "indexcache.h"
+#include "indexcatalog.h"
+#include "floatconversion.h"
+#include "solverpool.h"
 #include "sep/extract.h"
+#include "sep/extractcontext.h"
 #include "qmath.h"
 
 extern "C" {
@@ -30,6 +39,27 @@ using namespace SEP;
 
 static int solverNum = 1;
 
+//This is the largest radius used to measure a star.  It is also part of the halo that is added around each partition,
+//so that any star that is centered in a partition is found whole even if it crosses the partition border.
+static constexpr uint32_t MAX_OBJECT_RADIUS = 50;
+
+//This is the size of the meshes of the background.  It is also the number of rows in each band read from a row source,
+//so each row of meshes only needs one band, or two if a subframe starts part way into a band.
+static constexpr int BACKGROUND_MESH_SIZE = 64;
+
+//astrometry.net reads the cancel and solved flags through int pointers, so the atomics have to be plain lock free ints
+static_assert(sizeof(std::atomic<int>) == sizeof(int) && ATOMIC_INT_LOCK_FREE == 2,
+              "std::atomic<int> must have the layout of an int to be shared with astrometry.net");
+
+//The engine kept by a worker of the solver pool is only reset, so that it is ready for the next solve on that worker
+static void releaseEngine(engine_t *engine)
+{
+    if(engine == SolverPool::workerEngine())
+        engine_reset(engine);
+    else
+        engine_free(engine);
+}
+
 InternalSextractorSolver::InternalSextractorSolver(ProcessType pType, ExtractorType eType, SolverType sType,
         FITSImage::Statistic imagestats, uint8_t const *imageBuffer, QObject *parent) : SextractorSolver(pType, eType, sType,
                     imagestats, imageBuffer, parent)
@@ -37,7 +67,9 @@ InternalSextractorSolver::InternalSextractorSolver(ProcessType pType, ExtractorT
     //This sets the base name used for the temp files.
     m_BaseName = "internalSextractorSolver_" + QString::number(solverNum++);
 
-    m_PartitionThreads = QThread::idealThreadCount();
+    //The extraction work runs on the global thread pool, so it is split into as many pieces as the pool has threads
+    m_PartitionThreads = QThreadPool::globalInstance()->maxThreadCount();
+    m_SolverThreads = QThread::idealThreadCount();
 
 }
 
@@ -47,16 +79,94 @@ InternalSextractorSolver::~InternalSextractorSolver()
         delete [] downSampledBuffer;
 }
 
-//This is the abort method.  The way that it works is that it creates a file.  Astrometry.net is monitoring for this file's creation in order to abort.
-void InternalSextractorSolver::abort()
+void SolvedLatch::setSolved(void *latch)
+{
+    SolvedLatch *solvedLatch = static_cast<SolvedLatch *>(latch);
+    QMutexLocker locker(&solvedLatch->m_Mutex);
+    if(solvedLatch->m_Solved)
+        return;
+    solvedLatch->m_SinceSolved.start();
+    solvedLatch->m_Solved.store(1, std::memory_order_release);
+}
+
+qint64 SolvedLatch::msecsSinceSolved()
+{
+    QMutexLocker locker(&m_Mutex);
+    if(!m_Solved)
+        return -1;
+    return m_SinceSolved.elapsed();
+}
+
+ExtractContextPool::~ExtractContextPool()
+{
+    qDeleteAll(m_Idle);
+}
+
+SEP::ExtractContext *ExtractContextPool::take()
+{
+    QMutexLocker locker(&m_Mutex);
+    if(m_Idle.isEmpty())
+        return new SEP::ExtractContext();
+    return m_Idle.takeLast();
+}
+
+void ExtractContextPool::give(SEP::ExtractContext *context)
 {
-    QFile file(cancelfn);
-    if(QFileInfo(file).dir().exists())
+    QMutexLocker locker(&m_Mutex);
+    m_Idle.append(context);
+}
+
+RowBandCache::RowBandCache(ImageRowSource *source, uint32_t width, uint32_t height, int bytesPerPixel, uint32_t bandRows,
+                           int maxBands) : m_Source(source), m_Width(width), m_Height(height), m_BytesPerPixel(bytesPerPixel),
+    m_BandRows(bandRows), m_MaxBands(maxBands)
+{
+}
+
+std::shared_ptr<const RowBandCache::Band> RowBandCache::bandFor(uint32_t y)
+{
+    const uint32_t number = y / m_BandRows;
+    {
+        QMutexLocker locker(&m_Mutex);
+        auto found = m_Bands.constFind(number);
+        if(found != m_Bands.constEnd())
+        {
+            m_Recent.removeOne(number);
+            m_Recent.append(number);
+            return found.value();
+        }
+    }
+
+    QMutexLocker readLocker(&m_ReadMutex);
+    //Another thread may have read the band while this one was waiting
     {
-        file.open(QIODevice::WriteOnly);
-        file.write("Cancel");
-        file.close();
+        QMutexLocker locker(&m_Mutex);
+        auto found = m_Bands.constFind(number);
+        if(found != m_Bands.constEnd())
+            return found.value();
     }
+
+    std::shared_ptr<Band> band(new Band);
+    band->y = number * m_BandRows;
+    band->rows = std::min(m_BandRows, m_Height - band->y);
+    band->data.resize(static_cast<size_t>(band->rows) * m_Width * m_BytesPerPixel);
+    if(!m_Source->readRows(band->y, band->rows, band->data.data()))
+    {
+        std::fill(band->data.begin(), band->data.end(), 0);
+        m_Failed = true;
+    }
+
+    QMutexLocker locker(&m_Mutex);
+    m_Bands.insert(number, band);
+    m_Recent.append(number);
+    while(m_Recent.size() > m_MaxBands)
+        m_Bands.remove(m_Recent.takeFirst());
+    return band;
+}
+
+//This is the abort method.  It sets the cancel flag that Astrometry.net is watching in the solver loops, so it stops right away.
+void InternalSextractorSolver::abort()
+{
+    m_CancelFlag.store(1, std::memory_order_release);
     if(!isChildSolver)
         emit logOutput("Aborting...");
     m_WasAborted = true;
@@ -74,8 +184,11 @@ SextractorSolver* InternalSextractorSolver::spawnChildSolver(int n)
     //They will all share the same basename
     solver->m_HasExtracted = true;
     solver->isChildSolver = true;
+    solver->m_SolverThreads = 1;
     solver->m_ActiveParameters = m_ActiveParameters;
     solver->indexFolderPaths = indexFolderPaths;
+    //The children all read the same index files that were loaded once by the parent
+    solver->sharedIndexes = sharedIndexes;
     //Set the log level one less than the main solver
     if(m_SSLogLevel == LOG_VERBOSE )
         solver->m_SSLogLevel = LOG_NORMAL;
@@ -87,16 +200,32 @@ SextractorSolver* InternalSextractorSolver::spawnChildSolver(int n)
         solver->setSearchPositionInDegrees(search_ra, search_dec);
     if(m_AstrometryLogLevel != SSolver::LOG_NONE || m_SSLogLevel != SSolver::LOG_OFF)
         connect(solver, &SextractorSolver::logOutput, this,  &SextractorSolver::logOutput);
-    //This way they all share a solved and cancel fn
-    //solver->cancelfn = cancelfn;
-    solver->solvedfn = solvedfn;
+    //This way they all share a solved latch, but each one has its own cancel flag
+    if(!m_SolvedLatch)
+        m_SolvedLatch.reset(new SolvedLatch);
+    solver->m_SolvedLatch = m_SolvedLatch;
     solver->usingDownsampledImage = usingDownsampledImage;
     return solver;
 }
 
+//An image from a row source is read a band of rows at a time, and only a few bands are kept in memory at once,
+//enough for every thread to have the rows it is working on.  The image is read three times: the background is computed
+//in the first pass over the bands, the stars are detected in the second, and they are measured in the third.
 int InternalSextractorSolver::extract()
 {
-    return(runSEPSextractor());
+    if(m_RowSource)
+        m_RowBands.reset(new RowBandCache(m_RowSource.data(), m_Statistics.width, m_Statistics.height, m_Statistics.bytesPerPixel,
+                                          BACKGROUND_MESH_SIZE, 4 * std::max(m_PartitionThreads, 1u)));
+    int result = runSEPSextractor();
+    if(m_RowBands && m_RowBands->failed())
+    {
+        emit logOutput("The image could not be read from the row source.");
+        m_ExtractedStars.clear();
+        m_HasExtracted = false;
+        result = -1;
+    }
+    m_RowBands.reset();
+    return result;
 }
 
 //This is the method that runs the solver or sextractor.  Do not call it, use the methods above instead, so that it can start a new thread.
@@ -123,17 +252,6 @@ void InternalSextractorSolver::run()
             QFile(m_LogFileName).remove();
     }
 
-    if(cancelfn == "")
-        cancelfn = m_BasePath + "/" + m_BaseName + ".cancel";
-    if(solvedfn == "")
-        solvedfn = m_BasePath + "/" + m_BaseName + ".solved";
-
-    QFile solvedFile(solvedfn);
-    solvedFile.setPermissions(solvedFile.permissions() | QFileDevice::WriteOther);
-    solvedFile.remove();
-
-    QFile(cancelfn).remove();
-
     switch(m_ProcessType)
     {
         case EXTRACT:
@@ -160,6 +278,11 @@ void InternalSextractorSolver::run()
             if(m_HasExtracted)
             {
                 int result = runInternalSolver();
+                //A child solver of a parallel solve keeps working on the shared queue until it solves or the queue runs out
+                while(result != 0 && takeNextWorkItem())
+                    result = runInternalSolver();
+                //The last solver to be done with the shared index files releases them, even if the StellarSolver is already gone
+                sharedIndexes.clear();
                 cleanupTempFiles();
                 emit finished(result);
             }
@@ -176,41 +299,32 @@ void InternalSextractorSolver::run()
     }
 }
 
+//The internal solver uses a cancel flag and a solved latch in memory, so it doesn't leave any temporary files behind
 void InternalSextractorSolver::cleanupTempFiles()
 {
-    QFile solvedFile(solvedfn);
-    solvedFile.setPermissions(solvedFile.permissions() | QFileDevice::WriteOther);
-    solvedFile.remove();
-    QFile(cancelfn).remove();
 }
 
-void InternalSextractorSolver::allocateDataBuffer(float *data, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+//This picks the version of readImageLine for the data type of the image, it returns nullptr if SEP can't read the type
+sep_line_reader InternalSextractorSolver::lineReaderFunction() const
 {
     switch (m_Statistics.dataType)
     {
         case SEP_TBYTE:
-            getFloatBuffer<uint8_t>(data, x, y, w, h);
-            break;
+            return &readImageLine<uint8_t>;
         case TSHORT:
-            getFloatBuffer<int16_t>(data, x, y, w, h);
-            break;
+            return &readImageLine<int16_t>;
         case TUSHORT:
-            getFloatBuffer<uint16_t>(data, x, y, w, h);
-            break;
+            return &readImageLine<uint16_t>;
         case TLONG:
-            getFloatBuffer<int32_t>(data, x, y, w, h);
-            break;
+            return &readImageLine<int32_t>;
         case TULONG:
-            getFloatBuffer<uint32_t>(data, x, y, w, h);
-            break;
+            return &readImageLine<uint32_t>;
         case TFLOAT:
-            getFloatBuffer<float>(data, x, y, w, h);
-            break;
+            return &readImageLine<float>;
         case TDOUBLE:
-            getFloatBuffer<double>(data, x, y, w, h);
-            break;
+            return &readImageLine<double>;
         default:
-            delete [] data;
+            return nullptr;
     }
 }
 
@@ -227,57 +341,68 @@ int InternalSextractorSolver::runSEPSextractor()
     emit logOutput("Starting Internal StellarSolver Sextractor with the " + m_ActiveParameters.listName + " profile . . .");
 
     //Only downsample images before SEP if the Sextraction is being used for plate solving
+    //An image from a row source is never in memory as a whole, so it can't be downsampled
     if(m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER && m_ActiveParameters.downsample != 1)
-        downsampleImage(m_ActiveParameters.downsample);
+    {
+        if(m_RowBands)
+            emit logOutput("The image is read from a row source, so it is not downsampled.");
+        else
+            downsampleImage(m_ActiveParameters.downsample);
+    }
     //saveAsFITS();  //You can uncomment this to test out the downsampling
     uint32_t x = 0, y = 0;
     uint32_t w = m_Statistics.width, h = m_Statistics.height;
-    uint32_t raw_w = m_Statistics.width, raw_h = m_Statistics.height;
     if(m_UseSubframe)
     {
         x = m_SubFrameRect.x();
         w = m_SubFrameRect.width();
         y = m_SubFrameRect.y();
         h = m_SubFrameRect.height();
+    }
 
-        raw_w = w;
-        raw_h = h;
+    if(!lineReaderFunction())
+    {
+        emit logOutput("The data type of the image is not supported by the internal sextractor.");
+        return -1;
     }
 
-    QList<float *> dataBuffers;
-    QList<QFuture<QList<FITSImage::Star>>> futures;
-    QList<QPair<uint32_t, uint32_t>> startupOffsets;
+    QList<QFuture<QVector<Detection>>> futures;
     QList<FITSImage::Background> backgrounds;
 
-    // Only partition if:
-    // We have 2 or more threads.
-    // The image width and height is larger than partition size.
+    // The background is computed once for the whole image, and all the partitions extract against it,
+    // so that they all use the same background and threshold.
+    sep_bkg *bkg = computeBackground(x, y, w, h);
+    if (!bkg)
+        return -1;
+
+    // Only partition if the image width and height is larger than partition size.
     constexpr int PARTITION_SIZE = 200;
-    if (m_ActiveParameters.partition &&  w > PARTITION_SIZE && h > PARTITION_SIZE && (m_PartitionThreads % 2) == 0)
+    if (m_ActiveParameters.partition &&  w > PARTITION_SIZE && h > PARTITION_SIZE)
     {
         // Partition the image to regions.
         // If there is extra at the end, we add an offset.
-        // e.g. 500x400 image with patitions sized 200x200 would have 4 paritions
-        // #1 0, 0, 200, 200 (200 x 200)
-        // #2 200, 0, 200 + 100, 200 (300 x 200)
-        // #3 0, 200, 200, 200 (200 x 200)
-        // #4 200, 200, 200 + 100, 200 (300 x 200)
-
-        int W_PARTITION_SIZE = PARTITION_SIZE;
-        int H_PARTITION_SIZE = PARTITION_SIZE;
-
-        // Limit it to PARTITION_THREADS
-        if ( (w * h) / (W_PARTITION_SIZE * H_PARTITION_SIZE) > m_PartitionThreads)
-        {
-            W_PARTITION_SIZE = w / (m_PartitionThreads / 2);
-            H_PARTITION_SIZE = h / 2;
-        }
-
-        int horizontalPartitions = w / W_PARTITION_SIZE;
-        int verticalPartitions = h / H_PARTITION_SIZE;
+        // e.g. 500x400 image would have 4 paritions of 250x200
+        // #1 0, 0, 250, 200 (250 x 200)
+        // #2 250, 0, 250, 200 (250 x 200)
+        // #3 0, 200, 250, 200 (250 x 200)
+        // #4 250, 200, 250, 200 (250 x 200)
+
+        // There is one partition for each thread, in a grid shaped like the image, but no partition is smaller than the partition size.
+        const int threads = static_cast<int>(std::max(m_PartitionThreads, 1u));
+        int verticalPartitions = qBound(1, qRound(sqrt(static_cast<double>(threads) * h / w)), static_cast<int>(h) / PARTITION_SIZE);
+        int horizontalPartitions = qBound(1, (threads + verticalPartitions - 1) / verticalPartitions, static_cast<int>(w) / PARTITION_SIZE);
+        // Each partition keeps its share of the stars, so the stars that are kept are spread across the image.
+        const uint32_t partitionKeep = static_cast<uint32_t>(std::max(m_ActiveParameters.initialKeep / (horizontalPartitions * verticalPartitions), 1));
+        int W_PARTITION_SIZE = w / horizontalPartitions;
+        int H_PARTITION_SIZE = h / verticalPartitions;
         int horizontalOffset = w - (W_PARTITION_SIZE * horizontalPartitions);
         int verticalOffset = h - (H_PARTITION_SIZE * verticalPartitions);
 
+        // Each partition is extracted together with a halo of the pixels around it, as wide as the convolution kernel
+        // plus the largest star radius, so the stars that cross a partition border are not cut off.
+        // A star in the overlap is found by both partitions, but only the partition that contains its center keeps it.
+        const uint32_t halo = static_cast<uint32_t>(sqrt(m_ActiveParameters.convFilter.size())) / 2 + MAX_OBJECT_RADIUS;
+
         for (int i = 0; i < verticalPartitions; i++)
         {
             for (int j = 0; j < horizontalPartitions; j++)
@@ -288,102 +413,129 @@ int InternalSextractorSolver::runSEPSextractor()
                 uint32_t subY = y + i * H_PARTITION_SIZE;
                 uint32_t subW = W_PARTITION_SIZE + offsetW;
                 uint32_t subH = H_PARTITION_SIZE + offsetH;
-                //uint32_t offset = subX + (subY * raw_w);
 
-                auto * data = new float[subW * subH];
-                allocateDataBuffer(data, subX, subY, subW, subH);
-                dataBuffers.append(data);
-                startupOffsets.append(qMakePair(subX, subY));
+                // The halo stops at the edges of the image or subframe, just like a single partition would
+                uint32_t haloLeft = std::min(halo, subX - x);
+                uint32_t haloTop = std::min(halo, subY - y);
+                uint32_t haloRight = std::min(halo, x + w - (subX + subW));
+                uint32_t haloBottom = std::min(halo, y + h - (subY + subH));
+                uint32_t bufferX = subX - haloLeft;
+                uint32_t bufferY = subY - haloTop;
+                uint32_t bufferW = subW + haloLeft + haloRight;
+                uint32_t bufferH = subH + haloTop + haloBottom;
+
+                // The partition reads its rectangle straight from the image buffer, nothing is copied
                 FITSImage::Background tempBackground;
                 backgrounds.append(tempBackground);
 
-                ImageParams parameters = {data,
-                                          subW,
-                                          subH,
-                                          0,
-                                          0,
-                                          subW,
-                                          subH,
-                                          m_ActiveParameters.initialKeep / m_PartitionThreads,
-                                          &backgrounds[backgrounds.size() - 1]
+                ImageParams parameters = {bufferW,
+                                          bufferH,
+                                          partitionKeep,
+                                          &backgrounds[backgrounds.size() - 1],
+                                          QRect(haloLeft, haloTop, subW, subH),
+                                          bkg,
+                                          QPoint(bufferX - x, bufferY - y),
+                                          QPoint(bufferX, bufferY)
                                          };
-                futures.append(QtConcurrent::run(this, &InternalSextractorSolver::extractPartition, parameters));
+                futures.append(QtConcurrent::run(this, &InternalSextractorSolver::detectPartition, parameters));
             }
         }
     }
     else
     {
-        auto * data = new float[w * h];
-        allocateDataBuffer(data, x, y, w, h);
-        dataBuffers.append(data);
-        startupOffsets.append(qMakePair(x, y));
         FITSImage::Background tempBackground;
         backgrounds.append(tempBackground);
-        ImageParams parameters = {data, raw_w, raw_h, x, y, w, h, static_cast<uint32_t>(m_ActiveParameters.initialKeep), &backgrounds[backgrounds.size() - 1]};
-        futures.append(QtConcurrent::run(this, &InternalSextractorSolver::extractPartition, parameters));
+        ImageParams parameters = {w, h, static_cast<uint32_t>(m_ActiveParameters.initialKeep), &backgrounds[backgrounds.size() - 1], QRect(0, 0, w, h), bkg, QPoint(0, 0), QPoint(x, y)};
+        futures.append(QtConcurrent::run(this, &InternalSextractorSolver::detectPartition, parameters));
     }
 
+    // The detections of all the partitions are measured together.
+    QVector<Detection> detections;
     for (auto oneFuture : futures)
     {
         oneFuture.waitForFinished();
-        QList<FITSImage::Star> partitionStars = oneFuture.result();
-        if (!startupOffsets.empty())
-        {
-            QPair<uint32_t, uint32_t> oneOffset = startupOffsets.takeFirst();
-            for (auto &oneStar : partitionStars)
-            {
-                oneStar.x += oneOffset.first;
-                oneStar.y += oneOffset.second;
-            }
-        }
-        m_ExtractedStars.append(partitionStars);
+        detections += oneFuture.result();
     }
+    m_ExtractedStars.append(measureStars(detections, bkg, x, y, w, h));
 
-    double sumGlobal = 0, sumRmsSq = 0;
-    for (const auto &bg : backgrounds)
-    {
-        sumGlobal += bg.global;
-        sumRmsSq += bg.globalrms * bg.globalrms;
-    }
-    if (!backgrounds.empty())
-    {
-        m_Background.bw = backgrounds[0].bw;
-        m_Background.bh = backgrounds[0].bh;
-    }
+    m_Background.bw = bkg->bw;
+    m_Background.bh = bkg->bh;
     m_Background.num_stars_detected = m_ExtractedStars.size();
-    m_Background.global = sumGlobal / backgrounds.size();
-    m_Background.globalrms = sqrt( sumRmsSq / backgrounds.size() );
+    m_Background.global = bkg->global;
+    m_Background.globalrms = bkg->globalrms;
+    sep_bkg_free(bkg);
 
     applyStarFilters(m_ExtractedStars);
 
-    for (auto * buffer : dataBuffers)
-        delete [] buffer;
-    dataBuffers.clear();
-
     m_HasExtracted = true;
 
     return 0;
 }
 
-QList<FITSImage::Star> InternalSextractorSolver::extractPartition(const ImageParams &parameters)
+//This computes the background of the image, or the subframe, for all the partitions to share.
+//The statistics of the background meshes are computed in parallel for bands of mesh rows, each band reading just its own rows,
+//then the mesh is filtered once for the whole image, so there are no seams in the background at the partition edges.
+sep_bkg *InternalSextractorSolver::computeBackground(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
 {
-    float *imback = nullptr;
-    double *fluxerr = nullptr, *area = nullptr;
-    short *flag = nullptr;
-    int status = 0;
+    // The reader for the bands doesn't subtract anything
+    LineReader reader = {m_ImageBuffer, m_Statistics.width, QPoint(x, y), nullptr, QPoint(0, 0), m_RowBands.get()};
+    sep_image im = {nullptr, nullptr, nullptr, nullptr, SEP_TFLOAT, 0, 0, 0,
+                    static_cast<int>(w), static_cast<int>(h), static_cast<int>(w), static_cast<int>(h),
+                    0, SEP_NOISE_NONE, 1.0, 0, lineReaderFunction(), &reader
+                   };
     sep_bkg *bkg = nullptr;
+    int status = sep_background_init(&im, BACKGROUND_MESH_SIZE, BACKGROUND_MESH_SIZE, &bkg);
+
+    if (status == 0)
+    {
+        const int meshRows = bkg->ny;
+        const int bands = std::min(meshRows, static_cast<int>(std::max(m_PartitionThreads, 1u)));
+        QList<QFuture<int>> futures;
+        for (int band = 0; band < bands; band++)
+        {
+            const int jstart = meshRows * band / bands;
+            const int jend = meshRows * (band + 1) / bands;
+            futures.append(QtConcurrent::run([&im, &reader, bkg, jstart, jend]()
+            {
+                //Each band has its own copy of the reader, for the band of rows it is on
+                LineReader bandReader = reader;
+                sep_image bandImage = im;
+                bandImage.readcontext = &bandReader;
+                return sep_background_rows(&bandImage, bkg, jstart, jend);
+            }));
+        }
+        for (auto &oneFuture : futures)
+        {
+            oneFuture.waitForFinished();
+            if (oneFuture.result() != 0)
+                status = oneFuture.result();
+        }
+    }
+
+    if (status == 0)
+        status = sep_background_finish(bkg, 3, 3, 0.0);
+
+    if (status != 0)
+    {
+        char errorMessage[512];
+        sep_get_errmsg(status, errorMessage);
+        emit logOutput(errorMessage);
+        sep_bkg_free(bkg);
+        return nullptr;
+    }
+    return bkg;
+}
+
+QVector<InternalSextractorSolver::Detection> InternalSextractorSolver::detectPartition(const ImageParams &parameters)
+{
+    int status = 0;
+    sep_bkg *bkg = parameters.sharedBackground;
     sep_catalog * catalog = nullptr;
-    QList<FITSImage::Star> partitionStars;
-    const uint32_t maxRadius = 50;
+    QVector<Detection> detections;
 
     auto cleanup = [ & ]()
     {
-        sep_bkg_free(bkg);
         Extract::sep_catalog_free(catalog);
-        free(imback);
-        free(fluxerr);
-        free(area);
-        free(flag);
 
         if (status != 0)
         {
@@ -393,15 +545,15 @@ QList<FITSImage::Star> InternalSextractorSolver::extractPartition(const ImagePar
         }
     };
 
-    //These are for the HFR
-    double requested_frac[2] = { 0.5, 0.99 };
-    double flux_fractions[2] = {0};
-    short flux_flag = 0;
     std::vector<std::pair<int, double>> ovals;
     int numToProcess = 0;
 
-    // #0 Create SEP Image structure
-    sep_image im = {parameters.data,
+    // #0 SEP reads the partition straight from the image buffer, converting each line to floats and subtracting
+    // the shared background only when it needs that line, so the image buffer is never copied or changed
+    LineReader reader = {m_ImageBuffer, m_Statistics.width, parameters.imagePosition, bkg, parameters.backgroundOffset, m_RowBands.get()};
+
+    // Create SEP Image structure
+    sep_image im = {nullptr,
                     nullptr,
                     nullptr,
                     nullptr,
@@ -409,75 +561,66 @@ QList<FITSImage::Star> InternalSextractorSolver::extractPartition(const ImagePar
                     0,
                     0,
                     0,
-                    static_cast<int>(parameters.width),
-                    static_cast<int>(parameters.height),
+                    static_cast<int>(parameters.subW),
+                    static_cast<int>(parameters.subH),
                     static_cast<int>(parameters.subW),
                     static_cast<int>(parameters.subH),
                     0,
                     SEP_NOISE_NONE,
                     1.0,
-                    0
+                    0,
+                    lineReaderFunction(),
+                    &reader
                    };
 
-    // #1 Background estimate
-    status = sep_background(&im, 64, 64, 3, 3, 0.0, &bkg);
-    if (status != 0)
-    {
-        cleanup();
-        return partitionStars;
-    }
-
-    // #2 Background evaluation
-    imback = (float *)malloc((parameters.subW * parameters.subH) * sizeof(float));
-    status = sep_bkg_array(bkg, imback, SEP_TFLOAT);
-    if (status != 0)
-    {
-        cleanup();
-        return partitionStars;
-    }
-
     //Saving some background information
     parameters.background->bh = bkg->bh;
     parameters.background->bw = bkg->bw;
     parameters.background->global = bkg->global;
     parameters.background->globalrms = bkg->globalrms;
 
-    // #3 Background subtraction
-    status = sep_bkg_subarray(bkg, im.data, im.dtype);
-    if (status != 0)
-    {
-        cleanup();
-        return partitionStars;
-    }
-
     std::unique_ptr<Extract> extractor;
     extractor.reset(new Extract());
-    // #4 Source Extraction
+    extractor->sep_set_separable_filter(m_ActiveParameters.separableFilter);
+    // The buffers of the extraction are taken from the ones kept by the StellarSolver from the last image, if it keeps them
+    ExtractContext *context = m_ExtractContexts ? m_ExtractContexts->take() : nullptr;
+    extractor->sep_set_extract_context(context);
+    // #1 Source Extraction
     // Note that we set deblend_cont = 1.0 to turn off deblending.
     status = extractor->sep_extract(&im, 2 * bkg->globalrms, SEP_THRESH_ABS, m_ActiveParameters.minarea,
                                     m_ActiveParameters.convFilter.data(),
                                     sqrt(m_ActiveParameters.convFilter.size()), sqrt(m_ActiveParameters.convFilter.size()), SEP_FILTER_CONV,
                                     m_ActiveParameters.deblend_thresh,
                                     m_ActiveParameters.deblend_contrast, m_ActiveParameters.clean, m_ActiveParameters.clean_param, &catalog);
+    if (context)
+        m_ExtractContexts->give(context);
+    sep_bkg_linebuf_free(&reader.backgroundBuffer);
     if (status != 0)
     {
         cleanup();
-        return partitionStars;
+        return detections;
     }
 
-    // Record the number of stars detected.
-    parameters.background->num_stars_detected = catalog->nobj;
-
     // Find the oval sizes for each detection in the detected star catalog, and sort by that. Oval size
     // correlates very well with HFR and likely magnitude.
+    // Detections centered in the halo around the partition belong to a neighbouring partition, so they are left out here.
+    int ownedDetections = 0;
     for (int i = 0; i < catalog->nobj; i++)
     {
+        if (catalog->x[i] < parameters.owned.left() || catalog->x[i] >= parameters.owned.left() + parameters.owned.width() ||
+                catalog->y[i] < parameters.owned.top() || catalog->y[i] >= parameters.owned.top() + parameters.owned.height())
+            continue;
+        ownedDetections++;
         const double ovalSizeSq = catalog->a[i] * catalog->a[i] + catalog->b[i] * catalog->b[i];
         ovals.push_back(std::pair<int, double>(i, ovalSizeSq));
     }
     std::sort(ovals.begin(), ovals.end(), [](const std::pair<int, double> &o1, const std::pair<int, double> &o2) -> bool { return o1.second > o2.second;});
 
-    numToProcess = std::min(static_cast<uint32_t>(catalog->nobj), parameters.keep);
+    // Record the number of stars detected.
+    parameters.background->num_stars_detected = ownedDetections;
+
+    numToProcess = std::min(static_cast<uint32_t>(ovals.size()), parameters.keep);
+    detections.reserve(numToProcess);
     for (int index = 0; index < numToProcess; index++)
     {
         // Processing detections in the order of the sort above.
@@ -486,104 +629,185 @@ QList<FITSImage::Star> InternalSextractorSolver::extractPartition(const ImagePar
         if (catalog->flag[i] & SEP_OBJ_TRUNC)
         {
             // Don't accept detections that go over the boundary.
+            // With the halo around the partition, that only happens at the edge of the image or for very large objects.
             continue;
         }
 
-        //Variables that are obtained from the catalog
-        //FOR SOME REASON, I FOUND THAT THE POSITIONS WERE OFF BY 1 PIXEL??
-        //This might be because of this: https://sextractor.readthedocs.io/en/latest/Param.html
-        //" Following the FITS convention, in SExtractor the center of the first image pixel has coordinates (1.0,1.0). "
-        float xPos = catalog->x[i] + 1;
-        float yPos = catalog->y[i] + 1;
-        float a = catalog->a[i];
-        float b = catalog->b[i];
-        float theta = catalog->theta[i];
-        float cxx = catalog->cxx[i];
-        float cyy = catalog->cxx[i];
-        float cxy = catalog->cxy[i];
-        double flux = catalog->flux[i];
-        double peak = catalog->peak[i];
-        int numPixels = catalog->npix[i];
-
-        //Variables that will be obtained through methods
-        double kronrad;
-        short kron_flag;
-        double sum;
-        double sumerr;
-        double kron_area;
-
-        //This will need to be done for both auto and ellipse
-        if(m_ActiveParameters.apertureShape != SHAPE_CIRCLE)
-        {
-            //Constant values
-            //The instructions say to use a fixed value of 6: https://sep.readthedocs.io/en/v1.0.x/api/sep.kron_radius.html
-            //Finding the kron radius for the sextraction
+        // The position is moved from the partition's buffer to the whole image or subframe, which is what the stars are measured on
+        Detection detection = {static_cast<float>(catalog->x[i] + parameters.backgroundOffset.x()),
+                               static_cast<float>(catalog->y[i] + parameters.backgroundOffset.y()),
+                               catalog->a[i],
+                               catalog->b[i],
+                               catalog->theta[i],
+                               catalog->cxx[i],
+                               catalog->cxx[i],
+                               catalog->cxy[i],
+                               catalog->flux[i],
+                               catalog->peak[i],
+                               catalog->npix[i]
+                              };
+        detections.append(detection);
+    }
 
-            sep_kron_radius(&im, xPos, yPos, cxx, cyy, cxy, 6, 0, &kronrad, &kron_flag);
-        }
+    cleanup();
+
+    return detections;
+}
+
+//The detections are split into one block for each thread, and each block is measured in parallel on the same image.
+//SEP only reads the image through the line reader, so each thread just needs its own copy of the reader for its scratch space.
+QList<FITSImage::Star> InternalSextractorSolver::measureStars(const QVector<Detection> &detections, sep_bkg *bkg, uint32_t x, uint32_t y,
+        uint32_t w, uint32_t h)
+{
+    QVector<FITSImage::Star> stars(detections.size());
+    LineReader reader = {m_ImageBuffer, m_Statistics.width, QPoint(x, y), bkg, QPoint(0, 0), m_RowBands.get()};
+    sep_image im = {nullptr, nullptr, nullptr, nullptr, SEP_TFLOAT, 0, 0, 0,
+                    static_cast<int>(w), static_cast<int>(h), static_cast<int>(w), static_cast<int>(h),
+                    0, SEP_NOISE_NONE, 1.0, 0, lineReaderFunction(), &reader
+                   };
 
-        bool use_circle;
+    const int count = detections.size();
+    const int blocks = std::min(count, static_cast<int>(std::max(m_PartitionThreads, 1u)));
+    FITSImage::Star *starData = stars.data();
 
-        switch(m_ActiveParameters.apertureShape)
+    // The detections are measured from the top of the image down, so each thread only works on the rows of its own strip
+    // of the image at any one time, which is what lets an image from a row source be measured with just a few bands in memory.
+    // The stars still come out in the order of the detections.
+    QVector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&detections](int a, int b)
+    {
+        return detections[a].y < detections[b].y;
+    });
+
+    QList<QFuture<void>> futures;
+    for (int block = 0; block < blocks; block++)
+    {
+        const int start = count * block / blocks;
+        const int end = count * (block + 1) / blocks;
+        futures.append(QtConcurrent::run([this, &im, &reader, &detections, &order, starData, start, end]()
         {
-            case SHAPE_AUTO:
-                use_circle = kronrad * sqrt(a * b) < m_ActiveParameters.r_min;
-                break;
+            LineReader blockReader = reader;
+            sep_image blockImage = im;
+            blockImage.readcontext = &blockReader;
+            for (int i = start; i < end; i++)
+                starData[order[i]] = measureStar(&blockImage, detections[order[i]]);
+            sep_bkg_linebuf_free(&blockReader.backgroundBuffer);
+        }));
+    }
+    for (auto &oneFuture : futures)
+        oneFuture.waitForFinished();
 
-            case SHAPE_CIRCLE:
-                use_circle = true;
-                break;
+    // The stars are measured on the whole image or subframe, so they are only moved by the position of the subframe
+    QList<FITSImage::Star> starList;
+    starList.reserve(count);
+    for (auto &oneStar : stars)
+    {
+        oneStar.x += x;
+        oneStar.y += y;
+        starList.append(oneStar);
+    }
+    return starList;
+}
 
-            case SHAPE_ELLIPSE:
-                use_circle = false;
-                break;
+FITSImage::Star InternalSextractorSolver::measureStar(sep_image *im, const Detection &detection)
+{
+    const uint32_t maxRadius = MAX_OBJECT_RADIUS;
 
-        }
+    //These are for the HFR
+    double requested_frac[2] = { 0.5, 0.99 };
+    double flux_fractions[2] = {0};
+    short flux_flag = 0;
 
-        if(use_circle)
-        {
-            sep_sum_circle(&im, xPos, yPos, m_ActiveParameters.r_min, 0, m_ActiveParameters.subpix, m_ActiveParameters.inflags, &sum,
-                           &sumerr, &kron_area, &kron_flag);
-        }
-        else
-        {
-            sep_sum_ellipse(&im, xPos, yPos, a, b, theta, m_ActiveParameters.kron_fact * kronrad, 0, m_ActiveParameters.subpix,
-                            m_ActiveParameters.inflags, &sum, &sumerr,
-                            &kron_area, &kron_flag);
-        }
+    //Variables that are obtained from the catalog
+    //FOR SOME REASON, I FOUND THAT THE POSITIONS WERE OFF BY 1 PIXEL??
+    //This might be because of this: https://sextractor.readthedocs.io/en/latest/Param.html
+    //" Following the FITS convention, in SExtractor the center of the first image pixel has coordinates (1.0,1.0). "
+    float xPos = detection.x + 1;
+    float yPos = detection.y + 1;
+    float a = detection.a;
+    float b = detection.b;
+    float theta = detection.theta;
+    float cxx = detection.cxx;
+    float cyy = detection.cyy;
+    float cxy = detection.cxy;
+    double flux = detection.flux;
+    double peak = detection.peak;
+    int numPixels = detection.numPixels;
+
+    //Variables that will be obtained through methods
+    double kronrad;
+    short kron_flag;
+    double sum;
+    double sumerr;
+    double kron_area;
+
+    //This will need to be done for both auto and ellipse
+    if(m_ActiveParameters.apertureShape != SHAPE_CIRCLE)
+    {
+        //Constant values
+        //The instructions say to use a fixed value of 6: https://sep.readthedocs.io/en/v1.0.x/api/sep.kron_radius.html
+        //Finding the kron radius for the sextraction
 
-        float mag = m_ActiveParameters.magzero - 2.5 * log10(sum);
-        float HFR = 0;
+        sep_kron_radius(im, xPos, yPos, cxx, cyy, cxy, 6, 0, &kronrad, &kron_flag);
+    }
 
-        if(m_ProcessType == EXTRACT_WITH_HFR)
-        {
-            //Get HFR
-            sep_flux_radius(&im, catalog->x[i], catalog->y[i], maxRadius, 0, m_ActiveParameters.subpix, 0, &flux, requested_frac, 2,
-                            flux_fractions,
-                            &flux_flag);
-            HFR = flux_fractions[0];
-        }
+    bool use_circle;
+
+    switch(m_ActiveParameters.apertureShape)
+    {
+        case SHAPE_AUTO:
+            use_circle = kronrad * sqrt(a * b) < m_ActiveParameters.r_min;
+            break;
+
+        case SHAPE_CIRCLE:
+            use_circle = true;
+            break;
+
+        case SHAPE_ELLIPSE:
+            use_circle = false;
+            break;
 
-        FITSImage::Star oneStar = {xPos,
-                                   yPos,
-                                   mag,
-                                   static_cast<float>(sum),
-                                   static_cast<float>(peak),
-                                   HFR,
-                                   a,
-                                   b,
-                                   qRadiansToDegrees(theta),
-                                   0,
-                                   0,
-                                   numPixels
-                                  };
-        // Make a copy and add it to QList
-        partitionStars.append(oneStar);
     }
 
-    cleanup();
+    if(use_circle)
+    {
+        sep_sum_circle(im, xPos, yPos, m_ActiveParameters.r_min, 0, m_ActiveParameters.subpix, m_ActiveParameters.inflags, &sum,
+                       &sumerr, &kron_area, &kron_flag);
+    }
+    else
+    {
+        sep_sum_ellipse(im, xPos, yPos, a, b, theta, m_ActiveParameters.kron_fact * kronrad, 0, m_ActiveParameters.subpix,
+                        m_ActiveParameters.inflags, &sum, &sumerr,
+                        &kron_area, &kron_flag);
+    }
 
-    return partitionStars;
+    float mag = m_ActiveParameters.magzero - 2.5 * log10(sum);
+    float HFR = 0;
+
+    if(m_ProcessType == EXTRACT_WITH_HFR)
+    {
+        //Get HFR
+        sep_flux_radius(im, detection.x, detection.y, maxRadius, 0, m_ActiveParameters.subpix, 0, &flux, requested_frac, 2,
+                        flux_fractions,
+                        &flux_flag);
+        HFR = flux_fractions[0];
+    }
+
+    FITSImage::Star oneStar = {xPos,
+                               yPos,
+                               mag,
+                               static_cast<float>(sum),
+                               static_cast<float>(peak),
+                               HFR,
+                               a,
+                               b,
+                               qRadiansToDegrees(theta),
+                               0,
+                               0,
+                               numPixels
+                              };
+    return oneStar;
 }
 
 void InternalSextractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
@@ -689,23 +913,37 @@ void InternalSextractorSolver::applyStarFilters(QList<FITSImage::Star> &starList
     }
 }
 
+//SEP calls this with the LineReader as the context to get n pixels of row y, starting at column x, of the image it is working on.
+//The background line is put in the output line first, and then it is subtracted while the image values are converted.
 template <typename T>
-void InternalSextractorSolver::getFloatBuffer(float * buffer, int x, int y, int w, int h)
+int InternalSextractorSolver::readImageLine(void *context, int y, int x, int n, float *line)
 {
-    auto * rawBuffer = reinterpret_cast<T const *>(m_ImageBuffer);
-    float * floatPtr = buffer;
-
-    int x2 = x + w;
-    int y2 = y + h;
-
-    for (int y1 = y; y1 < y2; y1++)
+    auto * reader = static_cast<LineReader *>(context);
+    const uint32_t imageY = reader->imagePosition.y() + y;
+    const uint32_t imageX = reader->imagePosition.x() + x;
+    T const * source;
+    //The reader only goes to the cache when the row is not in the band it is on, since the cache has to be locked
+    if (reader->bands)
     {
-        int offset = y1 * m_Statistics.width;
-        for (int x1 = x; x1 < x2; x1++)
-        {
-            *floatPtr++ = rawBuffer[offset + x1];
-        }
+        if (!reader->band || imageY < reader->band->y || imageY - reader->band->y >= reader->band->rows)
+            reader->band = reader->bands->bandFor(imageY);
+        source = reinterpret_cast<T const *>(reader->band->data.data()) + static_cast<size_t>(imageY - reader->band->y) * reader->stride +
+                 imageX;
+    }
+    else
+        source = reinterpret_cast<T const *>(reader->buffer) + static_cast<size_t>(imageY) * reader->stride + imageX;
+    if (reader->background)
+    {
+        //Only the n pixels of the background that are needed are evaluated, in the scratch space the reader keeps
+        int status = sep_bkg_line_flt_range(reader->background, reader->backgroundOffset.y() + y, reader->backgroundOffset.x() + x,
+                                            n, line, &reader->backgroundBuffer);
+        if (status != 0)
+            return status;
+        FloatConversion::convertLine(source, line, line, n);
     }
+    else
+        FloatConversion::convertLine(source, nullptr, line, n);
+    return 0;
 }
 
 void InternalSextractorSolver::downsampleImage(int d)
@@ -809,6 +1047,35 @@ void InternalSextractorSolver::downSampleImageType(int d)
     usingDownsampledImage = true;
 }
 
+//Astrometry.net calls this with the quads of one star to try.  The tasks are handed out in order to this thread and to threads
+//from the global thread pool.  Once a task finds a match, the tasks after it aren't started, since astrometry.net might not need them.
+void InternalSextractorSolver::runSolverTasks(void *solver, int (*task)(void *, int), void *taskData, int count)
+{
+    InternalSextractorSolver *self = static_cast<InternalSextractorSolver *>(solver);
+    std::atomic<int> next(0);
+    std::atomic<int> lastNeeded(count - 1);
+
+    auto work = [&]()
+    {
+        for(int i = next++; i < count && i <= lastNeeded; i = next++)
+        {
+            if(task(taskData, i))
+            {
+                int last = lastNeeded;
+                while(i < last && !lastNeeded.compare_exchange_weak(last, i));
+            }
+        }
+    };
+
+    int helpers = qMin(static_cast<int>(self->m_SolverThreads), count) - 1;
+    QList<QFuture<void>> futures;
+    for(int i = 0; i < helpers; i++)
+        futures.append(QtConcurrent::run(work));
+    work();
+    for(auto &future : futures)
+        future.waitForFinished();
+}
+
 //This method prepares the job file.  It is based upon the methods parse_job_from_qfits_header and engine_read_job_file in engine.c of astrometry.net
 //as well as the part of the method augment_xylist in augment_xylist.c where it handles xyls files
 bool InternalSextractorSolver::prepare_job()
@@ -839,14 +1106,23 @@ bool InternalSextractorSolver::prepare_job()
     sp->set_crpix = TRUE;
     sp->set_crpix_center = TRUE;
 
-    blind_set_cancel_file(bp, cancelfn.toLatin1().constData());
-    blind_set_solved_file(bp, solvedfn.toLatin1().constData());
+    blind_set_cancel_flag(bp, reinterpret_cast<const int *>(&m_CancelFlag));
+    if(m_SolvedLatch)
+        blind_set_solved_flag(bp, m_SolvedLatch->flag(), &SolvedLatch::setSolved, m_SolvedLatch.data());
+
+    //When this solver is not one of the children of a parallel solve, astrometry.net can use all the threads itself
+    if(m_SolverThreads > 1)
+    {
+        sp->parallel_for = &InternalSextractorSolver::runSolverTasks;
+        sp->parallel_data = this;
+    }
 
     //Logratios for Solving
     bp->logratio_tosolve = m_ActiveParameters.logratio_tosolve;
     sp->logratio_tokeep = m_ActiveParameters.logratio_tokeep;
     sp->logratio_totune = m_ActiveParameters.logratio_totune;
     sp->logratio_bail_threshold = log(DEFAULT_BAIL_THRESHOLD);
+    sp->verify_fast_nrefs = m_ActiveParameters.fastVerifyStars;
 
     bp->best_hit_only = TRUE;
 
@@ -1081,8 +1357,10 @@ int InternalSextractorSolver::runInternalSolver()
         emit logOutput("Configuring StellarSolver");
     }
 
-    //This creates and sets up the engine
-    engine_t* engine = engine_new();
+    //This creates and sets up the engine, or uses the one kept by the worker of the solver pool that this is running on
+    engine_t* engine = SolverPool::workerEngine();
+    if(!engine)
+        engine = engine_new();
 
     //This sets some basic engine settings
     engine->inparallel = m_ActiveParameters.inParallel ? TRUE : FALSE;
@@ -1095,14 +1373,16 @@ int InternalSextractorSolver::runInternalSolver()
     {
         if(m_LogToFile)
         {
-            logFile = fopen(m_LogFileName.toLatin1().constData(), "w");
+            //The log file was removed when the solver started, a child solver appends the log of each work item it takes
+            logFile = fopen(m_LogFileName.toLatin1().constData(), "a");
         }
         else
         {
 #ifndef _WIN32 //Windows does not support FIFO files
             m_LogFileName = m_BasePath + "/" + m_BaseName + ".logFIFO.txt";
             int mkFifoSuccess = 0; //Note if the return value of the command is 0 it succeeded, -1 means it failed.
-            if ((mkFifoSuccess = mkfifo(m_LogFileName.toLatin1(), S_IRUSR | S_IWUSR) == 0))
+            //The FIFO is still there if this child solver already used it for an earlier work item
+            if ((mkFifoSuccess = mkfifo(m_LogFileName.toLatin1(), S_IRUSR | S_IWUSR) == 0) || errno == EEXIST)
             {
                 startLogMonitor();
                 logFile = fopen(m_LogFileName.toLatin1().constData(), "r+");
@@ -1126,8 +1406,53 @@ int InternalSextractorSolver::runInternalSolver()
         engine_add_search_path(engine, onePath.toLatin1().constData());
     }
 
-    //This actually adds the index files in the directories above.
-    engine_autoindex_search_paths(engine);
+    //The index files are found with the index catalogue, so their headers don't have to be read again for every solve.
+    //If the position is known, only the index files for the part of the sky around it are used.
+    //If none of them are near it, all of them are used like before.
+    QList<IndexCatalog::Entry> catalogIndexes;
+    if(!sharedIndexes)
+    {
+        if(m_UsePosition)
+        {
+            catalogIndexes = IndexCatalog::indexesNear(indexFolderPaths, search_ra, search_dec, m_ActiveParameters.search_radius);
+            IndexCatalog::prefetchAround(indexFolderPaths, search_ra, search_dec, m_ActiveParameters.search_radius);
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("%1 index files are within %2 degrees of the search position").arg(catalogIndexes.count()).arg(
+                                   m_ActiveParameters.search_radius));
+        }
+        if(catalogIndexes.isEmpty())
+            catalogIndexes = IndexCatalog::indexesIn(indexFolderPaths);
+    }
+
+    //If the index files were already loaded for the parallel solvers, they are used as is.
+    //If the index cache is on, the index files come from the cache already loaded, otherwise the engine loads them itself.
+    QList<index_t *> cachedIndexes;
+    if(sharedIndexes)
+    {
+        for(auto index : *sharedIndexes)
+            engine_add_loaded_index(engine, index);
+    }
+    else if(IndexCache::isEnabled())
+    {
+        QStringList indexFiles;
+        for(const IndexCatalog::Entry &entry : catalogIndexes)
+            indexFiles.append(entry.path);
+        cachedIndexes = IndexCache::acquireFiles(indexFiles);
+        for(auto index : cachedIndexes)
+            engine_add_loaded_index(engine, index);
+    }
+    else
+    {
+        //When the engine loads the index files in parallel it needs all of them loaded now, otherwise it only needs the metadata
+        //until a job uses the file, and that comes from the catalogue.
+        for(const IndexCatalog::Entry &entry : catalogIndexes)
+        {
+            if(engine->inparallel)
+                engine_add_index(engine, entry.path.toLocal8Bit().data());
+            else
+                engine_add_index_metadata(engine, IndexCatalog::metadataIndex(entry));
+        }
+    }
 
     //This checks to see that index files were found in the paths above, if not, it prints this warning and aborts.
     if (!pl_size(engine->indexes))
@@ -1138,13 +1463,12 @@ int InternalSextractorSolver::runInternalSolver()
                                "See http://astrometry.net/use.html about how to get some index files.\n"
                                "---------------------------------------------------------------------\n"
                                "\n"));
-        engine_free(engine);
+        releaseEngine(engine);
+        IndexCache::release(cachedIndexes);
         return -1;
     }
 
     prepare_job();
-    engine->cancelfn = cancelfn.toLatin1().data();
-    engine->solvedfn = solvedfn.toLatin1().data();
 
     blind_t* bp = &(job->bp);
 
@@ -1199,6 +1523,8 @@ int InternalSextractorSolver::runInternalSolver()
     if (engine->minwidth <= 0.0 || engine->maxwidth <= 0.0 || engine->minwidth > engine->maxwidth)
     {
         emit logOutput(QString("\"minwidth\" and \"maxwidth\" must be positive and the maxwidth must be greater!\n"));
+        releaseEngine(engine);
+        IndexCache::release(cachedIndexes);
         return -1;
     }
     ///This sets the scales based on the minwidth and maxwidth if the image scale isn't known
@@ -1231,6 +1557,10 @@ int InternalSextractorSolver::runInternalSolver()
     if (engine_run_job(engine, job))
         emit logOutput("Failed to run job");
 
+    //If another child solver got the solution, this records how long it took this one to stop after that
+    if(m_SolvedLatch && !bp->solver.best_match_solves)
+        m_TimeToStop = m_SolvedLatch->msecsSinceSolved();
+
     //Needs to be done whether FIFO or regular file
     if(m_AstrometryLogLevel != SSolver::LOG_NONE && logFile)
         fclose(logFile);
@@ -1255,7 +1585,8 @@ int InternalSextractorSolver::runInternalSolver()
 #endif
 
     //This deletes or frees the items that are no longer needed.
-    engine_free(engine);
+    releaseEngine(engine);
+    IndexCache::release(cachedIndexes);
     bl_free(job->scales);
     dl_free(job->depths);
     free(fieldToSolve);
@@ -1353,22 +1684,15 @@ void InternalSextractorSolver::computeWCSCoord()
     int w = m_Statistics.width * d;
     int h = m_Statistics.height * d;
 
-
-    wcs_coord = new FITSImage::wcs_point[w * h];
-    FITSImage::wcs_point * p = wcs_coord;
-
-    for (int y = 0; y < h; y++)
+    //The coordinates are not computed here anymore, the grid computes them when they are needed.
+    //It keeps its own copy of the solution so that it still works after this solver is deleted.
+    sip_t solution = wcs;
+    m_WCSGrid.reset(new WCSGrid(w, h, [solution, d](double x, double y, double & ra, double & dec)
     {
-        for (int x = 0; x < w; x++)
-        {
-            double ra;
-            double dec;
-            sip_pixelxy2radec(&wcs, x / d, y / d, &ra, &dec);
-            p->ra = ra;
-            p->dec = dec;
-            p++;
-        }
-    }
+        sip_pixelxy2radec(&solution, x / d, y / d, &ra, &dec);
+        return true;
+    }));
+    wcs_coord = nullptr;
 }
 
 bool InternalSextractorSolver::pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &skyPoint)
@@ -1387,6 +1711,26 @@ bool InternalSextractorSolver::pixelToWCS(const QPointF &pixelPoint, FITSImage::
     return true;
 }
 
+bool InternalSextractorSolver::pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints)
+{
+    if(!hasWCSData())
+    {
+        emit logOutput("There is no WCS Data.");
+        return false;
+    }
+    int d = m_ActiveParameters.downsample;
+    skyPoints.resize(pixelPoints.size());
+    for(int i = 0; i < pixelPoints.size(); i++)
+    {
+        double ra;
+        double dec;
+        sip_pixelxy2radec(&wcs, pixelPoints[i].x() / d, pixelPoints[i].y() / d, &ra, &dec);
+        skyPoints[i].ra = ra;
+        skyPoints[i].dec = dec;
+    }
+    return true;
+}
+
 bool InternalSextractorSolver::wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint)
 {
     if(!hasWCSData())
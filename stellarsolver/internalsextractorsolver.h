@@ -8,12 +8,108 @@
 #pragma once
 
 #include "sextractorsolver.h"
+#include "imagerowsource.h"
+
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QHash>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 //Sextractor Includes
 #include "sep/sep.h"
 
 using namespace SSolver;
 
+//This is shared by the child solvers of one parallel solve, in place of the solved file they used to share.
+//The first child to solve the field sets it, and astrometry.net in all the others sees it in the solver loops and stops.
+class SolvedLatch
+{
+    public:
+        //This is called by astrometry.net, in the thread of the child solver that solved the field
+        static void setSolved(void *latch);
+        bool isSolved() const
+        {
+            return m_Solved.load(std::memory_order_acquire) != 0;
+        }
+        //astrometry.net reads the flag as an int with an acquire load, which std::atomic<int> is laid out the same as
+        const int *flag() const
+        {
+            return reinterpret_cast<const int *>(&m_Solved);
+        }
+        //This is the time in milliseconds since the field was solved, or -1 if it hasn't been solved
+        qint64 msecsSinceSolved();
+
+    private:
+        std::atomic<int> m_Solved { 0 };
+        QMutex m_Mutex;
+        QElapsedTimer m_SinceSolved;
+};
+
+namespace SEP
+{
+class ExtractContext;
+}
+
+//This keeps the working memory of the SEP extraction of a StellarSolver from one image to the next, so that the pixel stack,
+//the line arrays and the deblending buffers are only allocated for the first image, which matters for a guider extracting
+//an image every second or so.  Each partition takes a context while it is extracted and gives it back afterwards, so there
+//are only ever as many contexts as there were partitions extracted at once.  They are all freed with the pool.
+class ExtractContextPool
+{
+    public:
+        ~ExtractContextPool();
+
+        SEP::ExtractContext *take();
+        void give(SEP::ExtractContext *context);
+
+    private:
+        QMutex m_Mutex;
+        QList<SEP::ExtractContext *> m_Idle;
+};
+
+//This reads the rows of an image from an ImageRowSource in bands and keeps the last few bands that were used in memory,
+//so that the extractor can read the image a line at a time from any thread without the whole image being in memory.
+//The bands are shared pointers, so a band that is being read by one thread stays valid even if another one evicts it.
+class RowBandCache
+{
+    public:
+        struct Band
+        {
+            uint32_t y;                 //The first row of the band
+            uint32_t rows;              //The number of rows in the band
+            std::vector<uint8_t> data;  //The rows of the band in the data type of the image
+        };
+
+        RowBandCache(ImageRowSource *source, uint32_t width, uint32_t height, int bytesPerPixel, uint32_t bandRows, int maxBands);
+
+        //This gets the band that contains row y, reading it first if it isn't in memory.
+        //If the source can't read it, the band is all zeros and failed() returns true afterwards.
+        //It locks the cache, so the line readers keep the band they are on and only call it when they move to another one.
+        std::shared_ptr<const Band> bandFor(uint32_t y);
+        bool failed() const
+        {
+            return m_Failed;
+        }
+
+    private:
+        ImageRowSource *m_Source;
+        uint32_t m_Width;
+        uint32_t m_Height;
+        int m_BytesPerPixel;
+        uint32_t m_BandRows;
+        int m_MaxBands;
+        QMutex m_Mutex;
+        //Only one band is read from the source at a time, but the bands that are already in memory can be used meanwhile
+        QMutex m_ReadMutex;
+        QHash<uint32_t, std::shared_ptr<const Band>> m_Bands;
+        //The numbers of the bands in memory, the one used last is at the end
+        QList<uint32_t> m_Recent;
+        std::atomic<bool> m_Failed { false };
+};
+
 class InternalSextractorSolver: public SextractorSolver
 {
     public:
@@ -29,29 +125,66 @@ class InternalSextractorSolver: public SextractorSolver
         void cleanupTempFiles() override;
 
         bool pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &skyPoint) override;
+        bool pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints) override;
         bool wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint) override;
 
         typedef struct
         {
-            float *data;
-            uint32_t width;
-            uint32_t height;
-            uint32_t subX;
-            uint32_t subY;
             uint32_t subW;
             uint32_t subH;
             uint32_t keep;
             FITSImage::Background *background;
+            QRect owned;        //The part of the buffer this partition owns, the rest is the halo shared with its neighbours
+            SEP::sep_bkg *sharedBackground;  //The background of the whole image, which is shared by all the partitions
+            QPoint backgroundOffset;    //Where the partition starts in the shared background
+            QPoint imagePosition;       //Where the partition starts in the image
         } ImageParams;
 
+        //SEP reads the image buffer through this one line at a time, converting each line to floats and subtracting
+        //the background as it goes, so the image never has to be copied into a float buffer for SEP.
+        typedef struct
+        {
+            uint8_t const *buffer;  //The image buffer, which is not changed
+            uint32_t stride;        //The width of the image buffer in pixels
+            QPoint imagePosition;   //Where the SEP image starts in the image buffer
+            SEP::sep_bkg *background;   //The background to subtract, or nullptr to just convert the values
+            QPoint backgroundOffset;    //Where the SEP image starts in the background
+            RowBandCache *bands;        //If this is set, the rows are read through it instead of from the buffer
+            SEP::sep_bkg_linebuf backgroundBuffer;  //The scratch space for the background lines, so each thread needs its own reader
+            std::shared_ptr<const RowBandCache::Band> band;  //The band of the rows this reader is on, which it keeps even if the cache drops it
+        } LineReader;
+
+        //This is one detection from a partition that is kept to be measured, with its position in the whole image or subframe
+        typedef struct
+        {
+            float x;
+            float y;
+            float a;
+            float b;
+            float theta;
+            float cxx;
+            float cyy;
+            float cxy;
+            double flux;
+            double peak;
+            int numPixels;
+        } Detection;
+
     protected:
         //This is the method that actually runs the internal sextractor
         int runSEPSextractor();
         //This applies the star filter to the stars list.
         void applyStarFilters(QList<FITSImage::Star> &starList);
-        QList<FITSImage::Star> extractPartition(const ImageParams &parameters);
+        //Detecting the stars is done for each partition, then measuring them is done for all the detections at once
+        //spread over all the threads, so the photometry and HFR use every core even if the image is not partitioned.
+        QVector<Detection> detectPartition(const ImageParams &parameters);
+        QList<FITSImage::Star> measureStars(const QVector<Detection> &detections, SEP::sep_bkg *bkg, uint32_t x, uint32_t y, uint32_t w,
+                                            uint32_t h);
+        FITSImage::Star measureStar(SEP::sep_image *im, const Detection &detection);
+        SEP::sep_bkg *computeBackground(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
         void addToStarList(QList<FITSImage::Star> &stars, QList<FITSImage::Star> &partialStarList);
-        void allocateDataBuffer(float *data, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+        //This is the function SEP calls to read a line of the image with a LineReader, for the data type of the image
+        SEP::sep_line_reader lineReaderFunction() const;
         //This boolean gets set internally if we are using a downsampled image buffer for SEP
         bool usingDownsampledImage = false;
 
@@ -59,6 +192,8 @@ class InternalSextractorSolver: public SextractorSolver
 
         // The generic data buffer containing the image data
         uint8_t *downSampledBuffer { nullptr };
+        // The bands of the image that are in memory while an image from a row source is extracted
+        std::unique_ptr<RowBandCache> m_RowBands;
 
         //Job File related stuff
         bool prepare_job();         //This prepares the job object for the solver
@@ -71,9 +206,17 @@ class InternalSextractorSolver: public SextractorSolver
         override;        //This starts the StellarSolver in a separate thread.  Note, ExternalSextractorSolver uses QProcess
         int runInternalSolver();    //This is the method that actually runs the internal solver
 
-        //This is used by the sextractor, it gets a new representation of the buffer that SEP can understand
+        //This is used by the sextractor, it reads a line of the buffer in a form that SEP can understand
         template <typename T>
-        void getFloatBuffer(float * buffer, int x, int y, int w, int h);
+        static int readImageLine(void *context, int y, int x, int n, float *line);
+
+        //This is the function astrometry.net calls to work on the quads of one star in parallel
+        static void runSolverTasks(void *solver, int (*task)(void *taskData, int i), void *taskData, int count);
+
+        //This is set by abort() from another thread, astrometry.net checks it while solving instead of polling for a cancel file
+        std::atomic<int> m_CancelFlag { 0 };
+        //This is the solved latch this solver shares with the other children of a parallel solve
+        QSharedPointer<SolvedLatch> m_SolvedLatch;
 
         MatchObj match;             //This is where the match object gets stored once the solving is done.
         sip_t wcs;                  //This is where the WCS data gets saved once the solving is done
@@ -88,5 +231,8 @@ class InternalSextractorSolver: public SextractorSolver
         bool logMonitorRunning = false;
         FILE *logFile = nullptr;
         uint32_t m_PartitionThreads = {16};
+        //The number of threads astrometry.net can use to solve.  It is 1 for the child solvers of a parallel solve,
+        //since they already use all the threads between them.
+        uint32_t m_SolverThreads = {1};
 };
 
@@ -21,6 +21,7 @@ bool SSolver::Parameters::operator==(const Parameters& o)
             fwhm == o.fwhm &&
             //skip conv filter?? This might be hard to compare
             partition == o.partition &&
+            separableFilter == o.separableFilter &&
 
             //StellarSolver Star Filter Settings
             maxSize == o.maxSize &&
@@ -52,7 +53,8 @@ bool SSolver::Parameters::operator==(const Parameters& o)
             //They need to be turned into a qstring because they are sometimes very close but not exactly the same
             QString::number(logratio_tosolve) == QString::number(o.logratio_tosolve) &&
             QString::number(logratio_tokeep) == QString::number(o.logratio_tokeep) &&
-            QString::number(logratio_totune) == QString::number(o.logratio_totune);
+            QString::number(logratio_totune) == QString::number(o.logratio_totune) &&
+            fastVerifyStars == o.fastVerifyStars;
 }
 
 QMap<QString, QVariant> SSolver::Parameters::convertToMap(Parameters params)
@@ -85,6 +87,7 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(Parameters params)
     }
     settingsMap.insert("convFilter", QVariant(conv.join(",")));
     settingsMap.insert("partition", QVariant(params.partition));
+    settingsMap.insert("separableFilter", QVariant(params.separableFilter));
 
     //StellarSolver Star Filter Settings
     settingsMap.insert("maxSize", QVariant(params.maxSize));
@@ -115,6 +118,7 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(Parameters params)
     settingsMap.insert("logratio_tokeep", QVariant(params.logratio_tokeep)) ;
     settingsMap.insert("logratio_totune", QVariant(params.logratio_totune)) ;
     settingsMap.insert("logratio_tosolve", QVariant(params.logratio_tosolve)) ;
+    settingsMap.insert("fastVerifyStars", QVariant(params.fastVerifyStars));
 
     return settingsMap;
 
@@ -153,6 +157,7 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(QMap<QString, QVariant>
         params.convFilter = filter;
     }
     params.partition = settingsMap.value("partition", params.partition).toBool();
+    params.separableFilter = settingsMap.value("separableFilter", params.separableFilter).toBool();
 
     //StellarSolver Star Filter Settings
     params.maxSize = settingsMap.value("maxSize", params.maxSize).toDouble();
@@ -183,6 +188,7 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(QMap<QString, QVariant>
     params.logratio_tokeep = settingsMap.value("logratio_tokeep", params.logratio_tokeep).toDouble() ;
     params.logratio_totune = settingsMap.value("logratio_totune", params.logratio_totune).toDouble() ;
     params.logratio_tosolve = settingsMap.value("logratio_tosolve", params.logratio_tosolve).toDouble();
+    params.fastVerifyStars = settingsMap.value("fastVerifyStars", params.fastVerifyStars).toInt();
 
     return params;
 
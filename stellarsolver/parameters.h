@@ -287,6 +287,11 @@ class Parameters
         double fwhm = 2;
         // Automatically partition the image to several threads to speed it up.
         bool partition = true;
+        // Experimental: apply the convolution filter as two one dimensional passes when it is separable, like the gaussian filters are.
+        // Whether the filter is separable is worked out from the filter itself, and other filters always use the two dimensional pass.
+        // This is much faster for the large filters, but the sums are done in a different order, so the results can differ in the last digits
+        // and a star right at the threshold can come and go.  It is off until it has been measured on real images.
+        bool separableFilter = false;
 
         //This is the filter used for convolution. You can create this directly or use the convenience method below.
         QVector<float> convFilter = {0.260856, 0.483068, 0.260856,
@@ -332,6 +337,9 @@ class Parameters
         double logratio_tokeep  = log(1e9); // Odds ratio at which to keep a solution (default: 1e9)
         double logratio_totune  = log(
                                       1e6); // Odds ratio at which to try tuning up a match that isn't good enough to solve (default: 1e6)
+        // Experimental: the number of the brightest reference stars a match is checked against before it is verified against all of them.
+        // This rejects most false matches early, but it can also reject a true one, so it is off (0) until it has been measured.  Try 30.
+        int fastVerifyStars = 0;
 
         bool operator==(const Parameters &o);
 
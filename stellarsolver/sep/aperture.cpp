@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 #include "sep.h"
 #include "sepcore.h"
 #include "overlap.h"
@@ -159,6 +160,370 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
     *r_out2 = (*r_out2) * (*r_out2);
 }
 
+/* get the converter for the image data. If the image has a line reader,
+ * each row of the box is read into a float buffer first. */
+static int get_data_converter(sep_image *im, converter *f, int *size)
+{
+    return get_converter(im->readline ? PIXDTYPE : im->dtype, f, size);
+}
+
+/* get a pointer to the data of row iy of the box, from xmin to xmax.
+ * pos is the position of the start of the row in the data array.
+ * Returns the status of the line reader, if the image has one. */
+static int get_data_row(sep_image *im, int iy, int xmin, int xmax, long pos,
+                        int size, std::vector<PIXTYPE> &rowbuf, BYTE **row)
+{
+    if (im->readline)
+    {
+        rowbuf.resize(xmax - xmin);
+        *row = reinterpret_cast<BYTE *>(rowbuf.data());
+        return im->readline(im->readcontext, iy, xmin, xmax - xmin, rowbuf.data());
+    }
+    *row = reinterpret_cast<BYTE *>(im->data) + pos * size;
+    return RETURN_OK;
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/*****************************************************************************/
+/* Fast versions of the aperture sums.
+ *
+ * StellarSolver always measures its stars on a float image (or a line
+ * reader, which gives floats) with no mask, segmentation map or noise array.
+ * For that case these versions read the pixels with the type of the data
+ * instead of calling a converter for every pixel, and the subpixel loops are
+ * written so the compiler can vectorise them: the squared x offsets of the
+ * subpixels are computed once per pixel, and the comparisons are counted
+ * without branches.  The circle sums are added up in the same order and
+ * with the same values as the general version, so the results are
+ * identical.  The annulus sums, which the HFR uses, find the bins of the
+ * subpixels from their squared radii instead of a square root for each one,
+ * and add all the subpixels of a pixel that fall in a bin at once, so they
+ * can differ from the general version by rounding.  tests/benchaperture.cpp
+ * measures both.
+ */
+
+/* returns true if the fast versions can be used for this image */
+static bool use_fast_aperture(const sep_image *im)
+{
+    return !im->mask && !im->segmap &&
+           !(im->noise && im->noise_type != SEP_NOISE_NONE);
+}
+
+/* the variance of each pixel, which is constant without a noise array */
+static PIXTYPE fast_varpix(const sep_image *im)
+{
+    if (im->noise_type == SEP_NOISE_NONE)
+        return 0.0;
+    return (im->noise_type == SEP_NOISE_STDDEV) ?
+           im->noiseval * im->noiseval : im->noiseval;
+}
+
+/* get a pointer to row iy of the box with the type of the data */
+template <typename T>
+static int typed_data_row(sep_image *im, int iy, int xmin, int xmax,
+                          std::vector<PIXTYPE> &rowbuf, const T **row)
+{
+    long pos = (long)(iy % im->raw_h) * im->raw_w + xmin;
+    BYTE *datat;
+    int status = get_data_row(im, iy, xmin, xmax, pos, sizeof(T), rowbuf, &datat);
+    *row = reinterpret_cast<const T *>(datat);
+    return status;
+}
+
+static void oversamp_ann_circle(double r, double *r_in2, double *r_out2);
+
+template <typename T>
+static int sum_circle_fast_t(sep_image *im, double x, double y, double r,
+                             int subpix, double *sum, double *sumerr,
+                             double *area, short *flag)
+{
+    PIXTYPE pix, varpix;
+    double dx, dy, dx1, dy2, offset, scale, scale2, r2, r_in2, r_out2, rpix2;
+    double tv, sigtv, totarea, overlap;
+    int i, ix, iy, xmin, xmax, ymin, ymax, sx, sy, hits, status;
+    const T *row;
+    std::vector<PIXTYPE> rowbuf;
+    std::vector<double> dx1sq(subpix);
+    std::vector<double> hitarea(subpix * subpix + 1);
+
+    tv = sigtv = totarea = 0.0;
+    *flag = 0;
+    varpix = fast_varpix(im);
+    scale = 1.0 / subpix;
+    scale2 = scale * scale;
+    offset = 0.5 * (scale - 1.0);
+    r2 = r * r;
+    oversamp_ann_circle(r, &r_in2, &r_out2);
+
+    /* the overlap of a pixel with this many subpixels in the aperture,
+     * added up one subpixel at a time like the general version does */
+    hitarea[0] = 0.0;
+    for (i = 1; i <= subpix * subpix; i++)
+        hitarea[i] = hitarea[i - 1] + scale2;
+
+    boxextent(x, y, r, r, im->w, im->h, &xmin, &xmax, &ymin, &ymax, flag);
+
+    for (iy = ymin; iy < ymax; iy++)
+    {
+        if ((status = typed_data_row<T>(im, iy, xmin, xmax, rowbuf, &row)))
+            return status;
+        for (ix = xmin; ix < xmax; ix++)
+        {
+            dx = ix - x;
+            dy = iy - y;
+            rpix2 = dx * dx + dy * dy;
+            if (rpix2 < r_out2)
+            {
+                if (rpix2 > r_in2)  /* might be partially in aperture */
+                {
+                    dx += offset;
+                    dy += offset;
+                    dx1 = dx;
+                    for (sx = 0; sx < subpix; sx++, dx1 += scale)
+                        dx1sq[sx] = dx1 * dx1;
+                    hits = 0;
+                    for (sy = subpix; sy--; dy += scale)
+                    {
+                        dy2 = dy * dy;
+                        for (sx = 0; sx < subpix; sx++)
+                            hits += (dx1sq[sx] + dy2 < r2);
+                    }
+                    overlap = hitarea[hits];
+                }
+                else
+                    /* definitely fully in aperture */
+                    overlap = 1.0;
+
+                pix = row[ix - xmin];
+                tv += pix * overlap;
+                sigtv += varpix * overlap;
+                totarea += overlap;
+            }
+        }
+    }
+
+    /* add poisson noise, only if gain > 0 */
+    if (im->gain > 0.0 && tv > 0.0)
+        sigtv += tv / im->gain;
+
+    *sum = tv;
+    *sumerr = sqrt(sigtv);
+    *area = totarea;
+
+    return RETURN_OK;
+}
+
+static int sum_circle_fast(sep_image *im, double x, double y, double r,
+                           int subpix, double *sum, double *sumerr,
+                           double *area, short *flag)
+{
+    switch (im->readline ? PIXDTYPE : im->dtype)
+    {
+        case SEP_TFLOAT:
+            return sum_circle_fast_t<float>(im, x, y, r, subpix, sum, sumerr, area, flag);
+        case SEP_TDOUBLE:
+            return sum_circle_fast_t<double>(im, x, y, r, subpix, sum, sumerr, area, flag);
+        case SEP_TINT:
+            return sum_circle_fast_t<int>(im, x, y, r, subpix, sum, sumerr, area, flag);
+        case SEP_TBYTE:
+            return sum_circle_fast_t<BYTE>(im, x, y, r, subpix, sum, sumerr, area, flag);
+    }
+    return ILLEGAL_DTYPE;
+}
+
+/* The fast annulus sums find the bins of the subpixels of a pixel by
+ * comparing their squared radii with the bin boundaries around the pixel's
+ * own bin, which works as long as no subpixel is more than two bins away
+ * from it.  The subpixel centres are less than 0.7072 px from the pixel
+ * centre, so that needs bins wider than half of that. */
+#define CIRCANN_FAST_MINSTEP 0.3536
+
+/* bound[k + 2] is the smallest squared radius that the general version puts
+ * in bin k or above, (int)(sqrt(r2) * stepdens) >= k, for k = 0 to n.  That
+ * expression never decreases with r2, so stepping (k * step)^2 by a few ulps
+ * finds the exact boundary.  There are two more boundaries on each side so
+ * the bins around any pixel can be looked up without checks. */
+static void circann_bin_bounds(double step, double stepdens, int n,
+                               std::vector<double> &bound)
+{
+    double r2;
+    int k;
+
+    bound.resize(n + 5);
+    bound[0] = bound[1] = -HUGE_VAL;
+    bound[2] = 0.0;
+    for (k = 1; k <= n; k++)
+    {
+        r2 = (k * step) * (k * step);
+        while (r2 > 0.0 && (int)(sqrt(r2) * stepdens) >= k)
+            r2 = nextafter(r2, 0.0);
+        while ((int)(sqrt(r2) * stepdens) < k)
+            r2 = nextafter(r2, HUGE_VAL);
+        bound[k + 2] = r2;
+    }
+    bound[n + 3] = bound[n + 4] = HUGE_VAL;
+}
+
+template <typename T>
+static int sum_circann_multi_fast_t(sep_image *im, double x, double y,
+                                    double rmax, int n, int subpix,
+                                    double *sum, double *sumvar, double *area,
+                                    short *flag)
+{
+    PIXTYPE pix, varpix;
+    double dx, dy, dx1, dy2, offset, scale, scale2, rpix2, rpix, r_out, r_out2;
+    double d, step, stepdens, prevbinmargin, nextbinmargin, wpix, wvar, w;
+    double blm1, bl0, bl1, bl2;
+    int ix, iy, xmin, xmax, ymin, ymax, sx, sy, j, k, status;
+    int nltm1, nlt0, nge1, nge2, alwaysoversample, onebin;
+    int count[5];
+    const T *row;
+    std::vector<PIXTYPE> rowbuf;
+    std::vector<double> dx1sq(subpix);
+    std::vector<double> bound;
+
+    *flag = 0;
+    varpix = fast_varpix(im);
+    scale = 1.0 / subpix;
+    scale2 = scale * scale;
+    offset = 0.5 * (scale - 1.0);
+
+    r_out = rmax + 1.5; /* margin for interpolation */
+    r_out2 = r_out * r_out;
+    step = rmax / n;
+    stepdens = 1.0 / step;
+    prevbinmargin = 0.7072;
+    nextbinmargin = step - 0.7072;
+    wvar = scale2 * varpix;
+    /* with bins narrower than the two margins every pixel is oversampled,
+     * so the remainder doesn't have to be worked out */
+    alwaysoversample = nextbinmargin < prevbinmargin;
+    onebin = step > 2 * CIRCANN_FAST_MINSTEP;
+    circann_bin_bounds(step, stepdens, n, bound);
+
+    boxextent(x, y, r_out, r_out, im->w, im->h, &xmin, &xmax, &ymin, &ymax,
+              flag);
+
+    for (iy = ymin; iy < ymax; iy++)
+    {
+        if ((status = typed_data_row<T>(im, iy, xmin, xmax, rowbuf, &row)))
+            return status;
+        for (ix = xmin; ix < xmax; ix++)
+        {
+            dx = ix - x;
+            dy = iy - y;
+            rpix2 = dx * dx + dy * dy;
+            if (rpix2 < r_out2)
+            {
+                pix = row[ix - xmin];
+
+                /* check if oversampling is needed (close to bin boundary?) */
+                rpix = sqrt(rpix2);
+                if (alwaysoversample ||
+                        (d = fmod(rpix, step)) < prevbinmargin || d > nextbinmargin)
+                {
+                    /* count the subpixels below and above the boundaries
+                     * of the two bins on each side of the pixel's bin */
+                    j = (int)(rpix * stepdens);
+                    if (j > n)
+                        j = n;
+                    blm1 = bound[j + 1];
+                    bl0 = bound[j + 2];
+                    bl1 = bound[j + 3];
+                    bl2 = bound[j + 4];
+                    dx += offset;
+                    dy += offset;
+                    dx1 = dx;
+                    for (sx = 0; sx < subpix; sx++, dx1 += scale)
+                        dx1sq[sx] = dx1 * dx1;
+                    nltm1 = nlt0 = nge1 = nge2 = 0;
+                    if (onebin)
+                        /* no subpixel can be two bins away */
+                        for (sy = subpix; sy--; dy += scale)
+                        {
+                            dy2 = dy * dy;
+                            for (sx = 0; sx < subpix; sx++)
+                            {
+                                rpix2 = dx1sq[sx] + dy2;
+                                nlt0 += (rpix2 < bl0);
+                                nge1 += (rpix2 >= bl1);
+                            }
+                        }
+                    else
+                        for (sy = subpix; sy--; dy += scale)
+                        {
+                            dy2 = dy * dy;
+                            for (sx = 0; sx < subpix; sx++)
+                            {
+                                rpix2 = dx1sq[sx] + dy2;
+                                nltm1 += (rpix2 < blm1);
+                                nlt0 += (rpix2 < bl0);
+                                nge1 += (rpix2 >= bl1);
+                                nge2 += (rpix2 >= bl2);
+                            }
+                        }
+                    count[0] = nltm1;
+                    count[1] = nlt0 - nltm1;
+                    count[2] = subpix * subpix - nlt0 - nge1;
+                    count[3] = nge1 - nge2;
+                    count[4] = nge2;
+
+                    /* each bin gets all of its subpixels at once */
+                    wpix = scale2 * pix;
+                    for (k = 0; k < 5; k++)
+                    {
+                        if (count[k] && j + k - 2 < n)
+                        {
+                            w = count[k];
+                            sum[j + k - 2] += w * wpix;
+                            sumvar[j + k - 2] += w * wvar;
+                            area[j + k - 2] += w * scale2;
+                        }
+                    }
+                }
+                else
+                    /* pixel not close to bin boundary */
+                {
+                    j = (int)(rpix * stepdens);
+                    if (j < n)
+                    {
+                        sum[j] += pix;
+                        sumvar[j] += varpix;
+                        area[j] += 1.0;
+                    }
+                }
+            }
+        }
+    }
+
+    /* add poisson noise, only if gain > 0 */
+    if (im->gain > 0.0)
+        for (j = n; j--;)
+            if (sum[j] > 0.0)
+                sumvar[j] += sum[j] / im->gain;
+
+    return RETURN_OK;
+}
+
+static int sum_circann_multi_fast(sep_image *im, double x, double y,
+                                  double rmax, int n, int subpix,
+                                  double *sum, double *sumvar, double *area,
+                                  short *flag)
+{
+    switch (im->readline ? PIXDTYPE : im->dtype)
+    {
+        case SEP_TFLOAT:
+            return sum_circann_multi_fast_t<float>(im, x, y, rmax, n, subpix, sum, sumvar, area, flag);
+        case SEP_TDOUBLE:
+            return sum_circann_multi_fast_t<double>(im, x, y, rmax, n, subpix, sum, sumvar, area, flag);
+        case SEP_TINT:
+            return sum_circann_multi_fast_t<int>(im, x, y, rmax, n, subpix, sum, sumvar, area, flag);
+        case SEP_TBYTE:
+            return sum_circann_multi_fast_t<BYTE>(im, x, y, rmax, n, subpix, sum, sumvar, area, flag);
+    }
+    return ILLEGAL_DTYPE;
+}
+
 /*****************************************************************************/
 /* circular aperture */
 
@@ -179,6 +544,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
 #define APER_COMPARE1 rpix2 < r_out2
 #define APER_COMPARE2 rpix2 > r_in2
 #define APER_COMPARE3 rpix2 < r2
+#define APER_FAST sum_circle_fast(im, x, y, r, subpix, sum, sumerr, area, flag)
 #include "aperture.i"
 #undef APER_NAME
 #undef APER_ARGS
@@ -192,6 +558,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
 #undef APER_COMPARE1
 #undef APER_COMPARE2
 #undef APER_COMPARE3
+#undef APER_FAST
 
 /*****************************************************************************/
 /* elliptical aperture */
@@ -329,6 +696,7 @@ int sep_sum_circann_multi(sep_image *im,
     long pos;
     short errisarray, errisstd;
     BYTE *datat, *errort, *maskt, *segt;
+    std::vector<PIXTYPE> rowbuf;
     converter convert, econvert, mconvert, sconvert;
     double rpix, r_out, r_out2, d, prevbinmargin, nextbinmargin, step, stepdens;
     int j, ismasked;
@@ -346,6 +714,11 @@ int sep_sum_circann_multi(sep_image *im,
     if (im->mask)
         memset(maskarea, 0, (size_t)(n * sizeof(double)));
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (use_fast_aperture(im) && rmax / n > CIRCANN_FAST_MINSTEP)
+        return sum_circann_multi_fast(im, x, y, rmax, n, subpix, sum, sumvar,
+                                      area, flag);
+
     /* initializations */
     size = esize = msize = 0;
     datat = maskt = segt = NULL;
@@ -369,7 +742,7 @@ int sep_sum_circann_multi(sep_image *im,
     errisstd = 0;
 
     /* get data converter(s) for input array(s) */
-    if ((status = get_converter(im->dtype, &convert, &size)))
+    if ((status = get_data_converter(im, &convert, &size)))
         return status;
     if (im->mask && (status = get_converter(im->mdtype, &mconvert, &msize)))
         return status;
@@ -402,7 +775,8 @@ int sep_sum_circann_multi(sep_image *im,
     {
         /* set pointers to the start of this row */
         pos = (iy % im->raw_h) * im->raw_w + xmin;
-        datat = reinterpret_cast<uint8_t *>(im->data) + pos * size;
+        if ((status = get_data_row(im, iy, xmin, xmax, pos, size, rowbuf, &datat)))
+            return status;
         if (errisarray)
             errort = reinterpret_cast<uint8_t *>(im->noise) + pos * esize;
         if (im->mask)
@@ -622,6 +996,7 @@ int sep_kron_radius(sep_image *im, double x, double y,
     int ismasked;
 
     BYTE *datat, *maskt, *segt;
+    std::vector<PIXTYPE> rowbuf;
     converter convert, mconvert, sconvert;
 
     r2 = r * r;
@@ -632,7 +1007,7 @@ int sep_kron_radius(sep_image *im, double x, double y,
     size = msize = ssize = 0;
 
     /* get data converter(s) for input array(s) */
-    if ((status = get_converter(im->dtype, &convert, &size)))
+    if ((status = get_data_converter(im, &convert, &size)))
         return status;
     if (im->mask && (status = get_converter(im->mdtype, &mconvert, &msize)))
         return status;
@@ -648,7 +1023,8 @@ int sep_kron_radius(sep_image *im, double x, double y,
     {
         /* set pointers to the start of this row */
         pos = (iy % im->raw_h) * im->raw_w + xmin;
-        datat = reinterpret_cast<uint8_t *>(im->data)  + pos * size;
+        if ((status = get_data_row(im, iy, xmin, xmax, pos, size, rowbuf, &datat)))
+            return status;
         if (im->mask)
             maskt = reinterpret_cast<uint8_t *>(im->mask) + pos * msize;
         if (im->segmap)
@@ -786,6 +1162,7 @@ int sep_windowed(sep_image *im,
     long pos;
     short errisarray, errisstd;
     BYTE *datat, *errort, *maskt;
+    std::vector<PIXTYPE> rowbuf;
     converter convert, econvert, mconvert;
     double r2, r_in2, r_out2;
 
@@ -818,7 +1195,7 @@ int sep_windowed(sep_image *im,
     oversamp_ann_circle(r, &r_in2, &r_out2);
 
     /* get data converter(s) for input array(s) */
-    if ((status = get_converter(im->dtype, &convert, &size)))
+    if ((status = get_data_converter(im, &convert, &size)))
         return status;
     if (im->mask && (status = get_converter(im->mdtype, &mconvert, &msize)))
         return status;
@@ -861,7 +1238,8 @@ int sep_windowed(sep_image *im,
         {
             /* set pointers to the start of this row */
             pos = (iy % im->raw_h) * im->raw_w + xmin;
-            datat = reinterpret_cast<uint8_t *>(im->data) + pos * size;
+            if ((status = get_data_row(im, iy, xmin, xmax, pos, size, rowbuf, &datat)))
+                return status;
             if (errisarray)
                 errort = reinterpret_cast<uint8_t *>(im->noise) + pos * esize;
             if (im->mask)
@@ -18,6 +18,7 @@ int APER_NAME(sep_image *im,
     long pos;
     short errisarray, errisstd;
     BYTE *datat, *errort, *maskt, *segt;
+    std::vector<PIXTYPE> rowbuf;
     converter convert, econvert, mconvert, sconvert;
     APER_DECL;
 
@@ -26,6 +27,13 @@ int APER_NAME(sep_image *im,
     if (subpix < 0)
         return ILLEGAL_SUBPIX;
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+#ifdef APER_FAST
+    /* the common case has a faster version, see aperture.cpp */
+    if (subpix > 0 && use_fast_aperture(im))
+        return APER_FAST;
+#endif
+
     /* initializations */
     size = esize = msize = ssize = 0;
     tv = sigtv = 0.0;
@@ -43,7 +51,7 @@ int APER_NAME(sep_image *im,
     APER_INIT;
 
     /* get data converter(s) for input array(s) */
-    if ((status = get_converter(im->dtype, &convert, &size)))
+    if ((status = get_data_converter(im, &convert, &size)))
         return status;
     if (im->mask && (status = get_converter(im->mdtype, &mconvert, &msize)))
         return status;
@@ -75,7 +83,8 @@ int APER_NAME(sep_image *im,
     {
         /* set pointers to the start of this row */
         pos = (iy % im->raw_h) * im->raw_w + xmin;
-        datat = reinterpret_cast<uint8_t*>(im->data) + pos * size;
+        if ((status = get_data_row(im, iy, xmin, xmax, pos, size, rowbuf, &datat)))
+            return status;
         if (errisarray)
             errort = reinterpret_cast<uint8_t*>(im->noise) + pos * esize;
         if (im->mask)
@@ -56,36 +56,43 @@ void backstat(backstruct *backmesh,
 int filterback(sep_bkg *bkg, int fw, int fh, double fthresh);
 float backguess(backstruct *bkg, float *mean, float *sigma);
 int makebackspline(sep_bkg *bkg, float *map, float *dmap);
+int bkg_line_flt_range(sep_bkg *bkg, float *values, float *dvalues, int y,
+                       int xstart, int width, float *line,
+                       sep_bkg_linebuf *buf);
 
 
 int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
                    double fthresh, sep_bkg **bkg)
 {
-    BYTE *imt, *maskt;
-    int npix;                   /* size of image */
+    sep_bkg *bkgout;
+    int status;
+
+    if ((status = sep_background_init(image, bw, bh, &bkgout)) != RETURN_OK)
+    {
+        *bkg = NULL;
+        return status;
+    }
+
+    if ((status = sep_background_rows(image, bkgout, 0, bkgout->ny)) != RETURN_OK ||
+            (status = sep_background_finish(bkgout, fw, fh, fthresh)) != RETURN_OK)
+    {
+        sep_bkg_free(bkgout);
+        *bkg = NULL;
+        return status;
+    }
+
+    *bkg = bkgout;
+    return status;
+}
+
+int sep_background_init(sep_image* image, int bw, int bh, sep_bkg **bkg)
+{
     int nx, ny, nb;             /* number of background boxes in x, y, total */
-    int bufsize;                /* size of a "row" of boxes in pixels (w*bh) */
-    int imgbufsize;             /* size of a "row" of boxes in pixels (raw_w*bh) for the whole image width */
-    int elsize;                 /* size (in bytes) of an image array element */
-    int melsize;                /* size (in bytes) of a mask array element */
-    PIXTYPE *buf, *buft, *mbuf, *mbuft;
-    PIXTYPE maskthresh;
-    array_converter convert, mconvert;
-    backstruct *backmesh, *bm;  /* info about each background "box" */
     sep_bkg *bkgout;          /* output */
-    int j, k, m, status;
+    int status;
 
     status = RETURN_OK;
-    npix = image->w * image->h;
-    bufsize = image->w * bh;
-    imgbufsize = image->raw_w * bh;
-    maskthresh = image->maskthresh;
-    if (image->mask == NULL) maskthresh = 0.0;
-
-    backmesh = bm = NULL;
     bkgout = NULL;
-    buf = mbuf = buft = mbuft = NULL;
-    convert = mconvert = NULL;
 
     /* determine number of background boxes */
     if ((nx = (image->w - 1) / bw + 1) < 1)
@@ -94,15 +101,8 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
         ny = 1;
     nb = nx * ny;
 
-    /* Allocate temp memory & initialize */
-    backmesh = static_cast<backstruct*>(malloc(sizeof(backstruct) * nx));
-    bm = backmesh;
-    for (m = nx; m--; bm++)
-        bm->histo = NULL;
-
     /* Allocate the returned struct */
-    bkgout = static_cast<sep_bkg*>(malloc(sizeof(sep_bkg)));
-    //QMALLOC(bkgout, sep_bkg, 1, status);
+    QCALLOC(bkgout, sep_bkg, 1, status);
     bkgout->w = image->w;
     bkgout->h = image->h;
     bkgout->nx = nx;
@@ -110,23 +110,65 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
     bkgout->n = nb;
     bkgout->bw = bw;
     bkgout->bh = bh;
-    bkgout->back = NULL;
-    bkgout->sigma = NULL;
-    bkgout->dback = NULL;
-    bkgout->dsigma = NULL;
     QMALLOC(bkgout->back, float, nb, status);
     QMALLOC(bkgout->sigma, float, nb, status);
     QMALLOC(bkgout->dback, float, nb, status);
     QMALLOC(bkgout->dsigma, float, nb, status);
 
+    *bkg = bkgout;
+    return status;
+
+exit:
+    sep_bkg_free(bkgout);
+    *bkg = NULL;
+    return status;
+}
+
+int sep_background_rows(sep_image* image, sep_bkg *bkg, int jstart, int jend)
+{
+    BYTE *imt, *maskt;
+    int nx, bw, bh;
+    int rows;                   /* number of pixel rows in a row of boxes */
+    int bufsize;                /* size of a "row" of boxes in pixels (w*bh) */
+    int imgbufsize;             /* size of a "row" of boxes in pixels (raw_w*bh) for the whole image width */
+    int elsize;                 /* size (in bytes) of an image array element */
+    int melsize;                /* size (in bytes) of a mask array element */
+    PIXTYPE *buf, *buft, *mbuf, *mbuft;
+    PIXTYPE maskthresh;
+    array_converter convert, mconvert;
+    backstruct *backmesh, *bm;  /* info about each background "box" */
+    int j, k, m, status;
+
+    status = RETURN_OK;
+    nx = bkg->nx;
+    bw = bkg->bw;
+    bh = bkg->bh;
+    bufsize = image->w * bh;
+    imgbufsize = image->raw_w * bh;
+    maskthresh = image->maskthresh;
+    if (image->mask == NULL) maskthresh = 0.0;
+
+    backmesh = bm = NULL;
+    buf = mbuf = buft = mbuft = NULL;
+    convert = mconvert = NULL;
+
+    /* Allocate temp memory & initialize */
+    QMALLOC(backmesh, backstruct, nx, status);
+    bm = backmesh;
+    for (m = nx; m--; bm++)
+        bm->histo = NULL;
+
     /* cast input array pointers. These are used to step through the arrays. */
     imt = (BYTE *)image->data;
     maskt = (BYTE *)image->mask;
 
     /* get the correct array converter and element size, based on dtype code */
-    status = get_array_converter(image->dtype, &convert, &elsize);
-    if (status != RETURN_OK)
-        goto exit;
+    if (!image->readline)
+    {
+        status = get_array_converter(image->dtype, &convert, &elsize);
+        if (status != RETURN_OK)
+            goto exit;
+    }
     if (image->mask)
     {
         status = get_array_converter(image->mdtype, &mconvert, &melsize);
@@ -134,21 +176,17 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
             goto exit;
     }
 
-    /* If the input array type is not PIXTYPE, allocate a buffer to hold
-       converted values */
-    if (image->dtype != PIXDTYPE)
+    /* If the input array type is not PIXTYPE, or the lines are read through
+       the image's line reader, allocate a buffer to hold converted values */
+    if (image->readline || image->dtype != PIXDTYPE)
     {
         QMALLOC(buf, PIXTYPE, bufsize, status);
         buft = buf;
-        if (status != RETURN_OK)
-            goto exit;
     }
     if (image->mask && (image->mdtype != PIXDTYPE))
     {
         QMALLOC(mbuf, PIXTYPE, bufsize, status);
         mbuft = mbuf;
-        if (status != RETURN_OK)
-            goto exit;
     }
 
     /* loop over rows of background boxes.
@@ -157,15 +195,28 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
      * arrays.  This is also how it is originally done in SExtractor,
      * because the pixel buffers are only read in from disk in
      * increments of a row of background boxes at a time.)
+     * The image only has to hold the rows jstart to jend, so that
+     * separate bands of rows can be done at the same time.
+     * With a line reader there is no data array, and the rows are read
+     * by their row numbers in the whole image.
      */
-    for (j = 0; j < ny; j++)
+    for (j = jstart; j < jend; j++)
     {
         /* if the last row, modify the width appropriately*/
-        if (j == ny - 1 && npix % bufsize)
-            bufsize = npix % bufsize;
+        rows = bkg->h - j * bh;
+        if (rows > bh)
+            rows = bh;
+        bufsize = image->w * rows;
 
         /* convert this row to PIXTYPE and store in buffer(s)*/
-        if (image->dtype != PIXDTYPE)
+        if (image->readline)
+        {
+            for (k = 0; k < rows; k++)
+                if ((status = image->readline(image->readcontext, j * bh + k, 0, image->w,
+                                              buft + k * image->w)) != RETURN_OK)
+                    goto exit;
+        }
+        else if (image->dtype != PIXDTYPE)
             convert(imt, bufsize, buft);
         else
             buft = (PIXTYPE *)imt;
@@ -195,44 +246,18 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
         for (m = 0; m < nx; m++, bm++)
         {
             k = m + nx * j;
-            backguess(bm, bkgout->back + k, bkgout->sigma + k);
+            backguess(bm, bkg->back + k, bkg->sigma + k);
             free(bm->histo);
             bm->histo = NULL;
         }
 
         /* increment array pointers to next row of background boxes */
-        //        imt += elsize * bufsize;
-        //        if (image->mask)
-        //            maskt += melsize * bufsize;
-        imt += elsize * imgbufsize;
+        if (!image->readline)
+            imt += elsize * imgbufsize;
         if (image->mask)
             maskt += melsize * imgbufsize;
     }
 
-    /* free memory */
-    free(buf);
-    buf = NULL;
-    free(mbuf);
-    mbuf = NULL;
-    free(backmesh);
-    backmesh = NULL;
-
-    /* Median-filter and check suitability of the background map */
-    if ((status = filterback(bkgout, fw, fh, fthresh)) != RETURN_OK)
-        goto exit;
-
-    /* Compute 2nd derivatives along the y-direction */
-    if ((status = makebackspline(bkgout, bkgout->back, bkgout->dback)) !=
-            RETURN_OK)
-        goto exit;
-    if ((status = makebackspline(bkgout, bkgout->sigma, bkgout->dsigma)) !=
-            RETURN_OK)
-        goto exit;
-
-    *bkg = bkgout;
-    return status;
-
-    /* If we encountered a problem, clean up any allocated memory */
 exit:
     free(buf);
     free(mbuf);
@@ -243,11 +268,23 @@ exit:
             free(bm->histo);
     }
     free(backmesh);
-    sep_bkg_free(bkgout);
-    *bkg = NULL;
     return status;
 }
 
+int sep_background_finish(sep_bkg *bkg, int fw, int fh, double fthresh)
+{
+    int status;
+
+    /* Median-filter and check suitability of the background map */
+    if ((status = filterback(bkg, fw, fh, fthresh)) != RETURN_OK)
+        return status;
+
+    /* Compute 2nd derivatives along the y-direction */
+    if ((status = makebackspline(bkg, bkg->back, bkg->dback)) != RETURN_OK)
+        return status;
+    return makebackspline(bkg, bkg->sigma, bkg->dsigma);
+}
+
 /******************************** backstat **********************************/
 /*
 Compute robust statistical estimators in a row of meshes.
@@ -776,7 +813,35 @@ int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
  * (bkg->sigma, bkg->dsigma) depending on whether the background value or rms
  * is being evaluated. */
 {
-    int i, j, x, yl, nbx, nbxm1, nby, nx, width, ystep, changepoint, status;
+    return bkg_line_flt_range(bkg, values, dvalues, y, 0, bkg->w, line, NULL);
+}
+
+/* grow one array of a sep_bkg_linebuf to at least n floats */
+static int linebuf_reserve(float **array, int *size, int n)
+{
+    float *grown;
+    if (*size >= n)
+        return RETURN_OK;
+    grown = (float *)realloc(*array, n * sizeof(float));
+    if (!grown)
+        return MEMORY_ALLOC_ERROR;
+    *array = grown;
+    *size = n;
+    return RETURN_OK;
+}
+
+int bkg_line_flt_range(sep_bkg *bkg, float *values, float *dvalues, int y,
+                       int xstart, int width, float *line,
+                       sep_bkg_linebuf *buf)
+/* Same as bkg_line_flt_internal, but only the pixels xstart to
+ * xstart + width of the line are saved to line.  If buf is given, its
+ * arrays are used for the interpolated nodes instead of allocating them.
+ * The interpolation along x starts at the last node change before xstart
+ * rather than at the start of the line, so the values are the same as for
+ * the whole line. */
+{
+    int i, j, x, yl, nbx, nbxm1, nby, nx, xend, ystep, changepoint, status;
+    int nchanges;
     float	dx, dx0, dy, dy3, cdx, cdy, cdy3, temp, xstep;
     float *nodebuf, *dnodebuf, *u;
     float *node, *nodep, *dnode, *blo, *bhi, *dblo, *dbhi;
@@ -786,7 +851,7 @@ int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
     dnodebuf = dnode = NULL;
     u = NULL;
 
-    width = bkg->w;
+    xend = xstart + width;
     nbx = bkg->nx;
     nbxm1 = nbx - 1;
     nby = bkg->ny;
@@ -813,35 +878,63 @@ int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
         bhi = blo + nbx;
         dblo = dvalues + ystep;
         dbhi = dblo + nbx;
-        QMALLOC(nodebuf, float, nbx, status);  /* Interpolated background */
-        nodep = node = nodebuf;
+        if (buf)
+        {
+            if ((status = linebuf_reserve(&buf->node, &buf->nodesize, nbx)) != RETURN_OK)
+                goto exit;
+            node = buf->node;
+        }
+        else
+        {
+            QMALLOC(nodebuf, float, nbx, status);  /* Interpolated background */
+            node = nodebuf;
+        }
+        nodep = node;
         for (x = nbx; x--;)
             *(nodep++) = cdy**(blo++) + dy**(bhi++) + cdy3**(dblo++) +
                          dy3**(dbhi++);
 
         /*-- Computation of 2nd derivatives along x */
-        QMALLOC(dnodebuf, float, nbx, status);  /* 2nd derivative along x */
-        dnode = dnodebuf;
+        if (buf)
+        {
+            if ((status = linebuf_reserve(&buf->dnode, &buf->dnodesize, nbx)) != RETURN_OK)
+                goto exit;
+            dnode = buf->dnode;
+        }
+        else
+        {
+            QMALLOC(dnodebuf, float, nbx, status);  /* 2nd derivative along x */
+            dnode = dnodebuf;
+        }
         if (nbx > 1)
         {
-            QMALLOC(u, float, nbxm1, status);  /* temporary array */
-            *dnode = *u = 0.0;	/* "natural" lower boundary condition */
+            float *ubuf;
+            if (buf)
+            {
+                if ((status = linebuf_reserve(&buf->u, &buf->usize, nbxm1)) != RETURN_OK)
+                    goto exit;
+                ubuf = buf->u;
+            }
+            else
+            {
+                QMALLOC(u, float, nbxm1, status);  /* temporary array */
+                ubuf = u;
+            }
+            *dnode = *ubuf = 0.0;	/* "natural" lower boundary condition */
             nodep = node + 1;
             for (x = nbxm1; --x; nodep++)
             {
                 temp = -1 / (*(dnode++) + 4);
                 *dnode = temp;
-                temp *= *(u++) - 6 * (*(nodep + 1) + * (nodep - 1) - 2 * *nodep);
-                *u = temp;
+                temp *= *(ubuf++) - 6 * (*(nodep + 1) + * (nodep - 1) - 2 * *nodep);
+                *ubuf = temp;
             }
             *(++dnode) = 0.0;	/* "natural" upper boundary condition */
             for (x = nbx - 2; x--;)
             {
                 temp = *(dnode--);
-                *dnode = (*dnode * temp + * (u--)) / 6.0;
+                *dnode = (*dnode * temp + * (ubuf--)) / 6.0;
             }
-            free(u);
-            u = NULL;
             dnode--;
         }
     }
@@ -864,7 +957,31 @@ int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
         bhi = node + 1;
         dblo = dnode;
         dbhi = dnode + 1;
-        for (x = i = 0, j = width; j--; i++, dx += xstep)
+        x = i = j = 0;
+
+        /* The nodes change at pixel k * nx + changepoint of the line, for
+         * 0 < k < nbxm1, and dx is reset to dx0 there.  Starting at the last
+         * change before xstart gives the same values as starting at 0. */
+        nchanges = 0;
+        if (changepoint > 0 && xstart >= nx + changepoint)
+        {
+            nchanges = (xstart - changepoint) / nx;
+            if (nchanges > nbxm1 - 1)
+                nchanges = nbxm1 - 1;
+        }
+        if (nchanges > 0)
+        {
+            /* the loop moves the nodes on to the last change itself */
+            blo += nchanges - 1;
+            bhi += nchanges - 1;
+            dblo += nchanges - 1;
+            dbhi += nchanges - 1;
+            x = nchanges;
+            i = changepoint;
+            j = nchanges * nx + changepoint;
+        }
+
+        for (; j < xend; j++, i++, dx += xstep)
         {
             if (i == changepoint && x > 0 && x < nbxm1)
             {
@@ -874,10 +991,12 @@ int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
                 dbhi++;
                 dx = dx0;
             }
-            cdx = 1 - dx;
-
-            *(line++) = (float)(cdx * (*blo + (cdx * cdx - 1)**dblo)
-                                + dx * (*bhi + (dx * dx - 1)**dbhi));
+            if (j >= xstart)
+            {
+                cdx = 1 - dx;
+                *(line++) = (float)(cdx * (*blo + (cdx * cdx - 1)**dblo)
+                                    + dx * (*bhi + (dx * dx - 1)**dbhi));
+            }
 
             if (i == nx)
             {
@@ -906,6 +1025,23 @@ int sep_bkg_line_flt(sep_bkg *bkg, int y, float *line)
     return bkg_line_flt_internal(bkg, bkg->back, bkg->dback, y, line);
 }
 
+int sep_bkg_line_flt_range(sep_bkg *bkg, int y, int x, int w, float *line,
+                           sep_bkg_linebuf *buf)
+/* Interpolate the background at the pixels x to x + w of line y */
+{
+    if (x < 0 || w < 0 || x + w > bkg->w)
+        return LINE_NOT_IN_BUF;
+    return bkg_line_flt_range(bkg, bkg->back, bkg->dback, y, x, w, line, buf);
+}
+
+void sep_bkg_linebuf_free(sep_bkg_linebuf *buf)
+{
+    free(buf->node);
+    free(buf->dnode);
+    free(buf->u);
+    memset(buf, 0, sizeof(sep_bkg_linebuf));
+}
+
 /*****************************************************************************/
 
 int sep_bkg_rmsline_flt(sep_bkg *bkg, int y, float *line)
@@ -25,9 +25,49 @@ f* GNU Lesser General Public License for more details.
 
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SEP_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace SEP
 {
 
+/* Multiply n values of src by k and add them to dst.
+ * The SSE2 version does the same multiply and then add for each element as
+ * the plain loop, so the results are identical.  SSE2 is always there on
+ * x86-64, so it doesn't need to be checked for. */
+static inline void multiply_add(PIXTYPE *dst, const PIXTYPE *src, float k, int n)
+{
+    int i = 0;
+#ifdef SEP_USE_SSE2
+    __m128 kv = _mm_set1_ps(k);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+                                          _mm_mul_ps(kv, _mm_loadu_ps(src + i))));
+#endif
+    for (; i < n; i++)
+        dst[i] += k * src[i];
+}
+
+/* Convolve one line with a one dimensional kernel.  Values past the ends of
+ * the line count as zero, the same as in convolve(). */
+static void convolve_line(PIXTYPE *line, float *conv, int convw, PIXTYPE *out, int n)
+{
+    int cx, dcx, convw2;
+
+    convw2 = convw / 2;
+    memset(out, 0, n * sizeof(PIXTYPE));
+    for (cx = 0; cx < convw; cx++)
+    {
+        dcx = cx - convw2;
+        if (dcx >= 0)
+            multiply_add(out, line + dcx, conv[cx], n - dcx);
+        else
+            multiply_add(out - dcx, line, conv[cx], n + dcx);
+    }
+}
+
 /* Convolve one line of an image with a given kernel.
  *
  * buf : arraybuffer struct containing buffer of data to convolve, and image
@@ -91,8 +131,100 @@ int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE
         }
 
         /* multiply and add the values */
-        while (dst < dstend)
-            *(dst++) += conv[i] * *(src++);
+        if (dst < dstend)
+            multiply_add(dst, src, conv[i], dstend - dst);
+    }
+
+    return RETURN_OK;
+}
+
+
+/* Check if a kernel is the outer product of a column and a row, which is
+ * true for the gaussian kernels.  If it is, convy and convx (convh and convw
+ * elements long) are filled in and 1 is returned. */
+int separate_kernel(float *conv, int convw, int convh, float *convx, float *convy)
+{
+    int i, j, px, py;
+    float maxval, pivot;
+
+    /* use the largest value of the kernel to split it */
+    px = py = 0;
+    maxval = 0.0;
+    for (j = 0; j < convh; j++)
+        for (i = 0; i < convw; i++)
+            if (fabs(conv[j * convw + i]) > maxval)
+            {
+                maxval = fabs(conv[j * convw + i]);
+                px = i;
+                py = j;
+            }
+    if (maxval == 0.0)
+        return 0;
+
+    pivot = conv[py * convw + px];
+    for (j = 0; j < convh; j++)
+        convy[j] = conv[j * convw + px];
+    for (i = 0; i < convw; i++)
+        convx[i] = conv[py * convw + i] / pivot;
+
+    for (j = 0; j < convh; j++)
+        for (i = 0; i < convw; i++)
+            if (fabs(conv[j * convw + i] - convy[j] * convx[i]) > 1e-6 * maxval)
+                return 0;
+    return 1;
+}
+
+
+/* Convolve one line of an image with a separable kernel, as two one
+ * dimensional passes.  Each line of the image is convolved along x once,
+ * when it is first needed, and kept in hlines for the next convh output
+ * lines, so each output pixel takes convw + convh multiply-adds instead of
+ * convw * convh.
+ *
+ * hlines : convh lines of buf->bw - 1 elements each
+ * hlineids : the image line in each of the hlines, all -1 to start with
+ */
+int convolve_separable(arraybuffer *buf, int y, float *convx, int convw,
+                       float *convy, int convh, PIXTYPE *hlines,
+                       int *hlineids, PIXTYPE *out)
+{
+    int cy, y0, n, slot, nslots, liney;
+    PIXTYPE *hline;
+
+    n = buf->bw - 1;
+    nslots = convh;
+    y0 = y - convh / 2; /* start line in image */
+
+    /* Cut off top of kernel if it extends beyond image */
+    if (y0 + convh > buf->dh)
+        convh = buf->dh - y0;
+
+    /* cut off bottom of kernel if it extends beyond image */
+    if (y0 < 0)
+    {
+        convh = convh + y0;
+        convy += (-y0);
+        y0 = 0;
+    }
+
+    /* check that buffer has needed lines */
+    if ((y0 < buf->yoff) || (y0 + convh > buf->yoff + buf->bh))
+        return LINE_NOT_IN_BUF;
+
+    memset(out, 0, n * sizeof(PIXTYPE)); /* initialize output to zero */
+
+    for (cy = 0; cy < convh; cy++)
+    {
+        liney = y0 + cy;
+        slot = liney % nslots;
+        hline = hlines + slot * n;
+        if (hlineids[slot] != liney)
+        {
+            convolve_line(buf->bptr + buf->bw * (liney - buf->yoff), convx, convw,
+                          hline, n);
+            hlineids[slot] = liney;
+        }
+        multiply_add(out, hline, convy[cy], n);
     }
 
     return RETURN_OK;
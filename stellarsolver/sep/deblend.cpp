@@ -38,7 +38,7 @@
 namespace SEP
 {
 
-Deblend::Deblend(int deblend_nthresh, const plistvalues &values)
+Deblend::Deblend(int deblend_nthresh, const plistvalues &values) : random(1)
 {
     allocdeblend(deblend_nthresh);
     plistsize = values.plistsize;
@@ -73,12 +73,15 @@ int Deblend::deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
     status = RETURN_OK;
     xn = deblend_nthresh;
 
-    /* reset global static objlist for deblending */
-    memset(objlist, 0, (size_t)xn * sizeof(objliststruct));
+    /* empty the object lists for deblending; objlist and debobjlist2 keep
+     * their arrays from the last object, so they are only allocated again
+     * when an object needs more room */
+    for (k = 0; k < xn; k++)
+        objlist[k].nobj = objlist[k].npix = 0;
 
     /* initialize local object lists */
-    debobjlist.obj = debobjlist2.obj =  NULL;
-    debobjlist.plist = debobjlist2.plist = NULL;
+    debobjlist.obj = NULL;
+    debobjlist.plist = NULL;
     debobjlist.nobj = debobjlist2.nobj = 0;
     debobjlist.npix = debobjlist2.npix = 0;
 
@@ -98,9 +101,10 @@ int Deblend::deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
     objlistout->thresh = debobjlist2.thresh = thresh0;
 
     /* add input object to global deblending objlist and one local objlist */
-    if ((status = addobjdeep(l, objlistin, &objlist[0], plistsize)) != RETURN_OK)
+    if ((status = addobjlist(l, objlistin, 0)) != RETURN_OK)
         goto exit;
-    if ((status = addobjdeep(l, objlistin, &debobjlist2, plistsize)) != RETURN_OK)
+    if ((status = addobjdeep_buffered(l, objlistin, &debobjlist2, plistsize,
+                                      &debobjlist2_objsize, &debobjlist2_npixsize)) != RETURN_OK)
         goto exit;
 
     value0 = objlist[0].obj[0].fdflux * deblend_mincont;
@@ -129,8 +133,7 @@ int Deblend::deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
                 if (belong(j, &debobjlist, i, &objlist[k - 1]))
                 {
                     debobjlist.obj[j].thresh = debobjlist.thresh;
-                    if ((status = addobjdeep(j, &debobjlist, &objlist[k], plistsize))
-                            != RETURN_OK)
+                    if ((status = addobjlist(j, &debobjlist, k)) != RETURN_OK)
                         goto exit;
                     m = objlist[k].nobj - 1;
                     if (m >= NSONMAX)
@@ -171,7 +174,8 @@ int Deblend::deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
                             obj[j].fdflux - obj[j].thresh * obj[j].fdnpix > value0)
                     {
                         objlist[k + 1].obj[j].flag |= SEP_OBJ_MERGED;
-                        status = addobjdeep(j, &objlist[k + 1], &debobjlist2, plistsize);
+                        status = addobjdeep_buffered(j, &objlist[k + 1], &debobjlist2, plistsize,
+                                                     &debobjlist2_objsize, &debobjlist2_npixsize);
                         if (status != RETURN_OK)
                             goto exit;
                     }
@@ -194,17 +198,10 @@ exit:
 
     free(submap);
     submap = nullptr;
-    free(debobjlist2.obj);
-    free(debobjlist2.plist);
-
-    for (k = 0; k < xn; k++)
-    {
-        free(objlist[k].obj);
-        free(objlist[k].plist);
-    }
 
-    free(debobjlist.obj);
-    free(debobjlist.plist);
+    /* debobjlist points into the buffers of lutz, which keeps them */
+    debobjlist.obj = NULL;
+    debobjlist.plist = NULL;
 
     return status;
 }
@@ -219,7 +216,10 @@ int Deblend::allocdeblend(int deblend_nthresh)
     int status = RETURN_OK;
     QMALLOC(son, short,  deblend_nthresh * NSONMAX * NBRANCH, status);
     QMALLOC(ok, short,  deblend_nthresh * NSONMAX, status);
-    QMALLOC(objlist, objliststruct, deblend_nthresh, status);
+    QCALLOC(objlist, objliststruct, deblend_nthresh, status);
+    QCALLOC(objlistobjsize, int, deblend_nthresh, status);
+    QCALLOC(objlistnpixsize, int, deblend_nthresh, status);
+    nthresh = deblend_nthresh;
 
     return status;
 exit:
@@ -237,11 +237,37 @@ void Deblend::freedeblend(void)
     son = NULL;
     free(ok);
     ok = NULL;
+    if (objlist)
+        for (int k = 0; k < nthresh; k++)
+        {
+            free(objlist[k].obj);
+            free(objlist[k].plist);
+        }
     free(objlist);
     objlist = NULL;
+    free(objlistobjsize);
+    objlistobjsize = NULL;
+    free(objlistnpixsize);
+    objlistnpixsize = NULL;
+    nthresh = 0;
+    free(debobjlist2.obj);
+    free(debobjlist2.plist);
+    debobjlist2.obj = NULL;
+    debobjlist2.plist = NULL;
+    debobjlist2_objsize = debobjlist2_npixsize = 0;
     return;
 }
 
+/******************************** addobjlist *******************************/
+/*
+Add object `objnb` of `objl` to the deblending objlist of threshold `k`.
+*/
+int Deblend::addobjlist(int objnb, objliststruct *objl, int k)
+{
+    return addobjdeep_buffered(objnb, objl, &objlist[k], plistsize,
+                               &objlistobjsize[k], &objlistnpixsize[k]);
+}
+
 /********************************* gatherup **********************************/
 /*
 Collect faint remaining pixels and allocate them to their most probable
@@ -264,6 +290,7 @@ int Deblend::gatherup(objliststruct *objlistin, objliststruct *objlistout)
     status = RETURN_OK;
 
     objlistout->thresh = objlistin->thresh;
+    random.seed(1);
 
     amp = static_cast<float *>(malloc(nobj * sizeof(float)));
     p = static_cast<float *>(malloc(nobj * sizeof(float)));
@@ -343,7 +370,7 @@ int Deblend::gatherup(objliststruct *objlistin, objliststruct *objlistout)
             }
             if (p[nobj - 1] > 1.0e-31)
             {
-                drand = p[nobj - 1] * rand() / RAND_MAX;
+                drand = p[nobj - 1] * (random() - random.min()) / (random.max() - random.min());
                 for (i = 1; i < nobj && p[i] < drand; i++);
                 if (i == nobj)
                     i = iclst;
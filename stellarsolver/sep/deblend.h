@@ -25,6 +25,7 @@
 #include "sep.h"
 #include "sepcore.h"
 
+#include <random>
 
 namespace SEP
 {
@@ -46,6 +47,7 @@ class Deblend
         int belong(int, objliststruct *, int, objliststruct *);
         int *createsubmap(objliststruct *, int, int *, int *, int *, int *);
         int gatherup(objliststruct *, objliststruct *);
+        int addobjlist(int objnb, objliststruct *objl, int k);
 
 
     private:
@@ -55,10 +57,22 @@ class Deblend
 
         objliststruct *objlist = nullptr;
         short *son = nullptr, *ok = nullptr;
+        /* The allocated sizes of the arrays of each objlist, in objects and
+         * in pixels.  The arrays are kept from one object to the next. */
+        int *objlistobjsize = nullptr, *objlistnpixsize = nullptr;
+        int nthresh = 0;
 
-        objliststruct	debobjlist, debobjlist2;
+        objliststruct	debobjlist, debobjlist2 = {};
+        int debobjlist2_objsize = 0, debobjlist2_npixsize = 0;
         plistvalues plist_values;
         int plistsize;
+
+        /* Each deblender has its own generator for gatherup(), so that
+         * extractions running in parallel on other threads neither change
+         * each other's results nor wait on the lock around the C library's
+         * rand().  It is seeded again for every object, so an object is
+         * deblended the same way whichever partition of the image finds it. */
+        std::minstd_rand random;
 };
 
 }
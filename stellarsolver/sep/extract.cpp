@@ -21,6 +21,7 @@
 *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
 
 #include "extract.h"
+#include "extractcontext.h"
 #include "lutz.h"
 #include "deblend.h"
 #include "analyse.h"
@@ -46,8 +47,9 @@ Extract::~Extract()
 
 /* initialize buffer */
 /* bufw must be less than or equal to w */
+/* if linereader is given, the lines are read through it and arr and dtype are not used */
 int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                              int bufw, int bufh)
+                              int bufw, int bufh, sep_line_reader linereader, void *readcontext)
 {
     int status, yl;
     status = RETURN_OK;
@@ -56,6 +58,8 @@ int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int
     buf->dptr = reinterpret_cast<unsigned char *>(arr);
     buf->dw = w;
     buf->dh = h;
+    buf->linereader = linereader;
+    buf->readcontext = readcontext;
 
     /* buffer array info */
     buf->bptr = NULL;
@@ -67,16 +71,25 @@ int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int
     buf->midline = buf->bptr + bufw * (bufh / 2); /* ptr to middle buffer line */
     buf->lastline = buf->bptr + bufw * (bufh - 1); /* ptr to last buffer line */
 
-    status = get_array_converter(dtype, &(buf->readline), &(buf->elsize));
-    if (status != RETURN_OK)
-        goto exit;
+    if (linereader)
+    {
+        buf->readline = NULL;
+        buf->elsize = sizeof(PIXTYPE);
+    }
+    else
+    {
+        status = get_array_converter(dtype, &(buf->readline), &(buf->elsize));
+        if (status != RETURN_OK)
+            goto exit;
+    }
 
     /* initialize yoff */
     buf->yoff = -bufh;
 
     /* read in lines until the first data line is one line above midline */
     for (yl = 0; yl < bufh - bufh / 2 - 1; yl++)
-        arraybuffer_readline(buf);
+        if ((status = arraybuffer_readline(buf)) != RETURN_OK)
+            goto exit;
 
     return status;
 
@@ -86,8 +99,9 @@ exit:
     return status;
 }
 
-/* read a line into the buffer at the top, shifting all lines down one */
-void Extract::arraybuffer_readline(arraybuffer *buf)
+/* read a line into the buffer at the top, shifting all lines down one.
+ * Returns the status of the line reader, if there is one. */
+int Extract::arraybuffer_readline(arraybuffer *buf)
 {
     PIXTYPE *line;
     int y;
@@ -105,10 +119,15 @@ void Extract::arraybuffer_readline(arraybuffer *buf)
     //                      buf->lastline);
 
     if (y < buf->dh)
-        buf->readline(buf->dptr + buf->elsize * buf->dw * y, buf->bw - 1,
-                      buf->lastline);
+    {
+        if (buf->linereader)
+            return buf->linereader(buf->readcontext, y, 0, buf->bw - 1, buf->lastline);
+        else
+            buf->readline(buf->dptr + buf->elsize * buf->dw * y, buf->bw - 1,
+                          buf->lastline);
+    }
 
-    return;
+    return RETURN_OK;
 }
 
 void Extract::arraybuffer_free(arraybuffer *buf)
@@ -179,15 +198,22 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     char              *marker;
     PIXTYPE           *scan, *cdscan, *wscan, *dummyscan;
     PIXTYPE           *sigscan, *workscan;
-    float             *convnorm;
+    float             *convnorm, *convx, *convy;
+    PIXTYPE           *hlines;
+    int               *hlineids;
+    int               separable;
     int               *start, *end, *survives;
     pixstatus         *psstack;
     char              errtext[512];
     sep_catalog       *cat;
+    Lutz              *lutz;
 
     status = RETURN_OK;
     pixel = NULL;
-    convnorm = NULL;
+    convnorm = convx = convy = NULL;
+    hlines = NULL;
+    hlineids = NULL;
+    separable = 0;
     scan = wscan = cdscan = dummyscan = NULL;
     sigscan = workscan = NULL;
     info = NULL;
@@ -210,9 +236,11 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
     mem_pixstack = sep_get_extract_pixstack();
 
-    /* seed the random number generator consistently on each call to get
-     * consistent results. rand() is used in deblending. */
-    srand(1);
+    if (!extract_context)
+    {
+        own_context.reset(new ExtractContext());
+        extract_context = own_context.get();
+    }
 
     /* Noise characteristics of the image: None, scalar or variable? */
     if (image->noise_type == SEP_NOISE_NONE) { } /* nothing to do */
@@ -265,15 +293,20 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     /* this is input `thresh` regardless of thresh_type. */
     objlist.thresh = thresh;
 
-    /*Allocate memory for buffers */
+    /* Take the buffers from the context, store and start have to start out
+     * zeroed */
     stacksize = w + 1;
-    QMALLOC(info, infostruct, stacksize, status);
-    QCALLOC(store, infostruct, stacksize, status);
-    QMALLOC(marker, char, stacksize, status);
-    QMALLOC(dummyscan, PIXTYPE, stacksize, status);
-    QMALLOC(psstack, pixstatus, stacksize, status);
-    QCALLOC(start, int, stacksize, status);
-    QMALLOC(end, int, stacksize, status);
+    status = extract_context->reserve_lines(stacksize);
+    if (status != RETURN_OK) goto exit;
+    info = extract_context->info;
+    store = extract_context->store;
+    marker = extract_context->marker;
+    dummyscan = extract_context->dummyscan;
+    psstack = extract_context->psstack;
+    start = extract_context->start;
+    end = extract_context->end;
+    memset(store, 0, stacksize * sizeof(infostruct));
+    memset(start, 0, stacksize * sizeof(int));
 
     //    if ((status = lutzalloc(w, h)) != RETURN_OK)
     //        goto exit;
@@ -287,7 +320,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
      */
     bufh = conv ? convh : 1;
     status = arraybuffer_init(&dbuf, image->data, image->dtype, image->raw_w, h, stacksize,
-                              bufh);
+                              bufh, image->readline, image->readcontext);
     if (status != RETURN_OK) goto exit;
     if (isvarnoise)
     {
@@ -331,13 +364,12 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     finalobjlist->nobj = finalobjlist->npix = 0;
 
 
-    /* Allocate memory for the pixel list */
+    /* Take the pixel list from the context */
     plistinit((conv != NULL), (image->noise_type != SEP_NOISE_NONE));
-    if (!(pixel = objlist.plist = (pliststruct *)malloc(nposize = mem_pixstack * plistsize)))
-    {
-        status = MEMORY_ALLOC_ERROR;
-        goto exit;
-    }
+    nposize = mem_pixstack * plistsize;
+    status = extract_context->reserve_pixels(nposize);
+    if (status != RETURN_OK) goto exit;
+    pixel = objlist.plist = extract_context->pixel;
 
     /*----- at the beginning, "free" object fills the whole pixel list */
     freeinfo.firstpix = 0;
@@ -369,6 +401,21 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
             sum += fabs(conv[i]);
         for (i = 0; i < convn; i++)
             convnorm[i] = conv[i] / sum;
+
+        /* A separable kernel can be applied as two one dimensional passes */
+        if (separable_filter && filter_type == SEP_FILTER_CONV)
+        {
+            QMALLOC(convx, float, convw, status);
+            QMALLOC(convy, float, convh, status);
+            separable = separate_kernel(convnorm, convw, convh, convx, convy);
+            if (separable)
+            {
+                QMALLOC(hlines, PIXTYPE, convh * (stacksize - 1), status);
+                QMALLOC(hlineids, int, convh, status);
+                for (i = 0; i < convh; i++)
+                    hlineids[i] = -1;
+            }
+        }
     }
 
     plist_values.plistexist_cdvalue = plistexist_cdvalue;
@@ -380,9 +427,8 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     plist_values.plistoff_var = plistoff_var;
     plist_values.plistsize = plistsize;
 
-    analyze.reset(new Analyze(plist_values));
-    lutz.reset(new Lutz(image->w, image->h, analyze.get(), plist_values));
-    deblend.reset(new Deblend(deblend_nthresh, plist_values));
+    extract_context->prepare(image->w, image->h, deblend_nthresh, plist_values);
+    lutz = extract_context->lutz.get();
 
 
     /*----- MAIN LOOP ------ */
@@ -411,7 +457,8 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
         else
         {
-            arraybuffer_readline(&dbuf);
+            if ((status = arraybuffer_readline(&dbuf)) != RETURN_OK)
+                goto exit;
             if (isvarnoise)
                 arraybuffer_readline(&nbuf);
             if (image->mask)
@@ -423,7 +470,11 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
             /* filter the lines */
             if (conv)
             {
-                status = convolve(&dbuf, yl, convnorm, convw, convh, cdscan);
+                if (separable)
+                    status = convolve_separable(&dbuf, yl, convx, convw, convy, convh,
+                                                hlines, hlineids, cdscan);
+                else
+                    status = convolve(&dbuf, yl, convnorm, convw, convh, cdscan);
                 if (status != RETURN_OK)
                     goto exit;
 
@@ -543,12 +594,14 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
                     mem_pixstack = (int)(mem_pixstack * 2);
                     nposize = mem_pixstack * plistsize;
                     pixel = (pliststruct *)realloc(pixel, nposize);
-                    objlist.plist = pixel;
+                    objlist.plist = extract_context->pixel = pixel;
                     if (!pixel)
                     {
+                        extract_context->pixelsize = 0;
                         status = MEMORY_ALLOC_ERROR;
                         goto exit;
                     }
+                    extract_context->pixelsize = nposize;
 
                     /* set next free pixel to the start of the new block
                      * and link up all the pixels in the new block */
@@ -697,7 +750,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
         /* Calculate mthresh for all objects in the list (needed for cleaning) */
         for (i = 0; i < finalobjlist->nobj; i++)
         {
-            status = analyze->analysemthresh(i, finalobjlist, minarea, thresh);
+            status = extract_context->analyze->analysemthresh(i, finalobjlist, minarea, thresh);
             if (status != RETURN_OK)
                 goto exit;
         }
@@ -720,14 +773,6 @@ exit:
             free(finalobjlist->plist);
         free(finalobjlist);
     }
-    free(pixel);
-    free(info);
-    free(store);
-    free(marker);
-    free(dummyscan);
-    free(psstack);
-    free(start);
-    free(end);
     free(survives);
     arraybuffer_free(&dbuf);
     if (image->noise)
@@ -736,6 +781,10 @@ exit:
         arraybuffer_free(&mbuf);
     if (conv)
         free(convnorm);
+    free(convx);
+    free(convy);
+    free(hlines);
+    free(hlineids);
     if (filter_type == SEP_FILTER_MATCHED)
     {
         free(sigscan);
@@ -784,9 +833,10 @@ int Extract::sortit(infostruct *info, objliststruct *objlist, int minarea, objli
     obj.flag = info->flag;
     obj.thresh = objlist->thresh;
 
-    analyze->preanalyse(0, objlist);
+    extract_context->analyze->preanalyse(0, objlist);
 
-    status = deblend->deblend(objlist, 0, &objlistout, deblend_nthresh, deblend_mincont, minarea, lutz.get());
+    status = extract_context->deblend->deblend(objlist, 0, &objlistout, deblend_nthresh, deblend_mincont, minarea,
+                                              extract_context->lutz.get());
     if (status)
     {
         /* formerly, this wasn't a fatal error, so a flag was set for
@@ -804,7 +854,7 @@ int Extract::sortit(infostruct *info, objliststruct *objlist, int minarea, objli
     /* Analyze the deblended objects and add to the final list */
     for (i = 0; i < objlist2->nobj; i++)
     {
-        analyze->analyse(i, objlist2, 1, gain);
+        extract_context->analyze->analyse(i, objlist2, 1, gain);
 
         /* this does nothing if DETECT_MAXAREA is 0 (and it currently is) */
         if (DETECT_MAXAREA && objlist2->obj[i].fdnpix > DETECT_MAXAREA)
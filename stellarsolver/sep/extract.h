@@ -31,9 +31,7 @@
 namespace SEP
 {
 
-class Lutz;
-class Deblend;
-class Analyze;
+class ExtractContext;
 
 class Extract
 {
@@ -48,6 +46,23 @@ class Extract
                         int clean_flag, double clean_param,
                         sep_catalog **catalog);
 
+        /* Apply separable kernels as two one dimensional passes.  This is much
+         * faster for large kernels, but the sums are done in a different order,
+         * so the results can differ in the last bits.  It is off by default. */
+        void sep_set_separable_filter(bool enabled)
+        {
+            separable_filter = enabled;
+        }
+
+        /* Take the working memory of the extraction from this context and
+         * leave it there afterwards, so it can be reused for the next image.
+         * The context is not owned by the Extract object.  Without one, the
+         * Extract object makes its own the first time it is used. */
+        void sep_set_extract_context(ExtractContext *context)
+        {
+            extract_context = context;
+        }
+
         static void free_catalog_fields(sep_catalog *catalog);
         static void sep_catalog_free(sep_catalog *catalog);
 
@@ -72,15 +87,14 @@ class Extract
 
 
         int arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                             int bufw, int bufh);
-        void arraybuffer_readline(arraybuffer *buf);
+                             int bufw, int bufh, sep_line_reader linereader = NULL, void *readcontext = NULL);
+        int arraybuffer_readline(arraybuffer *buf);
         void arraybuffer_free(arraybuffer *buf);
 
     private:
 
-        std::unique_ptr<Deblend> deblend;
-        std::unique_ptr<Lutz> lutz;
-        std::unique_ptr<Analyze> analyze;
+        std::unique_ptr<ExtractContext> own_context;
+        ExtractContext *extract_context = nullptr;
 
         int convert_to_catalog(objliststruct *objlist, int *survives, sep_catalog *cat, int w, int include_pixels);
         void apply_mask_line(arraybuffer *mbuf, arraybuffer *imbuf, arraybuffer *nbuf);
@@ -89,6 +103,7 @@ class Extract
         int plistoff_value, plistoff_cdvalue, plistoff_thresh, plistoff_var;
         int plistsize;
         size_t extract_pixstack = 300000;
+        bool separable_filter = false;
         plistvalues plist_values;
         objstruct obj;
 };
@@ -0,0 +1,123 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+* This file is part of SEP
+*
+* Copyright 1993-2011 Emmanuel Bertin -- IAP/CNRS/UPMC
+* Copyright 2014 SEP developers
+*
+* SEP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SEP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with SEP.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "extractcontext.h"
+#include "lutz.h"
+#include "deblend.h"
+#include "analyse.h"
+
+#include <cstdlib>
+
+namespace SEP
+{
+
+ExtractContext::ExtractContext()
+{
+    memset(&plist_values, 0, sizeof(plistvalues));
+}
+
+ExtractContext::~ExtractContext()
+{
+    free_lines();
+    free(pixel);
+}
+
+void ExtractContext::free_lines()
+{
+    free(info);
+    free(store);
+    free(marker);
+    free(dummyscan);
+    free(psstack);
+    free(start);
+    free(end);
+    info = store = NULL;
+    marker = NULL;
+    dummyscan = NULL;
+    psstack = NULL;
+    start = end = NULL;
+    linesize = 0;
+}
+
+int ExtractContext::reserve_lines(int stacksize)
+{
+    int status = RETURN_OK;
+
+    if (stacksize <= linesize)
+        return RETURN_OK;
+
+    free_lines();
+    QMALLOC(info, infostruct, stacksize, status);
+    QMALLOC(store, infostruct, stacksize, status);
+    QMALLOC(marker, char, stacksize, status);
+    QMALLOC(dummyscan, PIXTYPE, stacksize, status);
+    QMALLOC(psstack, pixstatus, stacksize, status);
+    QMALLOC(start, int, stacksize, status);
+    QMALLOC(end, int, stacksize, status);
+    linesize = stacksize;
+
+    return status;
+
+exit:
+    free_lines();
+    return status;
+}
+
+int ExtractContext::reserve_pixels(size_t size)
+{
+    if (size <= pixelsize)
+        return RETURN_OK;
+
+    free(pixel);
+    if (!(pixel = (pliststruct *)malloc(size)))
+    {
+        pixelsize = 0;
+        return MEMORY_ALLOC_ERROR;
+    }
+    pixelsize = size;
+    return RETURN_OK;
+}
+
+void ExtractContext::prepare(int w, int h, int nthresh, const plistvalues &values)
+{
+    /* Lutz keeps a pointer to the Analyze object, so it is made again with it */
+    if (!analyze || memcmp(&values, &plist_values, sizeof(plistvalues)) != 0)
+    {
+        plist_values = values;
+        analyze.reset(new Analyze(plist_values));
+        lutz.reset();
+        deblend.reset();
+    }
+    if (!lutz || w != lutz_w || h != lutz_h)
+    {
+        lutz.reset(new Lutz(w, h, analyze.get(), plist_values));
+        lutz_w = w;
+        lutz_h = h;
+    }
+    if (!deblend || nthresh != deblend_nthresh)
+    {
+        deblend.reset(new Deblend(nthresh, plist_values));
+        deblend_nthresh = nthresh;
+    }
+}
+
+}
@@ -0,0 +1,83 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+* This file is part of SEP
+*
+* Copyright 1993-2011 Emmanuel Bertin -- IAP/CNRS/UPMC
+* Copyright 2014 SEP developers
+*
+* SEP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SEP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with SEP.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#pragma once
+
+#include "sep.h"
+#include "sepcore.h"
+
+#include <memory>
+
+namespace SEP
+{
+
+class Lutz;
+class Deblend;
+class Analyze;
+
+/* The working memory of Extract::sep_extract(): the line arrays, the pixel
+ * stack, and the Analyze, Lutz and Deblend objects with their own buffers.
+ * An extraction given a context takes all of these from it instead of
+ * allocating them, and leaves them there for the next one.  The buffers only
+ * grow, so once a context has been used for a frame, later frames of the same
+ * size and settings don't allocate any of them.
+ *
+ * A context must only be used by one extraction at a time. */
+class ExtractContext
+{
+    public:
+        ExtractContext();
+        ~ExtractContext();
+
+        ExtractContext(const ExtractContext &) = delete;
+        ExtractContext &operator=(const ExtractContext &) = delete;
+
+    private:
+        friend class Extract;
+
+        /* make sure the line arrays hold at least stacksize elements */
+        int reserve_lines(int stacksize);
+        /* make sure the pixel stack holds at least size bytes */
+        int reserve_pixels(size_t size);
+        /* make the Analyze, Lutz and Deblend objects for these settings, or
+         * keep the ones from the last extraction if they were the same */
+        void prepare(int w, int h, int deblend_nthresh, const plistvalues &values);
+        void free_lines();
+
+        infostruct  *info = nullptr, *store = nullptr;
+        char        *marker = nullptr;
+        PIXTYPE     *dummyscan = nullptr;
+        pixstatus   *psstack = nullptr;
+        int         *start = nullptr, *end = nullptr;
+        int         linesize = 0;
+
+        pliststruct *pixel = nullptr;
+        size_t      pixelsize = 0;
+
+        std::unique_ptr<Analyze> analyze;
+        std::unique_ptr<Lutz> lutz;
+        std::unique_ptr<Deblend> deblend;
+        int lutz_w = 0, lutz_h = 0, deblend_nthresh = 0;
+        plistvalues plist_values;
+};
+
+}
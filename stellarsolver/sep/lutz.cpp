@@ -46,6 +46,8 @@ Lutz::Lutz(int width, int height, Analyze *a, const plistvalues &values)
 Lutz::~Lutz()
 {
     lutzfree();
+    free(objbuf);
+    free(plistbuf);
 }
 
 /******************************* lutzalloc ***********************************/
@@ -108,6 +110,8 @@ void Lutz::lutzfree()
 /*
 C implementation of R.K LUTZ' algorithm for the extraction of 8-connected pi-
 xels in an image
+The object and pixel lists of objlist point into buffers owned by this Lutz
+object, they are only valid until the next call and must not be freed.
 */
 int Lutz::lutz(pliststruct *plistin,
                int *objrootsubmap, int subx, int suby, int subw,
@@ -119,8 +123,9 @@ int Lutz::lutz(pliststruct *plistin,
     char			newmarker;
     int			cn, co, luflag, pstop, xl, xl2, yl,
                 out, deb_maxarea, stx, sty, enx, eny, step,
-                nobjm = NOBJ,
+                nobjm,
                 inewsymbol, *iscan;
+    size_t		plistneeded;
     short		        trunflag;
     PIXTYPE		thresh;
     pixstatus		cs, ps;
@@ -145,27 +150,38 @@ int Lutz::lutz(pliststruct *plistin,
     step = subw - (++enx - stx);
     eny++;
 
-    /*------Allocate memory to store object data */
-    free(objlist->obj);
-
-    if (!(obj = objlist->obj = (objstruct *)malloc(nobjm * sizeof(objstruct))))
+    /*------Make sure there is memory to store object data */
+    if (objbufsize < (int)NOBJ)
     {
-        out = MEMORY_ALLOC_ERROR;
-        plist = NULL;			/* To avoid gcc -Wall warnings */
-        goto exit_lutz;
+        free(objbuf);
+        if (!(objbuf = (objstruct *)malloc(NOBJ * sizeof(objstruct))))
+        {
+            objbufsize = 0;
+            objlist->obj = NULL;
+            objlist->plist = NULL;
+            return MEMORY_ALLOC_ERROR;
+        }
+        objbufsize = NOBJ;
     }
+    obj = objlist->obj = objbuf;
+    nobjm = objbufsize;
 
-    /*------Allocate memory for the pixel list */
-    free(objlist->plist);
-    if (!(objlist->plist
-            = (pliststruct *)malloc((eny - sty) * (enx - stx) * plistsize)))
+    /*------Make sure there is memory for the pixel list */
+    plistneeded = (size_t)(eny - sty) * (enx - stx) * plistsize;
+    if (plistbufsize < plistneeded)
     {
-        out = MEMORY_ALLOC_ERROR;
-        plist = NULL;			/* To avoid gcc -Wall warnings */
-        goto exit_lutz;
+        free(plistbuf);
+        if (!(plistbuf = (pliststruct *)malloc(plistneeded)))
+        {
+            plistbufsize = 0;
+            objlist->obj = NULL;
+            objlist->plist = NULL;
+            return MEMORY_ALLOC_ERROR;
+        }
+        plistbufsize = plistneeded;
     }
 
-    pixel = plist = objlist->plist;
+    pixel = plist = objlist->plist = plistbuf;
 
     /*----------------------------------------*/
     for (xl = stx; xl <= enx; xl++)
@@ -272,13 +288,17 @@ int Lutz::lutz(pliststruct *plistin,
                             if ((int)info[co].pixnb >= deb_maxarea)
                             {
                                 if (objlist->nobj >= nobjm)
-                                    if (!(obj = objlist->obj = (objstruct *)
-                                                               realloc(obj, (nobjm += nobjm / 2) *
-                                                                       sizeof(objstruct))))
+                                {
+                                    if (!(obj = (objstruct *)
+                                                realloc(objbuf, (nobjm += nobjm / 2) *
+                                                        sizeof(objstruct))))
                                     {
                                         out = MEMORY_ALLOC_ERROR;
                                         goto exit_lutz;
                                     }
+                                    objlist->obj = objbuf = obj;
+                                    objbufsize = nobjm;
+                                }
                                 lutzsort(&info[co], objlist);
                             }
                         }
@@ -321,28 +341,13 @@ int Lutz::lutz(pliststruct *plistin,
 
 exit_lutz:
 
-    if (objlist->nobj && out == RETURN_OK)
-    {
-        if (!(objlist->obj =
-                    (objstruct *)realloc(obj, objlist->nobj * sizeof(objstruct))))
-            out = MEMORY_ALLOC_ERROR;
-    }
-    else
-    {
-        free(obj);
+    /* the buffers are kept for the next call, they are just not handed out
+     * when there is nothing in them */
+    if (!objlist->nobj || out != RETURN_OK)
         objlist->obj = NULL;
-    }
 
-    if (cn && out == RETURN_OK)
-    {
-        if (!(objlist->plist = (pliststruct *)realloc(plist, cn)))
-            out = MEMORY_ALLOC_ERROR;
-    }
-    else
-    {
-        free(objlist->plist);
+    if (!cn || out != RETURN_OK)
         objlist->plist = NULL;
-    }
 
     return out;
 }
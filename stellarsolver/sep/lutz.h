@@ -61,6 +61,14 @@ class Lutz
 
         Analyze *analyzer {nullptr};
 
+        /* The object list and pixel list that lutz() fills in.  They belong
+         * to the Lutz object and are only grown, never shrunk, so deblending
+         * one object after another doesn't allocate them again each time. */
+        objstruct   *objbuf = nullptr;
+        int         objbufsize = 0;
+        pliststruct *plistbuf = nullptr;
+        size_t      plistbufsize = 0;
+
         static const uint32_t NOBJ {256};
 };
 
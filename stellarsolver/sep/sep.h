@@ -61,10 +61,26 @@ namespace SEP
 
 /* structs ------------------------------------------------------------------*/
 
+/* sep_line_reader
+ *
+ * Reads `n` pixels of row `y` of an image, starting at column `x`, and
+ * writes them as floats to `line`. The rows and columns are those of the
+ * sep_image (0 to w-1 and 0 to h-1). `context` is the `readcontext`
+ * member of the sep_image. Returns 0 on success, or an error status that
+ * is passed back to the caller of the SEP function that read the line.
+ */
+typedef int (*sep_line_reader)(void *context, int y, int x, int n, float *line);
+
 /* sep_image
  *
  * Represents an image, including data, noise and mask arrays, and
  * gain.
+ *
+ * If `readline` is set, the data array is not used at all. Instead the
+ * image data is read one line at a time through `readline`, so the caller
+ * can convert its own data type, read from a larger buffer or subtract a
+ * background as each line is needed, without making a copy of the image.
+ * `dtype` is ignored in that case.
  */
 typedef struct
 {
@@ -84,6 +100,8 @@ typedef struct
     short noise_type;  /* interpretation of noise value                  */
     double gain;       /* (poisson counts / data unit)                   */
     double maskthresh; /* pixel considered masked if mask > maskthresh   */
+    sep_line_reader readline; /* reads the data lines (can be NULL)      */
+    void *readcontext; /* passed to readline                             */
 } sep_image;
 
 /* sep_bkg
@@ -162,6 +180,24 @@ int sep_background(sep_image *image,
                    sep_bkg **bkg);   /* OUTPUT                           */
 
 
+/* sep_background_init(), sep_background_rows(), sep_background_finish()
+ *
+ * The same as sep_background(), split into steps so that the statistics of
+ * separate bands of background rows can be computed at the same time.
+ * sep_background_init() allocates bkg for the whole image.  `image` only
+ * needs the width and height of the whole image here.
+ * sep_background_rows() computes the rows of background boxes jstart to
+ * jend.  Here `image` only has to hold those rows, starting at row
+ * jstart * bh of the whole image.  Calls for bands that don't overlap can
+ * run in parallel.
+ * sep_background_finish() filters the background map once all the rows are
+ * done.  bkg must be freed with sep_bkg_free() even if a step fails.
+ */
+int sep_background_init(sep_image *image, int bw, int bh, sep_bkg **bkg);
+int sep_background_rows(sep_image *image, sep_bkg *bkg, int jstart, int jend);
+int sep_background_finish(sep_bkg *bkg, int fw, int fh, double fthresh);
+
+
 /* sep_bkg_global[rms]()
  *
  * Get the estimate of the global background "median" or standard deviation.
@@ -189,6 +225,33 @@ int sep_bkg_line(sep_bkg *bkg, int y, void *line, int dtype);
 int sep_bkg_subline(sep_bkg *bkg, int y, void *line, int dtype);
 int sep_bkg_rmsline(sep_bkg *bkg, int y, void *line, int dtype);
 
+/* sep_bkg_linebuf
+ *
+ * Working space for sep_bkg_line_flt_range(), so that a caller evaluating
+ * many short pieces of background lines only allocates it once.  Zero it
+ * before the first use and free it with sep_bkg_linebuf_free().  Each
+ * thread needs its own.
+ */
+typedef struct
+{
+    float *node;
+    int nodesize;
+    float *dnode;
+    int dnodesize;
+    float *u;
+    int usize;
+} sep_bkg_linebuf;
+
+/* sep_bkg_line_flt_range()
+ *
+ * Evaluate the background at line `y` for the pixels x to x + w only.
+ * Line must be an array of w floats.  `buf` can be NULL, in which case
+ * the working space is allocated for this call only.
+ */
+int sep_bkg_line_flt_range(sep_bkg *bkg, int y, int x, int w, float *line,
+                           sep_bkg_linebuf *buf);
+void sep_bkg_linebuf_free(sep_bkg_linebuf *buf);
+
 
 /* sep_bkg_[sub,rms]array()
  *
@@ -141,6 +141,8 @@ typedef struct
     array_converter readline;  /* function to read a data line into buffer */
     int elsize;         /* size in bytes of one element in original data */
     int yoff;           /* line index in original data corresponding to bufptr */
+    sep_line_reader linereader; /* reads the data lines instead of dptr (can be NULL) */
+    void *readcontext;  /* passed to linereader */
 } arraybuffer;
 
 typedef struct
@@ -203,8 +205,17 @@ int get_array_writer(int dtype, array_writer *f, int *size);
 int get_array_subtractor(int dtype, array_writer *f, int *size);
 
 int addobjdeep(int objnb, objliststruct *objl1, objliststruct *objl2, int plistsize);
+/* Like addobjdeep, but the arrays of `objl2` only grow, and their allocated
+ * sizes (in objects and in pixels) are kept in `objsize` and `npixsize`, so a
+ * list that is emptied by setting nobj and npix to 0 is filled again without
+ * allocating. */
+int addobjdeep_buffered(int objnb, objliststruct *objl1, objliststruct *objl2, int plistsize,
+                        int *objsize, int *npixsize);
 
 int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE *out);
+int separate_kernel(float *conv, int convw, int convh, float *convx, float *convy);
+int convolve_separable(arraybuffer *buf, int y, float *convx, int convw, float *convy, int convh,
+                       PIXTYPE *hlines, int *hlineids, PIXTYPE *out);
 int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y, float *conv, int convw, int convh,
                    PIXTYPE *work, PIXTYPE *out, int noise_type);
 
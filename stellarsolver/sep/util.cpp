@@ -405,4 +405,55 @@ earlyexit:
     return MEMORY_ALLOC_ERROR;
 }
 
+int addobjdeep_buffered(int objnb, objliststruct *objl1, objliststruct *objl2, int plistsize,
+                        int *objsize, int *npixsize)
+{
+    objstruct	*objl2obj;
+    pliststruct	*plist1 = objl1->plist, *plist2;
+    int		fp, i, j, npx, objnb2, size;
+
+    fp = objl2->npix;
+    j = fp * plistsize;
+    objnb2 = objl2->nobj;
+    npx = objl1->obj[objnb].fdnpix;
+
+    /* grow the arrays by at least half of their size, so that adding objects
+     * one at a time only allocates a few times */
+    if (objnb2 + 1 > *objsize)
+    {
+        size = objnb2 + 1 > 2 * *objsize ? objnb2 + 1 : 2 * *objsize;
+        if (!(objl2obj = (objstruct *)realloc(objl2->obj, size * sizeof(objstruct))))
+            return MEMORY_ALLOC_ERROR;
+        objl2->obj = objl2obj;
+        *objsize = size;
+    }
+    if (fp + npx > *npixsize)
+    {
+        size = fp + npx > *npixsize + *npixsize / 2 ? fp + npx : *npixsize + *npixsize / 2;
+        if (!(plist2 = (pliststruct *)realloc(objl2->plist, (size_t)size * plistsize)))
+            return MEMORY_ALLOC_ERROR;
+        objl2->plist = plist2;
+        *npixsize = size;
+    }
+    objl2->nobj++;
+    objl2->npix += npx;
+
+    /* copy the plist */
+    plist2 = objl2->plist + j;
+    for(i = objl1->obj[objnb].firstpix; i != -1; i = PLIST(plist1 + i, nextpix))
+    {
+        memcpy(plist2, plist1 + i, (size_t)plistsize);
+        PLIST(plist2, nextpix) = (j += plistsize);
+        plist2 += plistsize;
+    }
+    PLIST(plist2 -= plistsize, nextpix) = -1;
+
+    /* copy the object itself */
+    objl2->obj[objnb2] = objl1->obj[objnb];
+    objl2->obj[objnb2].firstpix = fp * plistsize;
+    objl2->obj[objnb2].lastpix = j - plistsize;
+
+    return RETURN_OK;
+}
+
 }
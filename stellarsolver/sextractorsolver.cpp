@@ -6,6 +6,8 @@
     version 2 of the License, or (at your option) any later version.
 */
 #include "sextractorsolver.h"
+#include "solveworkqueue.h"
+#include "solverpool.h"
 
 using namespace SSolver;
 
@@ -18,7 +20,29 @@ SextractorSolver::SextractorSolver(ProcessType pType, ExtractorType eType, Solve
 
 SextractorSolver::~SextractorSolver()
 {
+    //A worker of the pool might still be returning from run, so this waits for it to let go of the solver
+    QMutexLocker locker(&m_PoolMutex);
+    while(m_PoolRuns > 0)
+        m_PoolDone.wait(&m_PoolMutex);
+}
+
+FITSImage::wcs_point *SextractorSolver::getWCSCoord()
+{
+    if(!wcs_coord && m_WCSGrid)
+        wcs_coord = m_WCSGrid->toArray();
+    return wcs_coord;
+}
 
+bool SextractorSolver::pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints)
+{
+    skyPoints.resize(pixelPoints.size());
+    bool allConverted = true;
+    for(int i = 0; i < pixelPoints.size(); i++)
+    {
+        if(!pixelToWCS(pixelPoints[i], skyPoints[i]))
+            allConverted = false;
+    }
+    return allConverted;
 }
 
 //This is a convenience function used to set all the scale parameters based on the FOV high and low values wit their units.
@@ -44,7 +68,75 @@ void SextractorSolver::setSearchPositionInDegrees(double ra, double dec)
     search_dec = dec;
 }
 
+bool SextractorSolver::takeNextWorkItem()
+{
+    if(!m_WorkQueue || m_WasAborted)
+        return false;
+    SolveWorkQueue::WorkItem item;
+    int itemNumber = 0;
+    if(!m_WorkQueue->takeNext(item, &itemNumber))
+        return false;
+
+    m_UseScale = item.useScale;
+    if(item.useScale)
+    {
+        scalelo = item.scaleLow;
+        scalehi = item.scaleHigh;
+        scaleunit = item.scaleUnit;
+    }
+    depthlo = item.depthLow;
+    depthhi = item.depthHigh;
+
+    if(m_SSLogLevel != LOG_OFF)
+    {
+        QString scaleText = item.useScale ? QString("Scale %1 to %2 %3").arg(scalelo).arg(scalehi).arg(getScaleUnitString()) : "All scales";
+        QString depthText = depthlo != -1 ? QString("Depth %1 to %2").arg(depthlo).arg(depthhi) : "All depths";
+        emit logOutput(QString("Work item %1 of %2: %3, %4").arg(itemNumber).arg(m_WorkQueue->count()).arg(scaleText).arg(depthText));
+    }
+    return true;
+}
+
 void SextractorSolver::execute()
 {
     run();
 }
+
+void SextractorSolver::launch()
+{
+    {
+        QMutexLocker locker(&m_PoolMutex);
+        m_PoolRuns++;
+    }
+    if(SolverPool::submit(this))
+        return;
+    {
+        QMutexLocker locker(&m_PoolMutex);
+        m_PoolRuns--;
+    }
+    start();
+}
+
+//This is called on the worker of the pool.  Nothing may use the solver after the lock is released, since it can be deleted right away.
+void SextractorSolver::runInPool()
+{
+    run();
+    QMutexLocker locker(&m_PoolMutex);
+    m_PoolRuns--;
+    m_PoolDone.wakeAll();
+}
+
+bool SextractorSolver::isWorking() const
+{
+    if(isRunning())
+        return true;
+    QMutexLocker locker(&m_PoolMutex);
+    return m_PoolRuns > 0;
+}
+
+void SextractorSolver::waitUntilDone()
+{
+    wait();
+    QMutexLocker locker(&m_PoolMutex);
+    while(m_PoolRuns > 0)
+        m_PoolDone.wait(&m_PoolMutex);
+}
@@ -11,8 +11,12 @@
 #include <QThread>
 #include <QRect>
 #include <QDir>
+#include <QSharedPointer>
+#include <QMutex>
+#include <QWaitCondition>
 #include "structuredefinitions.h"
 #include "parameters.h"
+#include "wcsgrid.h"
 
 //CFitsio Includes
 #include <fitsio.h>
@@ -26,6 +30,10 @@ extern "C" {
 
 using namespace SSolver;
 
+class SolveWorkQueue;
+class ExtractContextPool;
+class ImageRowSource;
+
 class SextractorSolver : public QThread
 {
         Q_OBJECT
@@ -43,14 +51,21 @@ class SextractorSolver : public QThread
         //These are the most important methods that you can use for the StellarSolver
         //This starts the process in a separate thread
         virtual void execute();
+        //This starts the process on a worker of the SolverPool if it is on, and otherwise in this solver's own thread
+        void launch();
+        //These check and wait for the process started with launch, wherever it is running
+        bool isWorking() const;
+        void waitUntilDone();
         virtual void abort() = 0;
         virtual SextractorSolver* spawnChildSolver(int n) = 0;
         virtual void cleanupTempFiles() = 0;
         //This will abort the solver
 
-        FITSImage::wcs_point *getWCSCoord()
+        //This is the full size array of WCS coordinates.  It only gets filled in from the WCS grid the first time it is requested.
+        FITSImage::wcs_point *getWCSCoord();
+        QSharedPointer<WCSGrid> getWCSGrid() const
         {
-            return wcs_coord;
+            return m_WCSGrid;
         };
         virtual void computeWCSCoord() = 0;
         virtual bool appendStarsRAandDEC(QList<FITSImage::Star> &stars) = 0;
@@ -66,6 +81,10 @@ class SextractorSolver : public QThread
 
         Parameters m_ActiveParameters;                  //The currently set parameters for StellarSolver
         QStringList indexFolderPaths;       //This is the list of folder paths that the solver will use to search for index files
+        QSharedPointer<const QList<index_t *>> sharedIndexes;  //If this is set, the internal solver uses these already loaded index files instead of loading its own
+        QSharedPointer<SolveWorkQueue> m_WorkQueue;  //If this is set, this child solver keeps taking work items from the queue until one solves
+        QSharedPointer<ExtractContextPool> m_ExtractContexts;  //If this is set, the internal extractor reuses the buffers kept in it instead of allocating new ones
+        QSharedPointer<ImageRowSource> m_RowSource;  //If this is set, the internal extractor reads the image from it a band of rows at a time instead of from the image buffer
 
         //Astrometry Scale Parameters, These are not saved parameters and change for each image, use the methods to set them
         bool m_UseScale = false;             //Whether or not to use the image scale parameters
@@ -106,6 +125,8 @@ class SextractorSolver : public QThread
         void setSearchPositionInDegrees(double ra, double dec);
         int depthlo = -1;                       //This is the low depth of this child solver
         int depthhi = -1;                       //This is the high depth of this child solver
+        //This sets the scale and depth range of the next item in the work queue, it returns false if there is no more work
+        bool takeNextWorkItem();
 
 
         const FITSImage::Background &getBackground() const
@@ -140,6 +161,11 @@ class SextractorSolver : public QThread
         {
             return m_HasExtracted;
         };
+        //For a child solver that lost the race to another child, this is how many milliseconds it took to stop after the other one solved
+        qint64 getTimeToStop() const
+        {
+            return m_TimeToStop;
+        };
         bool isCalculatingHFR()
         {
             return m_ProcessType == EXTRACT_WITH_HFR;
@@ -154,6 +180,8 @@ class SextractorSolver : public QThread
         bool computingWCS = false;
 
         virtual bool pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &skyPoint) = 0;
+        //This converts a whole list of points at once.  It returns false if any of them could not be converted.
+        virtual bool pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints);
         virtual bool wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint) = 0;
 
 
@@ -188,8 +216,19 @@ class SextractorSolver : public QThread
         QString solvedfn;           //Filename whose creation tells astrometry.net it already solved the field.
 
         bool isChildSolver = false;              //This identifies that this solver is in fact a child solver.
-
-        //The pointer where the WCS Data will be computed
+        qint64 m_TimeToStop = -1;                //The time it took a child solver to stop after another child solved the image
+
+        //This counts the processes that are queued or running on a worker of the SolverPool.
+        //It is a count because the solver can be launched again for the WCS while the worker is still returning from the solve.
+        friend class SolverPool;
+        void runInPool();
+        int m_PoolRuns = 0;
+        mutable QMutex m_PoolMutex;
+        QWaitCondition m_PoolDone;
+
+        //The grid that computes the WCS coordinates of the image on demand
+        QSharedPointer<WCSGrid> m_WCSGrid;
+        //The pointer where the full size WCS Data will be filled in if it is requested
         FITSImage::wcs_point *wcs_coord{ nullptr };
 
         inline double convertToDegreeHeight(double scale)
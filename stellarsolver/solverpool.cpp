@@ -0,0 +1,120 @@
+/*  SolverPool, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "solverpool.h"
+#include "sextractorsolver.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QThreadStorage>
+#include <QtConcurrent>
+
+namespace
+{
+//The engine belongs to the worker thread, it is freed when the thread exits
+struct WorkerEngine
+{
+    WorkerEngine() : engine(engine_new()) {}
+    ~WorkerEngine()
+    {
+        engine_free(engine);
+    }
+    engine_t *engine;
+};
+
+struct SolverPoolState
+{
+    QMutex mutex;
+    QThreadPool *pool { nullptr };
+    int workers { 0 };
+    QThreadStorage<WorkerEngine *> engines;
+};
+
+//The state is kept in a function local static so that it is safe to use from other static objects
+SolverPoolState &state()
+{
+    static SolverPoolState s;
+    return s;
+}
+}
+
+void SolverPool::setEnabled(bool enabled, int workers)
+{
+    QMutexLocker locker(&state().mutex);
+    if(workers <= 0)
+        workers = QThread::idealThreadCount();
+    if(enabled && state().pool && state().workers == workers)
+        return;
+
+    //The old workers finish the solvers they have, then their threads exit and free their engines
+    if(state().pool)
+    {
+        state().pool->waitForDone();
+        delete state().pool;
+        state().pool = nullptr;
+        state().workers = 0;
+    }
+    if(!enabled)
+        return;
+
+    QThreadPool *pool = new QThreadPool;
+    pool->setExpiryTimeout(-1);
+    pool->setMaxThreadCount(workers);
+
+    //This starts all the threads and their engines now, each one waits until all of them are running so they can't share a thread
+    QSemaphore started;
+    QSemaphore release;
+    for(int i = 0; i < workers; i++)
+    {
+        QtConcurrent::run(pool, [&started, &release]()
+        {
+            if(!state().engines.hasLocalData())
+                state().engines.setLocalData(new WorkerEngine);
+            started.release();
+            release.acquire();
+        });
+    }
+    started.acquire(workers);
+    release.release(workers);
+    pool->waitForDone();
+
+    state().pool = pool;
+    state().workers = workers;
+}
+
+bool SolverPool::isEnabled()
+{
+    QMutexLocker locker(&state().mutex);
+    return state().pool != nullptr;
+}
+
+int SolverPool::workerCount()
+{
+    QMutexLocker locker(&state().mutex);
+    return state().workers;
+}
+
+bool SolverPool::submit(SextractorSolver *solver)
+{
+    QMutexLocker locker(&state().mutex);
+    if(!state().pool)
+        return false;
+    QtConcurrent::run(state().pool, [solver]()
+    {
+        solver->runInPool();
+    });
+    return true;
+}
+
+engine_t *SolverPool::workerEngine()
+{
+    if(!state().engines.hasLocalData())
+        return nullptr;
+    return state().engines.localData()->engine;
+}
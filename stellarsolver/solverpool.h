@@ -0,0 +1,36 @@
+/*  SolverPool, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/engine.h"
+}
+
+class SextractorSolver;
+
+//This is a process wide set of worker threads that stay around between solves, for programs that solve many images in a row.
+//When it is on, the solvers run on one of these workers instead of starting a new thread for each extraction or solve,
+//and the parallel solvers of one solve are queued on them too.  Each worker also keeps its own astrometry.net engine
+//that the internal solver resets and uses again instead of making a new one every time.
+//When it is off, which is the default, each solver starts its own thread like before.
+class SolverPool
+{
+    public:
+        //This starts the workers, or stops them after they finish what they are doing.  0 workers means one for each core.
+        static void setEnabled(bool enabled, int workers = 0);
+        static bool isEnabled();
+        static int workerCount();
+
+        //This queues the solver to run on the next worker that is free, it returns false if the pool is off.
+        //Use SextractorSolver::launch instead of calling this.
+        static bool submit(SextractorSolver *solver);
+
+        //This is the engine kept by the worker this is called from, or nullptr if it is not called from one of the workers
+        static engine_t *workerEngine();
+};
@@ -0,0 +1,51 @@
+/*  SolveWorkQueue, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "solveworkqueue.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+
+SolveWorkQueue::SolveWorkQueue(const QVector<WorkItem> &items) : m_Items(items)
+{
+    std::stable_sort(m_Items.begin(), m_Items.end(), [](const WorkItem & a, const WorkItem & b)
+    {
+        return a.priority < b.priority;
+    });
+}
+
+bool SolveWorkQueue::takeNext(WorkItem &item, int *itemNumber)
+{
+    QMutexLocker locker(&m_Mutex);
+    if(m_Stopped || m_Next >= m_Items.count())
+        return false;
+    if(itemNumber)
+        *itemNumber = m_Next + 1;
+    item = m_Items.at(m_Next++);
+    return true;
+}
+
+void SolveWorkQueue::stop()
+{
+    QMutexLocker locker(&m_Mutex);
+    m_Stopped = true;
+}
+
+bool SolveWorkQueue::isStopped()
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Stopped;
+}
+
+int SolveWorkQueue::remaining()
+{
+    QMutexLocker locker(&m_Mutex);
+    if(m_Stopped)
+        return 0;
+    return m_Items.count() - m_Next;
+}
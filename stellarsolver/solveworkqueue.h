@@ -0,0 +1,54 @@
+/*  SolveWorkQueue, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include "parameters.h"
+
+#include <QMutex>
+#include <QVector>
+
+//This is the queue of work that the child solvers of one parallel solve share.
+//Instead of giving each child one fixed part of the search up front, the search is broken up into many small
+//work items of a scale range and a depth range, and each child takes the next item as soon as it is done with the last one,
+//so that all of them keep working until the image is solved or the queue is empty.
+//The items are handed out in the order of how likely they are to solve the image quickly.
+class SolveWorkQueue
+{
+    public:
+        struct WorkItem
+        {
+            bool useScale;          //If this is false, the item searches the whole scale range of the parameters
+            double scaleLow;
+            double scaleHigh;
+            SSolver::ScaleUnits scaleUnit;
+            int depthLow;           //These are -1 if the item searches all the stars
+            int depthHigh;
+            double priority;        //Lower values are handed out first
+        };
+
+        //The items are sorted by priority, items with the same priority keep the order they were given in
+        explicit SolveWorkQueue(const QVector<WorkItem> &items);
+
+        //This gets the next item to work on, it returns false when the queue is empty or stopped
+        bool takeNext(WorkItem &item, int *itemNumber = nullptr);
+        //This is called once the image is solved or the solve is aborted so that the children don't take any more items
+        void stop();
+        bool isStopped();
+
+        int count() const
+        {
+            return m_Items.count();
+        };
+        int remaining();
+
+    private:
+        QMutex m_Mutex;
+        QVector<WorkItem> m_Items;
+        int m_Next { 0 };
+        bool m_Stopped { false };
+};
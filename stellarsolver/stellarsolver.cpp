@@ -17,7 +17,19 @@
 #include "sextractorsolver.h"
 #include "externalsextractorsolver.h"
 #include "onlinesolver.h"
+#include "indexcache.h"
+#include "indexcatalog.h"
+#include "solveworkqueue.h"
+#include "imagerowsource.h"
+#include "solverpool.h"
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/indexbin.h"
+}
+
 #include <QApplication>
+#include <QtConcurrent>
 #include <QSettings>
 
 using namespace SSolver;
@@ -31,6 +43,7 @@ StellarSolver::StellarSolver(ProcessType type, const FITSImage::Statistic &image
     m_ProcessType = type;
     m_ImageBuffer = imageBuffer;
     m_Subframe = QRect(0, 0, m_Statistics.width, m_Statistics.height);
+    m_ExtractContexts.reset(new ExtractContextPool());
 }
 
 StellarSolver::StellarSolver(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer,
@@ -41,10 +54,19 @@ StellarSolver::StellarSolver(const FITSImage::Statistic &imagestats, uint8_t con
     qRegisterMetaType<ExtractorType>("ExtractorType");
     m_ImageBuffer = imageBuffer;
     m_Subframe = QRect(0, 0, m_Statistics.width, m_Statistics.height);
+    m_ExtractContexts.reset(new ExtractContextPool());
 }
 StellarSolver::~StellarSolver()
 {
+    //Child solvers that are still running hold on to the shared index files themselves, the last one to finish releases them.
+    releaseSharedIndexes();
+}
 
+void StellarSolver::releaseSharedIndexes()
+{
+    if(m_SextractorSolver)
+        m_SextractorSolver->sharedIndexes.clear();
+    m_SharedIndexes.clear();
 }
 
 SextractorSolver* StellarSolver::createSextractorSolver()
@@ -88,6 +110,8 @@ SextractorSolver* StellarSolver::createSextractorSolver()
     solver->m_BasePath = m_BasePath;
     solver->m_ActiveParameters = params;
     solver->indexFolderPaths = indexFolderPaths;
+    solver->m_ExtractContexts = m_ExtractContexts;
+    solver->m_RowSource = m_RowSource;
     if(m_UseScale)
         solver->setSearchScale(m_ScaleLow, m_ScaleHigh, m_ScaleUnit);
     if(m_UsePosition)
@@ -130,7 +154,7 @@ void StellarSolver::extract(bool calculateHFR, QRect frame)
     useSubframe = frame.isNull() ? false : true;
     m_Subframe = frame;
     start();
-    m_SextractorSolver->wait();
+    m_SextractorSolver->waitUntilDone();
 }
 
 //This will allow the solver to gracefully disconnect, abort, finish, and get deleted
@@ -140,7 +164,7 @@ void StellarSolver::releaseSextractorSolver(SextractorSolver *solver)
 {
     if(solver != nullptr)
     {
-        if(solver->isRunning())
+        if(solver->isWorking())
         {
             connect(solver, &SextractorSolver::finished, solver, &SextractorSolver::deleteLater);
             solver->disconnect(this);
@@ -179,6 +203,7 @@ void StellarSolver::start()
         hasWCS = false;
         hasWCSCoord = false;
         wcs_coord = nullptr;
+        m_WCSGrid.clear();
     }
 
     //    if(m_isBlocking)
@@ -211,7 +236,7 @@ void StellarSolver::start()
     else
     {
         connect(m_SextractorSolver, &SextractorSolver::finished, this, &StellarSolver::processFinished);
-        m_SextractorSolver->start();
+        m_SextractorSolver->launch();
     }
 
 }
@@ -281,6 +306,15 @@ bool StellarSolver::checkParameters()
         }
     }
 
+    //Only the internal extractor can read an image from a row source, the others need the whole image
+    if(m_RowSource && !((m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER) || (m_ProcessType != SOLVE
+                        && m_SextractorType != EXTRACTOR_EXTERNAL)))
+    {
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("An image from a row source can only be used with the internal star extractor and the internal solver.");
+        return false;
+    }
+
     return true; //For now
 }
 
@@ -294,76 +328,172 @@ void StellarSolver::parallelSolve()
     m_ParallelSolversFinishedCount = 0;
     int threads = QThread::idealThreadCount();
 
+    releaseSharedIndexes();
+    //The search is broken up into many small work items that the child solvers take from a shared queue as they finish the last one,
+    //so a child that gets through its part of the search quickly doesn't sit idle while another one is still working.
+    double minScale;
+    double maxScale;
+    ScaleUnits units;
+    if(m_UseScale)
+    {
+        minScale = m_ScaleLow;
+        maxScale = m_ScaleHigh;
+        units = m_ScaleUnit;
+    }
+    else
+    {
+        minScale = params.minwidth;
+        maxScale = params.maxwidth;
+        units = DEG_WIDTH;
+    }
+    int sourceNum = 200;
+    if(params.keepNum != 0)
+        sourceNum = params.keepNum;
+
+    //Every item restarts astrometry.net, which is quick for the internal solver, but the external solver starts a new process for each one.
+    bool internalSolver = m_SolverType == SOLVER_STELLARSOLVER;
+    int scaleSlices = 1;
+    int depthStep = 0;
     if(params.multiAlgorithm == MULTI_SCALES)
     {
-        //Attempt to search on multiple scales
-        //Note, originally I had each parallel solver getting equal ranges, but solves are faster on bigger scales
-        //So now I'm giving the bigger scale solvers more of a range to work with.
-        double minScale;
-        double maxScale;
-        ScaleUnits units;
-        if(m_UseScale)
-        {
-            minScale = m_ScaleLow;
-            maxScale = m_ScaleHigh;
-            units = m_ScaleUnit;
-        }
-        else
-        {
-            minScale = params.minwidth;
-            maxScale = params.maxwidth;
-            units = DEG_WIDTH;
-        }
-        double scaleConst = (maxScale - minScale) / pow(threads, 2);
-        if(m_SSLogLevel != LOG_OFF)
-            emit logOutput(QString("Starting %1 threads to solve on multiple scales").arg(threads));
-        for(double thread = 0; thread < threads; thread++)
-        {
-            double low = minScale + scaleConst * pow(thread, 2);
-            double high = minScale + scaleConst * pow(thread + 1, 2);
-            SextractorSolver *solver = m_SextractorSolver->spawnChildSolver(thread);
-            connect(solver, &SextractorSolver::finished, this, &StellarSolver::finishParallelSolve);
-            solver->setSearchScale(low, high, units);
-            parallelSolvers.append(solver);
-            if(m_SSLogLevel != LOG_OFF)
-                emit logOutput(QString("Solver # %1, Low %2, High %3 %4").arg(parallelSolvers.count()).arg(low).arg(high).arg(
-                                   getScaleUnitString()));
-        }
+        scaleSlices = internalSolver ? threads * 4 : threads * 2;
+        if(internalSolver)
+            depthStep = qMax(10, sourceNum / 4);
     }
     //Note: it might be useful to do a parallel solve on multiple positions, but I am afraid
     //that since it searches in a circle around the search position, it might be difficult to make it
     //search a square grid without either missing sections of sky or overlapping search regions.
     else if(params.multiAlgorithm == MULTI_DEPTHS)
     {
-        //Attempt to search on multiple depths
-        int sourceNum = 200;
-        if(params.keepNum != 0)
-            sourceNum = params.keepNum;
-        int inc = sourceNum / threads;
-        //We don't need an unnecessary number of threads
-        if(inc < 10)
-            inc = 10;
-        if(m_SSLogLevel != LOG_OFF)
-            emit logOutput(QString("Starting %1 threads to solve on multiple depths").arg(sourceNum / inc));
-        for(int i = 1; i < sourceNum; i += inc)
+        //We don't need depth ranges of less than 10 stars
+        depthStep = qMax(10, sourceNum / (internalSolver ? threads * 4 : threads));
+    }
+
+    QVector<SolveWorkQueue::WorkItem> items;
+    int depthBands = depthStep > 0 ? (sourceNum + depthStep - 2) / depthStep : 1;
+    for(int band = 0; band < depthBands; band++)
+    {
+        for(int slice = 0; slice < scaleSlices; slice++)
         {
-            SextractorSolver *solver = m_SextractorSolver->spawnChildSolver(i);
-            connect(solver, &SextractorSolver::finished, this, &StellarSolver::finishParallelSolve);
-            solver->depthlo = i;
-            solver->depthhi = i + inc;
-            parallelSolvers.append(solver);
-            if(m_SSLogLevel != LOG_OFF)
-                emit logOutput(QString("Child Solver # %1, Depth Low %2, Depth High %3").arg(parallelSolvers.count()).arg(i).arg(i + inc));
+            SolveWorkQueue::WorkItem item;
+            item.useScale = m_UseScale || scaleSlices > 1;
+            //The scale slices are equal steps in the log of the scale, so the bigger scales get more of a range to work with.
+            //Solves are faster on bigger scales, and the index files cover scales in steps like this too.
+            if(minScale > 0 && maxScale > minScale)
+            {
+                double ratio = maxScale / minScale;
+                item.scaleLow = minScale * pow(ratio, (double)slice / scaleSlices);
+                item.scaleHigh = minScale * pow(ratio, (double)(slice + 1) / scaleSlices);
+            }
+            else
+            {
+                item.scaleLow = minScale + (maxScale - minScale) * slice / scaleSlices;
+                item.scaleHigh = minScale + (maxScale - minScale) * (slice + 1) / scaleSlices;
+            }
+            item.scaleUnit = units;
+            item.depthLow = depthStep > 0 ? 1 + band * depthStep : -1;
+            item.depthHigh = depthStep > 0 ? qMin(sourceNum, (band + 1) * depthStep) : -1;
+
+            //The brightest stars are the most likely to be in the index files, so all the scales are searched with them first.
+            //Within a depth range, if the scale was given, the scales closest to the middle of that range are searched first,
+            //and otherwise the biggest scales are searched first since they solve the fastest.
+            double scaleRank;
+            if(m_UseScale)
+                scaleRank = qAbs((slice + 0.5) / scaleSlices - 0.5);
+            else
+                scaleRank = (double)(scaleSlices - slice) / scaleSlices;
+            item.priority = band + scaleRank;
+            items.append(item);
         }
     }
+    m_WorkQueue.reset(new SolveWorkQueue(items));
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Split the search into %1 work items on %2 scales and %3 depths").arg(items.count()).arg(scaleSlices).arg(
+                           depthBands));
+
+    //If the index files are loaded in parallel, the internal solver children all read one set of them loaded here, instead of each one loading its own copy.
+    //Otherwise, each child only loads the index files it needs as it uses them, since there might not be enough RAM to have all of them loaded at once.
+    if(m_SolverType == SOLVER_STELLARSOLVER && params.inParallel)
+    {
+        //If the position is known, only the index files near it are loaded, unless none of them are.
+        QStringList folders = indexFolderPaths;
+        bool usePosition = m_UsePosition;
+        double ra = m_SearchRA;
+        double dec = m_SearchDE;
+        double radius = params.search_radius;
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("Loading the index files to share between the child solvers");
+        m_IndexLoader = new QFutureWatcher<QSharedPointer<const QList<index_t *>>>(this);
+        connect(m_IndexLoader, &QFutureWatcher<QSharedPointer<const QList<index_t *>>>::finished, this,
+                &StellarSolver::launchParallelSolvers);
+        m_IndexLoader->setFuture(QtConcurrent::run([folders, usePosition, ra, dec, radius]()
+        {
+            QStringList indexFiles;
+            if(usePosition)
+            {
+                indexFiles = IndexCatalog::indexFilesNear(folders, ra, dec, radius);
+                IndexCatalog::prefetchAround(folders, ra, dec, radius);
+            }
+            if(indexFiles.isEmpty())
+            {
+                for(const IndexCatalog::Entry &entry : IndexCatalog::indexesIn(folders))
+                    indexFiles.append(entry.path);
+            }
+            return IndexCache::acquireShared(indexFiles);
+        }));
+        return;
+    }
+    launchParallelSolvers();
+}
+
+//This starts the child solvers of a parallel solve, once the shared index files are loaded if there are any
+void StellarSolver::launchParallelSolvers()
+{
+    if(m_IndexLoader)
+    {
+        m_SharedIndexes = m_IndexLoader->result();
+        m_IndexLoader->deleteLater();
+        m_IndexLoader = nullptr;
+        if(m_SharedIndexes->isEmpty())
+            m_SharedIndexes.clear();
+        else if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Loaded %1 index files to share between the child solvers").arg(m_SharedIndexes->count()));
+    }
+
+    //The solve was aborted while the index files were loading
+    if(m_WorkQueue->isStopped())
+    {
+        releaseSharedIndexes();
+        m_WorkQueue.clear();
+        m_isRunning = false;
+        m_HasFailed = true;
+        emit ready();
+        emit finished();
+        return;
+    }
+    m_SextractorSolver->sharedIndexes = m_SharedIndexes;
+
+    //There is no point in having more child solvers than work items
+    int threads = QThread::idealThreadCount();
+    int workers = qMin(threads, m_WorkQueue->count());
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Starting %1 threads to solve the work items").arg(workers));
+    for(int i = 0; i < workers; i++)
+    {
+        SextractorSolver *solver = m_SextractorSolver->spawnChildSolver(i);
+        connect(solver, &SextractorSolver::finished, this, &StellarSolver::finishParallelSolve);
+        solver->m_WorkQueue = m_WorkQueue;
+        solver->takeNextWorkItem();
+        parallelSolvers.append(solver);
+    }
     for(auto solver : parallelSolvers)
-        solver->start();
+        solver->launch();
 }
 
 bool StellarSolver::parallelSolversAreRunning() const
 {
     for(auto solver : parallelSolvers)
-        if(solver->isRunning())
+        if(solver->isWorking())
             return true;
     return false;
 }
@@ -385,7 +515,7 @@ void StellarSolver::processFinished(int code)
                     solverWithWCS->computingWCS = true;
                     disconnect(solverWithWCS, &SextractorSolver::finished, this, &StellarSolver::processFinished);
                     connect(solverWithWCS, &SextractorSolver::finished, this, &StellarSolver::finishWCS);
-                    solverWithWCS->start();
+                    solverWithWCS->launch();
                 }
             }
             m_HasSolved = true;
@@ -433,10 +563,12 @@ void StellarSolver::finishParallelSolve(int success)
 
     if(success == 0 && !m_HasSolved)
     {
+        if(m_WorkQueue)
+            m_WorkQueue->stop();
         for(auto solver : parallelSolvers)
         {
             disconnect(solver, &SextractorSolver::logOutput, this, &StellarSolver::logOutput);
-            if(solver != reportingSolver && solver->isRunning())
+            if(solver != reportingSolver && solver->isWorking())
                 solver->abort();
         }
         if(m_SSLogLevel != LOG_OFF)
@@ -457,7 +589,7 @@ void StellarSolver::finishParallelSolve(int success)
             disconnect(solverWithWCS, &SextractorSolver::finished, this, &StellarSolver::finishParallelSolve);
             connect(solverWithWCS, &SextractorSolver::finished, this, &StellarSolver::finishWCS);
             connect(solverWithWCS, &SextractorSolver::logOutput, this, &StellarSolver::logOutput);
-            solverWithWCS->start();
+            solverWithWCS->launch();
         }
         if(m_SextractorType != EXTRACTOR_BUILTIN) //Note this is just cleaning up the files from the star extraction done prior to the parallel solve.  So for built in, it doesn't even do it, so no files to clean up
             m_SextractorSolver->cleanupTempFiles();
@@ -468,10 +600,15 @@ void StellarSolver::finishParallelSolve(int success)
     {
         if(m_SSLogLevel != LOG_OFF && !m_HasSolved)
             emit logOutput(QString("Child solver: %1 did not solve or was aborted").arg(whichSolver(reportingSolver)));
+        if(m_SSLogLevel == LOG_VERBOSE && m_HasSolved && reportingSolver->getTimeToStop() >= 0)
+            emit logOutput(QString("Child solver: %1 stopped %2 ms after the image was solved").arg(whichSolver(
+                               reportingSolver)).arg(reportingSolver->getTimeToStop()));
     }
 
     if(m_ParallelSolversFinishedCount == parallelSolvers.count())
     {
+        releaseSharedIndexes();
+        m_WorkQueue.clear();
 
         if(m_HasSolved)
         {
@@ -496,10 +633,11 @@ void StellarSolver::finishWCS()
 {
     if(solverWithWCS)
     {
-        wcs_coord = solverWithWCS->getWCSCoord();
+        //The full size coordinate array is not filled in until getWCSCoord is called
+        m_WCSGrid = solverWithWCS->getWCSGrid();
         if(m_ExtractorStars.count() > 0)
             solverWithWCS->appendStarsRAandDEC(m_ExtractorStars);
-        if(wcs_coord)
+        if(m_WCSGrid)
         {
             hasWCSCoord = true;
             emit wcsReady();
@@ -529,9 +667,18 @@ bool StellarSolver::pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &
     return false;
 }
 
-//This is the abort method.  The way that it works is that it creates a file.  Astrometry.net is monitoring for this file's creation in order to abort.
+bool StellarSolver::pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints)
+{
+    if(hasWCS && solverWithWCS)
+        return solverWithWCS->pixelToWCS(pixelPoints, skyPoints);
+    return false;
+}
+
+//This is the abort method.  It aborts all the solvers that are running, each solver stops in its own way.
 void StellarSolver::abort()
 {
+    if(m_WorkQueue)
+        m_WorkQueue->stop();
     for(auto solver : parallelSolvers)
         solver->abort();
     if(m_SextractorSolver)
@@ -544,11 +691,47 @@ bool StellarSolver::isRunning() const
 {
     if(parallelSolversAreRunning())
         return true;
-    if(m_SextractorSolver && m_SextractorSolver->isRunning())
+    if(m_SextractorSolver && m_SextractorSolver->isWorking())
         return true;
     return m_isRunning;
 }
 
+bool StellarSolver::loadNewImageBuffer(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer)
+{
+    if(isRunning())
+        return false;
+    //Nothing that was found in the last image belongs to this one, just as when start() runs again
+    m_ExtractorStars.clear();
+    m_SolverStars.clear();
+    numStars = 0;
+    m_HasExtracted = false;
+    m_HasSolved = false;
+    m_HasFailed = false;
+    hasWCS = false;
+    hasWCSCoord = false;
+    wcs_coord = nullptr;
+    m_WCSGrid.clear();
+    //The WCS of the last image would otherwise be used to find the RA and DEC of the stars extracted from this one
+    solverWithWCS = nullptr;
+    m_Statistics = imagestats;
+    m_ImageBuffer = imageBuffer;
+    m_RowSource.clear();
+    //A subframe that was set for the last image is kept for this one
+    if(useSubframe)
+        setUseSubframe(m_Subframe);
+    else
+        m_Subframe = QRect(0, 0, m_Statistics.width, m_Statistics.height);
+    return true;
+}
+
+bool StellarSolver::loadNewImageRowSource(const FITSImage::Statistic &imagestats, QSharedPointer<ImageRowSource> source)
+{
+    if(!loadNewImageBuffer(imagestats, nullptr))
+        return false;
+    m_RowSource = source;
+    return true;
+}
+
 //This method uses a fwhm value to generate the conv filter the sextractor will use.
 void StellarSolver::createConvFilterFromFWHM(Parameters *params, double fwhm)
 {
@@ -790,14 +973,87 @@ QStringList StellarSolver::getDefaultIndexFolderPaths()
 
 
 
+void StellarSolver::setUseIndexCache(bool enabled)
+{
+    IndexCache::setEnabled(enabled);
+}
+
+bool StellarSolver::usingIndexCache()
+{
+    return IndexCache::isEnabled();
+}
+
+int StellarSolver::preloadIndexes(const QStringList &indexFolders)
+{
+    return IndexCache::preload(indexFolders);
+}
+
+int StellarSolver::evictIndexes(const QStringList &indexPaths)
+{
+    return IndexCache::evict(indexPaths);
+}
+
+QStringList StellarSolver::getResidentIndexes()
+{
+    return IndexCache::residentIndexes();
+}
+
+QString StellarSolver::convertIndexFile(const QString &indexPath, const QString &outputPath)
+{
+    QString output = outputPath;
+    if(output.isEmpty())
+    {
+        //The converted files go into a folder of their own, since the solver would load both copies of an index in the same folder
+        QFileInfo info(indexPath);
+        QDir folder(info.absolutePath());
+        if(!folder.mkpath(INDEXBIN_FOLDER))
+            return QString();
+        output = folder.absoluteFilePath(QString(INDEXBIN_FOLDER) + "/" + info.completeBaseName() + INDEXBIN_SUFFIX);
+    }
+    else if(QFileInfo(output).absolutePath() == QFileInfo(indexPath).absolutePath())
+    {
+        return QString();
+    }
+    index_t *index = index_load(indexPath.toLocal8Bit().constData(), 0, nullptr);
+    if(!index)
+        return QString();
+    const int result = indexbin_write(index, output.toLocal8Bit().constData());
+    index_free(index);
+    return result == 0 ? output : QString();
+}
+
+void StellarSolver::setUseSolverPool(bool enabled, int workers)
+{
+    SolverPool::setEnabled(enabled, workers);
+}
+
+bool StellarSolver::usingSolverPool()
+{
+    return SolverPool::isEnabled();
+}
+
+//The array is filled in from the WCS grid the first time this is called, which takes a while for a large image.
+//Use getWCSGrid instead if you only need the coordinates of some of the pixels.
 FITSImage::wcs_point * StellarSolver::getWCSCoord()
 {
     if(hasWCS && hasWCSCoord)
+    {
+        if(!wcs_coord && solverWithWCS)
+            wcs_coord = solverWithWCS->getWCSCoord();
         return wcs_coord;
+    }
     else
         return nullptr;
 }
 
+QSharedPointer<WCSGrid> StellarSolver::getWCSGrid()
+{
+    if(hasWCS && hasWCSCoord)
+        return m_WCSGrid;
+    else
+        return QSharedPointer<WCSGrid>();
+}
+
 bool StellarSolver::appendStarsRAandDEC(QList<FITSImage::Star> &stars)
 {
     if(solverWithWCS)
@@ -853,18 +1109,20 @@ bool StellarSolver::enoughRAMisAvailableFor(QStringList indexFolders)
 {
     double totalSize = 0;
 
-    foreach(QString folder, indexFolders)
+    //The index catalogue already knows which files are index files and how big they are
+    for(const IndexCatalog::Entry &entry : IndexCatalog::indexesIn(indexFolders))
     {
-        QDir dir(folder);
-        if(dir.exists())
-        {
-            dir.setNameFilters(QStringList() << "*.fits" << "*.fit");
-            QFileInfoList indexInfoList = dir.entryInfoList();
-            foreach(QFileInfo indexInfo, indexInfoList)
-                totalSize += indexInfo.size();
-        }
-
+        //Index files that are already in the index cache won't take any more RAM
+        if(!IndexCache::isResident(entry.path))
+            totalSize += entry.size;
     }
+
+    //The internal solver's child solvers share one loaded set of index files, but the external solvers are separate
+    //processes that each load their own copy, so the RAM needed goes up with the number of threads.
+    int copies = 1;
+    if(params.multiAlgorithm != NOT_MULTI && m_SolverType == SOLVER_LOCALASTROMETRY)
+        copies = QThread::idealThreadCount();
+    totalSize *= copies;
     double availableRAM = 0;
     double totalRAM = 0;
     getAvailableRAM(availableRAM, totalRAM);
@@ -881,6 +1139,8 @@ bool StellarSolver::enoughRAMisAvailableFor(QStringList indexFolders)
         emit logOutput(
             QString("Evaluating Installed RAM for inParallel Option.  Total Size of Index files: %1 GB, Installed RAM: %2 GB, Free RAM: %3 GB").arg(
                 totalSize / bytesInGB).arg(totalRAM / bytesInGB).arg(availableRAM / bytesInGB));
+        if(copies > 1)
+            emit logOutput(QString("Note: The total includes a copy of the index files for each of the %1 external solvers").arg(copies));
 #if defined(Q_OS_OSX)
         emit logOutput("Note: Free RAM for now is reported as Installed RAM on MacOS until I figure out how to get available RAM");
 #endif
@@ -12,6 +12,7 @@
 #include "sextractorsolver.h"
 #include "parameters.h"
 #include "version.h"
+#include "imagerowsource.h"
 
 //QT Includes
 #include <QDir>
@@ -21,6 +22,7 @@
 #include <QVector>
 #include <QRect>
 #include <QPointer>
+#include <QFutureWatcher>
 
 using namespace SSolver;
 
@@ -162,6 +164,28 @@ class StellarSolver : public QObject
         static QList<SSolver::Parameters> loadSavedOptionsProfiles(QString savedOptionsProfiles);
         static QStringList getDefaultIndexFolderPaths();
 
+        //These static methods control the index cache that is shared by all StellarSolver objects in this process.
+        //When it is on, the internal solver keeps the index files loaded between solves instead of reloading them every time.
+        static void setUseIndexCache(bool enabled);
+        static bool usingIndexCache();
+        //This loads the index files in these folders into the cache (turning it on), and returns how many are resident.
+        static int preloadIndexes(const QStringList &indexFolders);
+        //This unloads the given index files from the cache, or all of them if no paths are given.
+        static int evictIndexes(const QStringList &indexPaths = QStringList());
+        static QStringList getResidentIndexes();
+        //This converts an astrometry.net index file to the native format, which the internal solver maps in place instead of reading.
+        //If no output path is given, the new file is written with the .ssidx suffix to the "ssidx" folder inside the folder of the old one.
+        //The index folders are not searched recursively, so the solver doesn't load both copies of each index.
+        //Use that folder in the index folder paths in place of the old one to solve with the converted files.
+        //An output path in the same folder as the old file is refused for the same reason.
+        //It returns the path of the new file, or an empty string if the conversion failed.
+        static QString convertIndexFile(const QString &indexPath, const QString &outputPath = QString());
+        //These static methods control the pool of solver threads that is shared by all StellarSolver objects in this process.
+        //When it is on, the solvers run on workers that are started once instead of starting new threads for every solve.
+        //0 workers means one for each core.
+        static void setUseSolverPool(bool enabled, int workers = 0);
+        static bool usingSolverPool();
+
 
         //Accessor Method for external classes
         int getNumStarsFound() const
@@ -221,6 +245,15 @@ class StellarSolver : public QObject
             return m_CalculateHFR;
         }
 
+        //This gives the StellarSolver the next image to work on, so the same StellarSolver can be used for a series of images,
+        //such as the frames of a guide camera, and reuse the buffers it kept from the last one.
+        //It does nothing and returns false while the StellarSolver is running.
+        bool loadNewImageBuffer(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer);
+        //This gives the StellarSolver an image to read a band of rows at a time from the source, instead of an image buffer,
+        //for images that are too big to keep in memory.  Only the internal extractor and solver can use it, and it isn't downsampled.
+        //ImageRowSource::fromFITSFile fills in the statistics for a FITS file.
+        bool loadNewImageRowSource(const FITSImage::Statistic &imagestats, QSharedPointer<ImageRowSource> source);
+
         void setUseSubframe(QRect frame);
         void clearSubFrame()
         {
@@ -245,14 +278,18 @@ class StellarSolver : public QObject
         }
 
         virtual FITSImage::wcs_point *getWCSCoord();
+        //This computes the WCS coordinates of the image lazily, only for the parts of the image that are used
+        QSharedPointer<WCSGrid> getWCSGrid();
 
         bool pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &skyPoint);
+        bool pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints);
         bool wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint);
 
 
     public slots:
         void processFinished(int code);
         void parallelSolve();
+        void launchParallelSolvers();
         void finishParallelSolve(int success);
         void finishWCS();
 
@@ -299,6 +336,18 @@ class StellarSolver : public QObject
         QRect m_Subframe;
         bool m_isRunning {false};
         QList<SextractorSolver*> parallelSolvers;
+        //These are the index files loaded once for all the parallel solvers to share.  Each child solver holds them too,
+        //so they are released when the last of them is done, even if this StellarSolver is deleted first.
+        QSharedPointer<const QList<index_t *>> m_SharedIndexes;
+        //This loads the shared index files in another thread, so that starting a solve doesn't block the thread it was started on
+        QFutureWatcher<QSharedPointer<const QList<index_t *>>> *m_IndexLoader {nullptr};
+        //This is the queue of work items that the parallel solvers take from until the image is solved
+        QSharedPointer<SolveWorkQueue> m_WorkQueue;
+        //These are the buffers of the internal extractor, which are kept from one image to the next
+        QSharedPointer<ExtractContextPool> m_ExtractContexts;
+        //If this is set, the image is read from it instead of from m_ImageBuffer
+        QSharedPointer<ImageRowSource> m_RowSource;
+        void releaseSharedIndexes();
         QPointer<SextractorSolver> m_SextractorSolver;
         QPointer<SextractorSolver> solverWithWCS;
         int m_ParallelSolversFinishedCount {0};
@@ -342,6 +391,7 @@ class StellarSolver : public QObject
         bool hasWCS {false};        //This boolean gets set if the StellarSolver has WCS data to retrieve
         bool hasWCSCoord{false};    //This boolean gets set if the Stellrsolver has already computed WCS Coordinates
         FITSImage::wcs_point * wcs_coord {nullptr};
+        QSharedPointer<WCSGrid> m_WCSGrid;
 
         bool wasAborted {false};
         // This is the cancel file path that astrometry.net monitors.  If it detects this file, it aborts the solve
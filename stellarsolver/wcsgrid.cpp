@@ -0,0 +1,225 @@
+/*  WCSGrid, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "wcsgrid.h"
+
+#include <QMutexLocker>
+#include <QtMath>
+
+namespace
+{
+//The number of lattice cells along each side of a tile, so a tile is 256 x 256 pixels with the default lattice step
+const int CELLS_PER_TILE = 16;
+
+//This is the angle in arcseconds between two positions on the sky
+double separationInArcsec(double ra1, double dec1, double ra2, double dec2)
+{
+    double sinDDec = qSin(qDegreesToRadians(dec2 - dec1) / 2.0);
+    double sinDRA = qSin(qDegreesToRadians(ra2 - ra1) / 2.0);
+    double a = sinDDec * sinDDec + qCos(qDegreesToRadians(dec1)) * qCos(qDegreesToRadians(dec2)) * sinDRA * sinDRA;
+    return qRadiansToDegrees(2.0 * qAsin(qSqrt(qMin(1.0, a)))) * 3600.0;
+}
+}
+
+WCSGrid::WCSGrid(int width, int height, const Evaluator &evaluator, int latticeStep, double maxErrorInPixels) :
+    m_Width(width), m_Height(height), m_Evaluator(evaluator), m_Step(qMax(1, latticeStep)), m_MaxError(maxErrorInPixels)
+{
+    int cellsX = qMax(1, (m_Width + m_Step - 1) / m_Step);
+    int cellsY = qMax(1, (m_Height + m_Step - 1) / m_Step);
+    m_TilesX = (cellsX + CELLS_PER_TILE - 1) / CELLS_PER_TILE;
+    m_TilesY = (cellsY + CELLS_PER_TILE - 1) / CELLS_PER_TILE;
+    m_Tiles = std::vector<std::atomic<Tile *>>(m_TilesX * m_TilesY);
+    for(auto &tile : m_Tiles)
+        tile.store(nullptr);
+}
+
+WCSGrid::~WCSGrid()
+{
+    for(auto &tile : m_Tiles)
+        delete tile.load();
+}
+
+int WCSGrid::tilesComputed() const
+{
+    int count = 0;
+    for(auto &tile : m_Tiles)
+    {
+        if(tile.load(std::memory_order_acquire))
+            count++;
+    }
+    return count;
+}
+
+bool WCSGrid::evaluate(double x, double y, double &ra, double &dec)
+{
+    QMutexLocker locker(&m_EvaluatorMutex);
+    return m_Evaluator(x, y, ra, dec);
+}
+
+WCSGrid::Tile *WCSGrid::tileAt(int tileX, int tileY)
+{
+    Tile *tile = m_Tiles[tileY * m_TilesX + tileX].load(std::memory_order_acquire);
+    if(tile)
+        return tile;
+    QMutexLocker locker(&m_TileMutex);
+    //Another thread might have computed it while this one was waiting
+    tile = m_Tiles[tileY * m_TilesX + tileX].load(std::memory_order_acquire);
+    if(!tile)
+    {
+        tile = computeTile(tileX, tileY);
+        m_Tiles[tileY * m_TilesX + tileX].store(tile, std::memory_order_release);
+    }
+    return tile;
+}
+
+//This evaluates the lattice points of one tile and checks each of its cells to see if it can be interpolated
+WCSGrid::Tile *WCSGrid::computeTile(int tileX, int tileY)
+{
+    const int points = CELLS_PER_TILE + 1;
+    Tile *tile = new Tile;
+    tile->points.resize(points * points);
+    tile->exact.resize(CELLS_PER_TILE * CELLS_PER_TILE);
+
+    const int x0 = tileX * CELLS_PER_TILE * m_Step;
+    const int y0 = tileY * CELLS_PER_TILE * m_Step;
+    for(int j = 0; j < points; j++)
+    {
+        for(int i = 0; i < points; i++)
+        {
+            LatticePoint &point = tile->points[j * points + i];
+            point.valid = evaluate(x0 + i * m_Step, y0 + j * m_Step, point.ra, point.dec);
+        }
+    }
+
+    for(int j = 0; j < CELLS_PER_TILE; j++)
+    {
+        for(int i = 0; i < CELLS_PER_TILE; i++)
+        {
+            const LatticePoint *corners[4] = { &tile->points[j * points + i], &tile->points[j * points + i + 1],
+                                               &tile->points[(j + 1) * points + i], &tile->points[(j + 1) * points + i + 1]
+                                             };
+            double ra, dec, exactRA, exactDec;
+            bool useExact = true;
+            if(interpolate(corners, 0.5, 0.5, ra, dec) &&
+                    evaluate(x0 + (i + 0.5) * m_Step, y0 + (j + 0.5) * m_Step, exactRA, exactDec))
+            {
+                //The pixel scale is estimated from the spacing of the lattice points
+                double pixelScale = separationInArcsec(corners[0]->ra, corners[0]->dec, corners[1]->ra, corners[1]->dec) / m_Step;
+                useExact = separationInArcsec(ra, dec, exactRA, exactDec) > m_MaxError * pixelScale;
+            }
+            tile->exact[j * CELLS_PER_TILE + i] = useExact;
+        }
+    }
+    return tile;
+}
+
+//This interpolates between the four corners of a cell.  The RA values are unwrapped around the first corner so that
+//cells that cross RA = 0 interpolate correctly.
+bool WCSGrid::interpolate(const LatticePoint *corners[4], double fx, double fy, double &ra, double &dec) const
+{
+    double cornerRA[4];
+    for(int c = 0; c < 4; c++)
+    {
+        if(!corners[c]->valid)
+            return false;
+        cornerRA[c] = corners[c]->ra;
+        if(cornerRA[c] - cornerRA[0] > 180.0)
+            cornerRA[c] -= 360.0;
+        else if(cornerRA[c] - cornerRA[0] < -180.0)
+            cornerRA[c] += 360.0;
+    }
+    double w00 = (1 - fx) * (1 - fy);
+    double w10 = fx * (1 - fy);
+    double w01 = (1 - fx) * fy;
+    double w11 = fx * fy;
+    ra = w00 * cornerRA[0] + w10 * cornerRA[1] + w01 * cornerRA[2] + w11 * cornerRA[3];
+    dec = w00 * corners[0]->dec + w10 * corners[1]->dec + w01 * corners[2]->dec + w11 * corners[3]->dec;
+    if(ra < 0)
+        ra += 360.0;
+    else if(ra >= 360.0)
+        ra -= 360.0;
+    return true;
+}
+
+bool WCSGrid::pixelToWCS(double x, double y, FITSImage::wcs_point &skyPoint)
+{
+    double ra, dec;
+    //Points outside the image are not covered by the grid
+    if(x < 0 || y < 0 || x > m_Width || y > m_Height)
+    {
+        if(!evaluate(x, y, ra, dec))
+            return false;
+        skyPoint.ra = ra;
+        skyPoint.dec = dec;
+        return true;
+    }
+
+    const int tileSize = CELLS_PER_TILE * m_Step;
+    int tileX = qMin(static_cast<int>(x) / tileSize, m_TilesX - 1);
+    int tileY = qMin(static_cast<int>(y) / tileSize, m_TilesY - 1);
+    Tile *tile = tileAt(tileX, tileY);
+
+    double localX = (x - tileX * tileSize) / m_Step;
+    double localY = (y - tileY * tileSize) / m_Step;
+    int cellX = qMin(static_cast<int>(localX), CELLS_PER_TILE - 1);
+    int cellY = qMin(static_cast<int>(localY), CELLS_PER_TILE - 1);
+
+    bool success;
+    if(tile->exact[cellY * CELLS_PER_TILE + cellX])
+    {
+        success = evaluate(x, y, ra, dec);
+    }
+    else
+    {
+        const int points = CELLS_PER_TILE + 1;
+        const LatticePoint *corners[4] = { &tile->points[cellY * points + cellX], &tile->points[cellY * points + cellX + 1],
+                                           &tile->points[(cellY + 1) * points + cellX], &tile->points[(cellY + 1) * points + cellX + 1]
+                                         };
+        success = interpolate(corners, localX - cellX, localY - cellY, ra, dec);
+    }
+    if(!success)
+        return false;
+    skyPoint.ra = ra;
+    skyPoint.dec = dec;
+    return true;
+}
+
+bool WCSGrid::pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &skyPoint)
+{
+    return pixelToWCS(pixelPoint.x(), pixelPoint.y(), skyPoint);
+}
+
+bool WCSGrid::pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints)
+{
+    skyPoints.resize(pixelPoints.size());
+    bool allConverted = true;
+    for(int i = 0; i < pixelPoints.size(); i++)
+    {
+        if(!pixelToWCS(pixelPoints[i].x(), pixelPoints[i].y(), skyPoints[i]))
+            allConverted = false;
+    }
+    return allConverted;
+}
+
+FITSImage::wcs_point *WCSGrid::toArray()
+{
+    FITSImage::wcs_point *coords = new FITSImage::wcs_point[m_Width * m_Height];
+    FITSImage::wcs_point *p = coords;
+    for (int y = 0; y < m_Height; y++)
+    {
+        for (int x = 0; x < m_Width; x++)
+        {
+            if(!pixelToWCS(x, y, *p))
+            {
+                p->ra = 0;
+                p->dec = 0;
+            }
+            p++;
+        }
+    }
+    return coords;
+}
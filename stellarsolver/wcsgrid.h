@@ -0,0 +1,95 @@
+/*  WCSGrid, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//Includes for this project
+#include "structuredefinitions.h"
+
+//QT Includes
+#include <QMutex>
+#include <QPointF>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+//This is a lazily evaluated grid of WCS coordinates for an image.
+//Instead of computing the RA and DEC of every pixel of the image right after solving, it evaluates the WCS
+//on a coarse lattice of points (every 16 pixels by default) and interpolates bilinearly between them.
+//The lattice is split into tiles that only get computed the first time a pixel inside them is requested.
+//When a tile is computed, each lattice cell is checked at its center against the exact WCS, and if the
+//interpolation error there is bigger than the allowed error, the pixels in that cell use the exact WCS instead.
+//That keeps the error bounded even close to the poles where RA changes very quickly across the image.
+class WCSGrid
+{
+    public:
+        //This computes the exact RA and DEC in degrees for a pixel position in the full size image
+        typedef std::function<bool(double x, double y, double &ra, double &dec)> Evaluator;
+
+        WCSGrid(int width, int height, const Evaluator &evaluator, int latticeStep = 16, double maxErrorInPixels = 0.05);
+        ~WCSGrid();
+
+        int width() const
+        {
+            return m_Width;
+        };
+        int height() const
+        {
+            return m_Height;
+        };
+
+        //These get the interpolated sky position of a pixel or a list of pixels, computing any tiles they touch
+        bool pixelToWCS(double x, double y, FITSImage::wcs_point &skyPoint);
+        bool pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &skyPoint);
+        bool pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints);
+
+        //This fills in a full size wcs_point array, like the solvers used to compute.  The caller owns the array and must delete [] it.
+        FITSImage::wcs_point *toArray();
+
+        //These report how much of the grid has been computed so far
+        int tileCount() const
+        {
+            return m_TilesX * m_TilesY;
+        };
+        int tilesComputed() const;
+
+    private:
+        struct LatticePoint
+        {
+            double ra;
+            double dec;
+            bool valid;
+        };
+        struct Tile
+        {
+            //The lattice points of the tile, including the points shared with the next tiles
+            QVector<LatticePoint> points;
+            //The cells in the tile that are too far off from the exact WCS to be interpolated
+            QVector<bool> exact;
+        };
+
+        Tile *tileAt(int tileX, int tileY);
+        Tile *computeTile(int tileX, int tileY);
+        bool evaluate(double x, double y, double &ra, double &dec);
+        bool interpolate(const LatticePoint *corners[4], double fx, double fy, double &ra, double &dec) const;
+
+        int m_Width;
+        int m_Height;
+        Evaluator m_Evaluator;
+        int m_Step;
+        double m_MaxError;
+        int m_TilesX;
+        int m_TilesY;
+
+        //The tiles are read without the lock once they are computed, the lock only protects creating them
+        std::vector<std::atomic<Tile *>> m_Tiles;
+        QMutex m_TileMutex;
+        //The evaluator is not guaranteed to be thread safe, so exact evaluations are serialized
+        QMutex m_EvaluatorMutex;
+};
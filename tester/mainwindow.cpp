@@ -875,7 +875,7 @@ void MainWindow::solveImage()
     if(hasWCSData)
     {
         hasWCSData = false;
-        delete [] wcs_coord;
+        wcsGrid.clear();
     }
 
     //Since this tester uses it many times, it doesn't *need* to replace the stellarsolver every time
@@ -1167,11 +1167,11 @@ bool MainWindow::solverComplete()
 bool MainWindow::loadWCSComplete()
 {
     disconnect(stellarSolver.get(), &StellarSolver::wcsReady, this, &MainWindow::loadWCSComplete);
-    FITSImage::wcs_point * coord = stellarSolver->getWCSCoord();
-    if(coord)
+    QSharedPointer<WCSGrid> grid = stellarSolver->getWCSGrid();
+    if(grid)
     {
         hasWCSData = true;
-        wcs_coord = coord;
+        wcsGrid = grid;
         stars = stellarSolver->getStarList();
         hasHFRData = stellarSolver->isCalculatingHFR();
         if(stars.count() > 0)
@@ -1239,7 +1239,7 @@ bool MainWindow::imageLoad()
         disconnect(stellarSolver.get(), &StellarSolver::logOutput, this, &MainWindow::logOutput);
     if(hasWCSData)
     {
-        delete [] wcs_coord;
+        wcsGrid.clear();
         hasWCSData = false;
     }
 
@@ -2023,11 +2023,11 @@ void MainWindow::mouseMovedOverImage(QPoint location)
         }
 
         QString mouseText = "";
-        if(hasWCSData)
+        FITSImage::wcs_point skyPoint;
+        if(hasWCSData && wcsGrid->pixelToWCS(x, y, skyPoint))
         {
-            int index = x + y * stats.width;
-            mouseText = QString("RA: %1, DEC: %2, Value: %3").arg(StellarSolver::raString(wcs_coord[index].ra)).arg(
-                            StellarSolver::decString(wcs_coord[index].dec)).arg(getValue(x, y));
+            mouseText = QString("RA: %1, DEC: %2, Value: %3").arg(StellarSolver::raString(skyPoint.ra)).arg(
+                            StellarSolver::decString(skyPoint.dec)).arg(getValue(x, y));
         }
         else
             mouseText = QString("X: %1, Y: %2, Value: %3").arg(x).arg(y).arg(getValue(x, y));
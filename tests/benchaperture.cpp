@@ -0,0 +1,130 @@
+/*  Aperture benchmarks for the StellarSolver Internal Library
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#include <QtTest>
+#include <random>
+#include <vector>
+
+#include "sep.h"
+
+//These benchmarks measure the HFR of the stars of a synthetic frame the way StellarSolver does, with the fast aperture sums and with the general ones.
+//An image with a mask always takes the general path, so the benchmarks give the same image an empty mask to compare the two.
+class BenchAperture : public QObject
+{
+        Q_OBJECT
+
+    private slots:
+        void initTestCase();
+        void fastMatchesGeneral();
+        void hfr_data();
+        void hfr();
+
+    private:
+        //This measures the flux radius of every star, with or without the empty mask
+        void measure(bool general, std::vector<double> &radii);
+
+        static const int Width = 4000;
+        static const int Height = 3000;
+        static const int NumStars = 2000;
+        static const int MaxRadius = 50;
+        static const int Subpix = 5;
+
+        std::vector<float> m_Image;
+        std::vector<uint8_t> m_Mask;
+        std::vector<double> m_X, m_Y;
+};
+
+//The frame has noise and 2000 stars of different sizes and brightnesses, all from a fixed seed.
+void BenchAperture::initTestCase()
+{
+    std::mt19937 generator(7);
+    std::normal_distribution<double> noise(0.0, 5.0);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    m_Image.resize(Width * Height);
+    for (float &pixel : m_Image)
+        pixel = noise(generator);
+    m_Mask.assign(Width * Height, 0);
+
+    for (int i = 0; i < NumStars; i++)
+    {
+        const double cx = MaxRadius + unit(generator) * (Width - 2 * MaxRadius);
+        const double cy = MaxRadius + unit(generator) * (Height - 2 * MaxRadius);
+        const double flux = 1000 + 50000 * unit(generator);
+        const double sigma = 1.0 + 2.0 * unit(generator);
+        for (int y = static_cast<int>(cy) - 15; y <= static_cast<int>(cy) + 15; y++)
+            for (int x = static_cast<int>(cx) - 15; x <= static_cast<int>(cx) + 15; x++)
+            {
+                const double d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+                m_Image[y * Width + x] += flux / (2 * M_PI * sigma * sigma) * exp(-d2 / (2 * sigma * sigma));
+            }
+        m_X.push_back(cx);
+        m_Y.push_back(cy);
+    }
+}
+
+void BenchAperture::measure(bool general, std::vector<double> &radii)
+{
+    SEP::sep_image im = {};
+    im.data = m_Image.data();
+    im.dtype = SEP_TFLOAT;
+    im.w = im.raw_w = Width;
+    im.h = im.raw_h = Height;
+    im.noise_type = SEP_NOISE_NONE;
+    im.gain = 1.0;
+    if (general)
+    {
+        im.mask = m_Mask.data();
+        im.mdtype = SEP_TBYTE;
+        im.maskthresh = 0.0;
+    }
+
+    double fractions[2] = {0.5, 0.99};
+    radii.resize(2 * NumStars);
+    for (int i = 0; i < NumStars; i++)
+    {
+        double flux = 0;
+        short flag = 0;
+        double sum, sumerr, area;
+        SEP::sep_sum_circle(&im, m_X[i], m_Y[i], 3.5, 0, Subpix, 0, &sum, &sumerr, &area, &flag);
+        flux = sum;
+        SEP::sep_flux_radius(&im, m_X[i], m_Y[i], MaxRadius, 0, Subpix, 0, &flux, fractions, 2, &radii[2 * i], &flag);
+    }
+}
+
+//The fast sums add up the subpixels of a pixel in a different order, so the radii can only differ by rounding.
+void BenchAperture::fastMatchesGeneral()
+{
+    std::vector<double> fast, general;
+    measure(false, fast);
+    measure(true, general);
+    for (size_t i = 0; i < fast.size(); i++)
+        QVERIFY2(qAbs(fast[i] - general[i]) <= 1e-9 * qAbs(general[i]),
+                 qPrintable(QString("Radius %1 is %2 with the fast sums and %3 with the general ones").arg(i).arg(fast[i], 0, 'g', 17)
+                            .arg(general[i], 0, 'g', 17)));
+}
+
+void BenchAperture::hfr_data()
+{
+    QTest::addColumn<bool>("general");
+    QTest::newRow("fast") << false;
+    QTest::newRow("general") << true;
+}
+
+void BenchAperture::hfr()
+{
+    QFETCH(bool, general);
+    std::vector<double> radii;
+    QBENCHMARK
+    {
+        measure(general, radii);
+    }
+}
+
+QTEST_GUILESS_MAIN(BenchAperture)
+#include "benchaperture.moc"
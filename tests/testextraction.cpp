@@ -0,0 +1,189 @@
+/*  Extraction tests for the StellarSolver Internal Library
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#include <QtTest>
+#include <QThreadPool>
+#include <random>
+#include <vector>
+
+#include <fitsio.h>
+
+#include "stellarsolver.h"
+
+//These tests extract stars from a synthetic image, so they don't need any image files or index files.
+class TestExtraction : public QObject
+{
+        Q_OBJECT
+
+    private slots:
+        void initTestCase();
+        void cleanupTestCase();
+        void catalogDoesNotDependOnThreads();
+        void separableFilterMatchesTwoDimensionalFilter();
+
+    private:
+        //This extracts the stars of the test image with the given parameters and the global thread pool limited to the given number of threads
+        void extractWithThreads(int threads, QList<FITSImage::Star> &stars, const Parameters *params = nullptr);
+
+        FITSImage::Statistic m_Statistics;
+        std::vector<uint16_t> m_Image;
+        int m_DefaultThreads { 1 };
+};
+
+//The image has a sloped sky with noise, stars of many sizes and brightnesses, and close pairs of stars that have to be deblended.
+//Everything comes from a fixed seed, so the image is the same every time.
+void TestExtraction::initTestCase()
+{
+    const int width = 1600;
+    const int height = 1200;
+    std::mt19937 generator(42);
+    std::normal_distribution<double> noise(0.0, 12.0);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    std::vector<double> pixels(width * height);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            pixels[y * width + x] = 1000.0 + 0.05 * x + 0.08 * y + noise(generator);
+
+    auto addStar = [&](double cx, double cy, double flux, double sigma)
+    {
+        const int r = static_cast<int>(5 * sigma) + 1;
+        for (int y = std::max(0, static_cast<int>(cy) - r); y <= std::min(height - 1, static_cast<int>(cy) + r); y++)
+            for (int x = std::max(0, static_cast<int>(cx) - r); x <= std::min(width - 1, static_cast<int>(cx) + r); x++)
+            {
+                const double d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+                pixels[y * width + x] += flux / (2 * M_PI * sigma * sigma) * exp(-d2 / (2 * sigma * sigma));
+            }
+    };
+    for (int i = 0; i < 600; i++)
+    {
+        const double cx = 5 + unit(generator) * (width - 10);
+        const double cy = 5 + unit(generator) * (height - 10);
+        const double flux = 2000 * pow(200.0, unit(generator));
+        const double sigma = 1.2 + 2.0 * unit(generator);
+        addStar(cx, cy, flux, sigma);
+        if (i % 10 == 0)
+            addStar(cx + 3 + 2 * unit(generator), cy + 2 * unit(generator), flux * (0.3 + unit(generator)), sigma);
+    }
+
+    m_Image.resize(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++)
+        m_Image[i] = static_cast<uint16_t>(std::min(65535.0, std::max(0.0, pixels[i])));
+
+    m_Statistics.width = width;
+    m_Statistics.height = height;
+    m_Statistics.dataType = TUSHORT;
+    m_Statistics.bytesPerPixel = sizeof(uint16_t);
+    m_Statistics.samples_per_channel = width * height;
+    m_Statistics.size = m_Image.size() * sizeof(uint16_t);
+
+    m_DefaultThreads = QThreadPool::globalInstance()->maxThreadCount();
+}
+
+void TestExtraction::cleanupTestCase()
+{
+    QThreadPool::globalInstance()->setMaxThreadCount(m_DefaultThreads);
+}
+
+void TestExtraction::extractWithThreads(int threads, QList<FITSImage::Star> &stars, const Parameters *params)
+{
+    QThreadPool::globalInstance()->setMaxThreadCount(threads);
+    StellarSolver solver(EXTRACT_WITH_HFR, m_Statistics, reinterpret_cast<uint8_t const *>(m_Image.data()));
+    solver.setSSLogLevel(LOG_OFF);
+    if (params)
+        solver.setParameters(*params);
+    solver.extract(true);
+    QTRY_VERIFY_WITH_TIMEOUT(solver.sextractionDone() || solver.failed(), 60000);
+    QVERIFY(!solver.failed());
+    stars = solver.getStarList();
+}
+
+//The image is split into one partition for each thread, so the partitions differ from one thread count to the next.
+//Every object is deblended the same way in any partition, so the same stars have to be found, and only the rounding of their positions
+//in the partitions can change them in the last digits.  With the same number of threads, the stars have to be exactly the same every time.
+void TestExtraction::catalogDoesNotDependOnThreads()
+{
+    QList<FITSImage::Star> reference;
+    extractWithThreads(1, reference);
+    if (QTest::currentTestFailed())
+        return;
+    QVERIFY(reference.size() > 100);
+
+    for (int threads : {2, 3, 7, 16})
+    {
+        QList<FITSImage::Star> stars, again;
+        extractWithThreads(threads, stars);
+        if (QTest::currentTestFailed())
+            return;
+        extractWithThreads(threads, again);
+        if (QTest::currentTestFailed())
+            return;
+
+        QCOMPARE(again.size(), stars.size());
+        for (int i = 0; i < stars.size(); i++)
+            QVERIFY2(memcmp(&stars[i], &again[i], sizeof(FITSImage::Star)) == 0,
+                     qPrintable(QString("Star %1 changes from one run to the next with %2 threads").arg(i).arg(threads)));
+
+        QCOMPARE(stars.size(), reference.size());
+        for (const FITSImage::Star &star : reference)
+        {
+            bool found = false;
+            for (const FITSImage::Star &other : stars)
+            {
+                if (qAbs(other.x - star.x) < 1e-3 && qAbs(other.y - star.y) < 1e-3)
+                {
+                    found = other.numPixels == star.numPixels &&
+                            qAbs(other.flux - star.flux) <= 1e-4 * qAbs(star.flux) &&
+                            qAbs(other.HFR - star.HFR) <= 1e-4 * qAbs(star.HFR);
+                    break;
+                }
+            }
+            QVERIFY2(found, qPrintable(QString("The star at %1, %2 differs with %3 threads").arg(star.x).arg(star.y).arg(threads)));
+        }
+    }
+}
+
+//The separable filter adds the convolution up in a different order, so it can't give exactly the same stars as the two dimensional one.
+//With a large gaussian filter, where it matters, nearly every star has to be found again at the same place with nearly the same flux.
+void TestExtraction::separableFilterMatchesTwoDimensionalFilter()
+{
+    Parameters params;
+    StellarSolver::createConvFilterFromFWHM(&params, 5);
+
+    QList<FITSImage::Star> reference;
+    extractWithThreads(m_DefaultThreads, reference, &params);
+    if (QTest::currentTestFailed())
+        return;
+    QVERIFY(reference.size() > 100);
+
+    params.separableFilter = true;
+    QList<FITSImage::Star> stars;
+    extractWithThreads(m_DefaultThreads, stars, &params);
+    if (QTest::currentTestFailed())
+        return;
+    QVERIFY(qAbs(stars.size() - reference.size()) <= reference.size() / 100);
+
+    int matched = 0;
+    for (const FITSImage::Star &star : reference)
+    {
+        for (const FITSImage::Star &other : stars)
+        {
+            if (qAbs(other.x - star.x) < 0.01 && qAbs(other.y - star.y) < 0.01)
+            {
+                if (qAbs(other.flux - star.flux) <= 1e-3 * qAbs(star.flux))
+                    matched++;
+                break;
+            }
+        }
+    }
+    QVERIFY2(matched >= reference.size() * 99 / 100,
+             qPrintable(QString("Only %1 of %2 stars match with the separable filter").arg(matched).arg(reference.size())));
+}
+
+QTEST_GUILESS_MAIN(TestExtraction)
+#include "testextraction.moc"